@@ -0,0 +1,40 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Bindless variant of shader_instanced.frag, the texture is picked per object from the bindless array
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec4 cameraEye;
+    float time;
+    int stage;
+} ubo;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[]; // BINDLESS_MAX_TEXTURES, only written slots are valid
+
+layout(location = 0) in vec3 fragWorldPosition;
+layout(location = 1) in vec3 fragNormal;
+layout(location = 2) in vec2 fragTexCoord;
+layout(location = 3) flat in uint fragTextureSlot;
+
+layout(location = 0) out vec4 outColor;
+
+const vec3 LIGHT_DIRECTION = normalize(vec3(0.5, 1.0, 0.3));
+const float AMBIENT = 0.1;
+const float SPECULAR_STRENGTH = 0.5;
+const float SHININESS = 32.0;
+
+void main() {
+    // Neighbouring instances may use different textures, so the index isn't dynamically uniform
+    vec3 albedo = texture(textures[nonuniformEXT(fragTextureSlot)], fragTexCoord).rgb;
+    vec3 normal = normalize(fragNormal);
+    vec3 view_direction = normalize(ubo.cameraEye.xyz - fragWorldPosition);
+    vec3 half_vector = normalize(LIGHT_DIRECTION + view_direction);
+
+    float diffuse = max(dot(normal, LIGHT_DIRECTION), 0.0);
+    float specular = SPECULAR_STRENGTH * pow(max(dot(normal, half_vector), 0.0), SHININESS);
+
+    outColor = vec4(albedo * (AMBIENT + diffuse) + vec3(specular), 1.0);
+}
@@ -0,0 +1,54 @@
+#version 450
+
+// Bindless variant of shader_instanced.vert. The placement is read from the object record buffer instead of a
+// per instance vertex stream, gl_InstanceIndex already includes the batch's first record.
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec4 cameraEye;
+    float time;
+    int stage;
+} ubo;
+
+// Mirrors InstanceData in src/main.c
+struct ObjectRecord {
+    vec3 position;
+    uint textureSlot;
+    vec4 rotation; // Quaternion, xyzw
+    vec3 scale;
+    float padding;
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer ObjectRecords {
+    ObjectRecord records[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragWorldPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out uint fragTextureSlot;
+
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+    ObjectRecord record = records[gl_InstanceIndex];
+    vec3 instance_position = rotate(record.rotation, inPosition * record.scale) + record.position;
+    vec4 world_position = ubo.model * vec4(instance_position, 1.0);
+
+    // Inverse transpose of the non uniform scale, assumes ubo.model is a rigid transform
+    vec3 instance_normal = rotate(record.rotation, inNormal / record.scale);
+
+    fragWorldPosition = world_position.xyz;
+    fragNormal = normalize(mat3(ubo.model) * instance_normal);
+    fragTexCoord = inTexCoord;
+    fragTextureSlot = record.textureSlot;
+    gl_Position = ubo.proj * ubo.view * world_position;
+}
@@ -0,0 +1,35 @@
+#version 450
+
+layout(binding = 1) uniform sampler2D texSampler;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec4 cameraEye;
+    float time;
+    int stage;
+} ubo;
+
+layout(location = 0) in vec3 fragWorldPosition;
+layout(location = 1) in vec3 fragNormal;
+layout(location = 2) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+const vec3 LIGHT_DIRECTION = normalize(vec3(0.5, 1.0, 0.3));
+const float AMBIENT = 0.1;
+const float SPECULAR_STRENGTH = 0.5;
+const float SHININESS = 32.0;
+
+void main() {
+    vec3 albedo = texture(texSampler, fragTexCoord).rgb;
+    vec3 normal = normalize(fragNormal);
+    vec3 view_direction = normalize(ubo.cameraEye.xyz - fragWorldPosition);
+    vec3 half_vector = normalize(LIGHT_DIRECTION + view_direction);
+
+    float diffuse = max(dot(normal, LIGHT_DIRECTION), 0.0);
+    float specular = SPECULAR_STRENGTH * pow(max(dot(normal, half_vector), 0.0), SHININESS);
+
+    outColor = vec4(albedo * (AMBIENT + diffuse) + vec3(specular), 1.0);
+}
@@ -0,0 +1,42 @@
+#version 450
+
+// Same descriptor layout as shader_phong_stages, placement comes from the per instance stream.
+// Camera and time are read from the UBO, so the shader works with cached command buffers.
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec4 cameraEye;
+    float time;
+    int stage;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 3) in vec3 instancePosition;
+layout(location = 4) in vec4 instanceRotation; // Quaternion, xyzw
+layout(location = 5) in vec3 instanceScale;
+
+layout(location = 0) out vec3 fragWorldPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec2 fragTexCoord;
+
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+    vec3 instance_position = rotate(instanceRotation, inPosition * instanceScale) + instancePosition;
+    vec4 world_position = ubo.model * vec4(instance_position, 1.0);
+
+    // Inverse transpose of the non uniform scale, assumes ubo.model is a rigid transform
+    vec3 instance_normal = rotate(instanceRotation, inNormal / instanceScale);
+
+    fragWorldPosition = world_position.xyz;
+    fragNormal = normalize(mat3(ubo.model) * instance_normal);
+    fragTexCoord = inTexCoord;
+    gl_Position = ubo.proj * ubo.view * world_position;
+}
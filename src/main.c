@@ -14,23 +14,40 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
 #include <arm/limits.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <float.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <cglm/cglm.h>
 #include <cglm/quat.h>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tinyobj_loader_c.h>
-
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
 #define DEFAULT_WINDOW_WIDTH 800
 #define DEFAULT_WINDOW_HEIGHT 600
 #define PROJECT_NAME "Vulkan Engine"
 
+#define HEADLESS_DEFAULT_FRAMES 1000
+#define HEADLESS_DEFAULT_OUTPUT_PATH "./headless_frame.bin"
+
 #define NUM_MODELS 2
+#define INSTANCED_GRID_SIZE 48 // Spheres per side of the instanced floor
+#define INSTANCED_GRID_SPACING 0.75f
 
 #define ENABLE_VALIDATION_LAYERS true
 #define ALLOW_DEVICE_WITHOUT_INTEGRATED_GPU true
@@ -43,11 +60,22 @@
 
 #define REQUIRED_VULKAN_API_VERSION VK_API_VERSION_1_3
 
-#define REQUIRED_DEVICE_EXTENSIONS {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME}
+#define MAX_DEVICE_EXTENSIONS 2 // See getDeviceExtensions
+
+#define MAX_FRAMES_IN_FLIGHT 4 // Upper bound of g_frames_in_flight, sizes the per frame arrays
+#define DEFAULT_FRAMES_IN_FLIGHT 2
 
-#define MAX_FRAMES_IN_FLIGHT 2
+#define CULLING_WORKGROUP_SIZE 64 // Must match local_size_x in shaders/cull_instances.comp
+#define CULLING_MAX_BATCHES 16 // Instanced models that can be culled on the GPU at the same time
+
+#define BINDLESS_MAX_TEXTURES 4096 // Length of the sampler2D[] array in shaders/shader_bindless.frag
+#define BINDLESS_MAX_OBJECTS 65536 // ObjectRecords in the shared record buffer of the bindless path
+#define BINDLESS_FALLBACK_TEXTURE_SLOT 0 // Always holds the fallback texture, streamed textures follow it
+
+#define SIMD_ALIGNMENT 32 // Enough for AVX, SoA arrays are allocated with it
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define quat vec4
 
@@ -61,47 +89,14 @@ const float CAMERA_MAX_PITCH = 50.0f;
 
 const float CLIPPING_PLANE_NEAR = 0.1f;
 const float CLIPPING_PLANE_FAR = 100.0f;
+const float SCENE_ROTATION_SPEED = 0.5f; // Radians per second
 
 /* DEBUG FEATURE FLAGS */
-#define MALLOC_DEBUG true
-#define REALLOC_DEBUG true
-#define FREE_DEBUG true
-#define SCOPE_TIMER_ENABLED true
-
-typedef struct Timer {
-    clock_t start;
-    const char *file;
-    int line;
-    const char *func;
-    const char *info;
-} Timer;
-
-// Function to start the timer, with file, line, and function info
-void start_timer(Timer* t, const char* file, const int line, const char* func) {
-    t->start = clock();
-    t->file = file;
-    t->line = line;
-    t->func = func;
-}
-
-void stop_timer(const Timer* t) {
-    const clock_t end = clock();
-    const double elapsed = (double)(end - t->start) / CLOCKS_PER_SEC;
-
-    if(elapsed < 1.0) {
-        printf("[[DS-SCOPE_TIMER]] %s | File: %s | Line: %d | Function: %s | Elapsed time: %.3f milliseconds\n",
-                                   t->info, t->file, t->line, t->func, elapsed * 1000.0);
-    } else {
-        printf("[[DS-SCOPE_TIMER]] %s | File: %s | Line: %d | Function: %s | Elapsed time: %.3f seconds\n",
-                                   t->info, t->file, t->line, t->func, elapsed);
-    }
-}
-
-void timer_cleanup(const Timer* t) { stop_timer(t); }
-
-#define SCOPE_TIMER __attribute__((cleanup(timer_cleanup))) \
-Timer _timer_instance; \
-start_timer(&_timer_instance, __FILE__, __LINE__, __func__);
+#define MEMORY_ASSERT_NO_FRAME_ALLOCATIONS false // PANIC when a steady state frame allocates on the main thread
+#define MEMORY_STEADY_STATE_FRAME 100 // Frames before that may still fill caches and grow arrays
+#ifndef TRACING_ENABLED
+#define TRACING_ENABLED true // See "CPU tracing", false compiles every TRACE_* macro to nothing
+#endif
 
 // PANIC macro to print error details (with file, line, and function info) and abort
 // While not very clean I am explicitly fine with memory leaks when PANIC is called during the initialization
@@ -122,48 +117,278 @@ start_timer(&_timer_instance, __FILE__, __LINE__, __func__);
 
 #define PANIC_NOT_IMPLEMENTED(msg) PANIC("NOT_IMPLEMENTED");
 
-// If we are in debug mode (i.e., when NDEBUG is false), we use this malloc/realloc/free with metadata
+/*
+ * Memory tracking
+ *
+ * malloc, calloc, realloc, strdup, posix_memalign and free are routed through the tracked_* functions below. Every
+ * allocation carries an AllocationHeader with its size, which keeps live and peak bytes exact in every build. Debug
+ * builds also attribute each allocation to its call site. Every thread owns a fixed table of AllocationSite entries
+ * that only it inserts into, and the header points at the entry, so frees on other threads just add to that entry's
+ * counters and nothing takes a lock after a thread's first allocation. printMemoryReport lists the busiest call sites
+ * with a power of two size histogram and every call site still holding memory at shutdown.
+ */
 #ifndef NDEBUG
-    // Redefine malloc, realloc, and free macros to include file, line, function, and variable name metadata
-    #define malloc(size) debug_malloc(size, __FILE__, __LINE__, __func__)
-    #define realloc(ptr, size) debug_realloc(ptr, size, __FILE__, __LINE__, __func__)
-    #define free(ptr) debug_free(ptr, #ptr, __FILE__, __LINE__, __func__)
+#define MEMORY_TRACK_CALLSITES true
+#else
+#define MEMORY_TRACK_CALLSITES false
+#endif
+#define MEMORY_MAX_CALLSITES 512 // Per thread, a power of two
+#define MEMORY_MAX_THREADS 256
+#define MEMORY_NUM_SIZE_BUCKETS 32 // Powers of two, the last bucket takes everything bigger
+#define MEMORY_REPORT_TOP_CALLSITES 10
+#define MEMORY_HEADER_MAGIC 0xA110u
+
+typedef struct {
+    const char* file; // NULL while the entry is unused
+    const char* func;
+    int line;
+
+    // Allocations count on the allocating thread, frees on any thread
+    uint64_t num_allocations;
+    uint64_t num_frees;
+    uint64_t allocated_bytes;
+    uint64_t freed_bytes;
+    uint32_t size_histogram[MEMORY_NUM_SIZE_BUCKETS];
+} AllocationSite;
+
+typedef struct {
+    AllocationSite sites[MEMORY_MAX_CALLSITES]; // Open addressing on (file, line)
+    AllocationSite overflow; // Call sites that didn't fit anymore
+} AllocationSiteTable;
+
+// Right in front of every tracked allocation, keeps the malloc alignment of 16 bytes
+typedef struct {
+    AllocationSite* site; // NULL without MEMORY_TRACK_CALLSITES
+    uint64_t size : 44;
+    uint64_t offset_log2 : 4; // From the start of the underlying allocation to the end of the header
+    uint64_t magic : 16;
+} AllocationHeader;
+
+AllocationSiteTable* g_allocation_site_tables[MEMORY_MAX_THREADS];
+uint32_t g_num_allocation_site_tables = 0;
+pthread_mutex_t g_allocation_site_mutex = PTHREAD_MUTEX_INITIALIZER;
+__thread AllocationSiteTable* t_allocation_sites = NULL;
+__thread uint64_t t_num_allocations = 0; // Of the calling thread since it started, see getThreadAllocationCount
+
+uint64_t g_memory_num_allocations = 0;
+uint64_t g_memory_live_allocations = 0;
+uint64_t g_memory_live_bytes = 0;
+uint64_t g_memory_peak_bytes = 0;
+
+uint32_t getSizeBucket(const uint64_t size) {
+    if (size == 0) return 0;
+    const uint32_t bucket = 63 - (uint32_t)__builtin_clzll(size);
+    return bucket < MEMORY_NUM_SIZE_BUCKETS ? bucket : MEMORY_NUM_SIZE_BUCKETS - 1;
+}
+
+AllocationSite* AllocationSite_get(const char* file, const int line, const char* func) {
+    AllocationSiteTable* table = t_allocation_sites;
+    if (table == NULL) {
+        table = calloc(1, sizeof(AllocationSiteTable));
+        if (table == NULL) PANIC("[[DS-MEMORY]] Failed to allocate the call site table of a thread");
+        pthread_mutex_lock(&g_allocation_site_mutex);
+        // Threads past MEMORY_MAX_THREADS are still tracked, they are only missing from the call site report
+        if (g_num_allocation_site_tables < MEMORY_MAX_THREADS) {
+            g_allocation_site_tables[g_num_allocation_site_tables] = table;
+            __atomic_store_n(&g_num_allocation_site_tables, g_num_allocation_site_tables + 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&g_allocation_site_mutex);
+        t_allocation_sites = table;
+    }
+
+    const uint32_t first_slot = (uint32_t)((uintptr_t)file >> 3) * 31u + (uint32_t)line;
+    for (uint32_t probe = 0; probe < MEMORY_MAX_CALLSITES; probe++) {
+        AllocationSite* site = &table->sites[(first_slot + probe) & (MEMORY_MAX_CALLSITES - 1)];
+        if (site->file == file && site->line == line) return site;
+        if (site->file == NULL) {
+            site->func = func;
+            site->line = line;
+            __atomic_store_n(&site->file, file, __ATOMIC_RELEASE);
+            return site;
+        }
+    }
+    return &table->overflow;
+}
+
+// Fills the header at the end of the first 1 << offset_log2 bytes of memory and returns the memory after it
+void* Memory_track(void* memory, const size_t size, const uint32_t offset_log2, const char* file, const int line, const char* func) {
+    AllocationHeader* header = (AllocationHeader*)((char*)memory + ((size_t)1 << offset_log2)) - 1;
+    header->site = NULL;
+    header->size = size;
+    header->offset_log2 = offset_log2;
+    header->magic = MEMORY_HEADER_MAGIC;
+#if MEMORY_TRACK_CALLSITES
+    AllocationSite* site = AllocationSite_get(file, line, func);
+    __atomic_add_fetch(&site->num_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->allocated_bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->size_histogram[getSizeBucket(size)], 1, __ATOMIC_RELAXED);
+    header->site = site;
+#else
+    (void)file; (void)line; (void)func;
+#endif
 
-    // Debug malloc function with metadata
-    void* debug_malloc(const size_t size, const char* file, int line, const char* func) {
-        printf("[[DS-MEMORY]] malloc(size=%zu) called from file: %s, line: %d, function: %s, ", size, file, line, func);
+    t_num_allocations += 1;
+    __atomic_add_fetch(&g_memory_num_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_memory_live_allocations, 1, __ATOMIC_RELAXED);
+    const uint64_t live_bytes = __atomic_add_fetch(&g_memory_live_bytes, size, __ATOMIC_RELAXED);
+    uint64_t peak_bytes = __atomic_load_n(&g_memory_peak_bytes, __ATOMIC_RELAXED);
+    while (live_bytes > peak_bytes && !__atomic_compare_exchange_n(&g_memory_peak_bytes, &peak_bytes, live_bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    return header + 1;
+}
 
-        #undef malloc
-        void* ptr = malloc(size);  // Call the real malloc
-        #define malloc(size) debug_malloc(size, __FILE__, __LINE__, __func__)
+// Takes a tracked allocation out of the statistics and returns the start of its underlying memory
+void* Memory_untrack(void* ptr, const char* file, const int line, const char* func) {
+    AllocationHeader* header = (AllocationHeader*)ptr - 1;
+    if (header->magic != MEMORY_HEADER_MAGIC) PANIC("[[DS-MEMORY]] Freeing %p which isn't a live tracked allocation in file %s, line %d, function %s", ptr, file, line, func);
+    header->magic = 0;
 
-        if(ptr == NULL) PANIC("[[DS-MEMORY]] Failed to allocate %zu bytes in file %s, line %d, function %s", size, file, line, func);
-        printf("Pointer allocated at: %p\n", ptr);
-        return ptr;
+    const uint64_t size = header->size;
+    if (header->site != NULL) {
+        __atomic_add_fetch(&header->site->num_frees, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&header->site->freed_bytes, size, __ATOMIC_RELAXED);
     }
+    __atomic_sub_fetch(&g_memory_live_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&g_memory_live_bytes, size, __ATOMIC_RELAXED);
+    return (char*)(header + 1) - ((size_t)1 << header->offset_log2);
+}
+
+#define MEMORY_HEADER_OFFSET_LOG2 4 // log2(sizeof(AllocationHeader))
+
+void* tracked_malloc(const size_t size, const char* file, const int line, const char* func) {
+    void* memory = malloc(sizeof(AllocationHeader) + size);
+    if(memory == NULL) PANIC("[[DS-MEMORY]] Failed to allocate %zu bytes in file %s, line %d, function %s", size, file, line, func);
+    return Memory_track(memory, size, MEMORY_HEADER_OFFSET_LOG2, file, line, func);
+}
+
+void* tracked_calloc(const size_t count, const size_t size, const char* file, const int line, const char* func) {
+    if(size != 0 && count > (SIZE_MAX - sizeof(AllocationHeader)) / size) PANIC("[[DS-MEMORY]] calloc(%zu, %zu) overflows in file %s, line %d, function %s", count, size, file, line, func);
+    void* memory = calloc(1, sizeof(AllocationHeader) + count * size);
+    if(memory == NULL) PANIC("[[DS-MEMORY]] Failed to allocate %zu bytes in file %s, line %d, function %s", count * size, file, line, func);
+    return Memory_track(memory, count * size, MEMORY_HEADER_OFFSET_LOG2, file, line, func);
+}
+
+// Counts as a free of the old block and an allocation at the realloc's call site
+void* tracked_realloc(void* ptr, const size_t size, const char* file, const int line, const char* func) {
+    if(ptr == NULL) return tracked_malloc(size, file, line, func);
+    if(((AllocationHeader*)ptr - 1)->offset_log2 != MEMORY_HEADER_OFFSET_LOG2) PANIC("[[DS-MEMORY]] realloc of an aligned allocation in file %s, line %d, function %s", file, line, func);
+    void* memory = realloc(Memory_untrack(ptr, file, line, func), sizeof(AllocationHeader) + size);
+    if(memory == NULL) PANIC("[[DS-MEMORY]] Failed to reallocate %zu bytes in file %s, line %d, function %s", size, file, line, func);
+    return Memory_track(memory, size, MEMORY_HEADER_OFFSET_LOG2, file, line, func);
+}
+
+char* tracked_strdup(const char* string, const char* file, const int line, const char* func) {
+    const size_t size = strlen(string) + 1;
+    return memcpy(tracked_malloc(size, file, line, func), string, size);
+}
+
+int tracked_posix_memalign(void** memptr, const size_t alignment, const size_t size, const char* file, const int line, const char* func) {
+    // The header sits in the padding in front of the aligned block
+    const uint32_t offset_log2 = MAX(getSizeBucket(alignment), (uint32_t)MEMORY_HEADER_OFFSET_LOG2);
+    void* memory = NULL;
+    const int result = posix_memalign(&memory, (size_t)1 << offset_log2, ((size_t)1 << offset_log2) + size);
+    if(result != 0) return result;
+    *memptr = Memory_track(memory, size, offset_log2, file, line, func);
+    return 0;
+}
+
+void tracked_free(void* ptr, const char* file, const int line, const char* func) {
+    if(ptr == NULL) return;
+    free(Memory_untrack(ptr, file, line, func));
+}
+
+#define malloc(size) tracked_malloc(size, __FILE__, __LINE__, __func__)
+#define calloc(count, size) tracked_calloc(count, size, __FILE__, __LINE__, __func__)
+#define realloc(ptr, size) tracked_realloc(ptr, size, __FILE__, __LINE__, __func__)
+#define strdup(string) tracked_strdup(string, __FILE__, __LINE__, __func__)
+#define posix_memalign(memptr, alignment, size) tracked_posix_memalign(memptr, alignment, size, __FILE__, __LINE__, __func__)
+#define free(ptr) tracked_free(ptr, __FILE__, __LINE__, __func__)
 
-    // Debug realloc function with metadata
-    void* debug_realloc(void* ptr, const size_t size, const char* file, int line, const char* func) {
-        printf("[[DS-MEMORY]] realloc(ptr=%p, size=%zu) called from file: %s, line: %d, function: %s, ", ptr, size, file, line, func);
+// Allocations the calling thread made so far, the difference over a frame must be 0 once it reached steady state
+uint64_t getThreadAllocationCount() {
+    return t_num_allocations;
+}
+
+int AllocationSite_compareLocation(const void* a, const void* b) {
+    const AllocationSite* site_a = a;
+    const AllocationSite* site_b = b;
+    const int file_order = strcmp(site_a->file, site_b->file);
+    return file_order != 0 ? file_order : site_a->line - site_b->line;
+}
 
-        #undef realloc
-        void* new_ptr = realloc(ptr, size);  // Call the real realloc
-        #define realloc(ptr, size) debug_realloc(ptr, size, __FILE__, __LINE__, __func__)
+int AllocationSite_compareNumAllocations(const void* a, const void* b) {
+    const uint64_t count_a = ((const AllocationSite*)a)->num_allocations;
+    const uint64_t count_b = ((const AllocationSite*)b)->num_allocations;
+    return count_a < count_b ? 1 : (count_a > count_b ? -1 : 0);
+}
 
-        if(new_ptr == NULL) PANIC("[[DS-MEMORY]] Failed to reallocate %zu bytes in file %s, line %d, function %s", size, file, line, func);
-        printf("Pointer reallocated at: %p\n", new_ptr);
-        return new_ptr;
+void printAllocationSite(const AllocationSite* site) {
+    printf("[[DS-MEMORY]]     %s:%d (%s): %llu allocations, %llu bytes |",
+           site->file, site->line, site->func, (unsigned long long)site->num_allocations, (unsigned long long)site->allocated_bytes);
+    for (uint32_t bucket = 0; bucket < MEMORY_NUM_SIZE_BUCKETS; bucket++) {
+        if (site->size_histogram[bucket] == 0) continue;
+        const uint64_t size = 1ull << bucket;
+        if (size < 1024) printf(" %lluB:%u", (unsigned long long)size, site->size_histogram[bucket]);
+        else if (size < 1024 * 1024) printf(" %lluK:%u", (unsigned long long)(size >> 10), site->size_histogram[bucket]);
+        else printf(" %lluM:%u", (unsigned long long)(size >> 20), site->size_histogram[bucket]);
     }
+    printf("\n");
+}
 
-    // Debug free function with metadata and variable name
-    void debug_free(void* ptr, const char* var_name, const char* file, int line, const char* func) {
-        printf("[[DS-MEMORY]] free(ptr=%p, variable=%s) called from file: %s, line: %d, function: %s\n", ptr, var_name, file, line, func);
+// Totals, and with MEMORY_TRACK_CALLSITES the busiest and the leaking call sites. Threads that allocated should
+// have been joined, their counters are read without synchronization.
+void printMemoryReport() {
+    printf("[[DS-MEMORY]] %llu allocations, peak %llu bytes, %llu bytes in %llu allocations still live\n",
+           (unsigned long long)g_memory_num_allocations, (unsigned long long)g_memory_peak_bytes,
+           (unsigned long long)g_memory_live_bytes, (unsigned long long)g_memory_live_allocations);
+#if MEMORY_TRACK_CALLSITES
+    // Merge the per thread entries of every call site, the copy is taken with the real malloc so it doesn't count
+    #undef malloc
+    #undef free
+    const uint32_t num_tables = __atomic_load_n(&g_num_allocation_site_tables, __ATOMIC_ACQUIRE);
+    AllocationSite* sites = malloc((size_t)num_tables * (MEMORY_MAX_CALLSITES + 1) * sizeof(AllocationSite));
+    uint32_t num_sites = 0;
+    for (uint32_t i = 0; i < num_tables; i++) {
+        const AllocationSiteTable* table = g_allocation_site_tables[i];
+        for (uint32_t j = 0; j < MEMORY_MAX_CALLSITES; j++) {
+            if (__atomic_load_n(&table->sites[j].file, __ATOMIC_ACQUIRE) != NULL) sites[num_sites++] = table->sites[j];
+        }
+        if (table->overflow.num_allocations > 0) {
+            sites[num_sites] = table->overflow;
+            sites[num_sites].file = "<call site table full>";
+            sites[num_sites].func = "";
+            sites[num_sites++].line = 0;
+        }
+    }
+    qsort(sites, num_sites, sizeof(AllocationSite), AllocationSite_compareLocation);
+    uint32_t num_merged = 0;
+    for (uint32_t i = 0; i < num_sites; i++) {
+        if (num_merged == 0 || AllocationSite_compareLocation(&sites[num_merged - 1], &sites[i]) != 0) {
+            sites[num_merged++] = sites[i];
+            continue;
+        }
+        AllocationSite* merged = &sites[num_merged - 1];
+        merged->num_allocations += sites[i].num_allocations;
+        merged->num_frees += sites[i].num_frees;
+        merged->allocated_bytes += sites[i].allocated_bytes;
+        merged->freed_bytes += sites[i].freed_bytes;
+        for (uint32_t bucket = 0; bucket < MEMORY_NUM_SIZE_BUCKETS; bucket++) merged->size_histogram[bucket] += sites[i].size_histogram[bucket];
+    }
 
-        #undef free
-        free(ptr);  // Call the real free
-        #define free(ptr) debug_free(ptr, #ptr, __FILE__, __LINE__, __func__)
+    printf("[[DS-MEMORY]] Leaks by call site:\n");
+    for (uint32_t i = 0; i < num_merged; i++) {
+        if (sites[i].num_allocations == sites[i].num_frees) continue;
+        printf("[[DS-MEMORY]]     %s:%d (%s): %llu bytes in %llu allocations\n", sites[i].file, sites[i].line, sites[i].func,
+               (unsigned long long)(sites[i].allocated_bytes - sites[i].freed_bytes), (unsigned long long)(sites[i].num_allocations - sites[i].num_frees));
     }
+
+    qsort(sites, num_merged, sizeof(AllocationSite), AllocationSite_compareNumAllocations);
+    printf("[[DS-MEMORY]] Busiest call sites, allocations by power of two size:\n");
+    for (uint32_t i = 0; i < MIN(num_merged, MEMORY_REPORT_TOP_CALLSITES); i++) printAllocationSite(&sites[i]);
+    free(sites);
+    #define malloc(size) tracked_malloc(size, __FILE__, __LINE__, __func__)
+    #define free(ptr) tracked_free(ptr, __FILE__, __LINE__, __func__)
 #endif
+}
 
 // Function to check if the file is a regular file using stat
 int is_regular_file(const char *filename) {
@@ -181,64 +406,445 @@ bool file_exists(const char *filepath) {
     return false;
 }
 
+/*
+ * File access
+ *
+ * Read-only assets (SPIR-V, textures, mesh caches, OBJ files) are accessed through a FileView. Regular files
+ * get mmap'ed so the data is paged in straight from the page cache without a heap allocation or copy.
+ * Only when mapping is impossible (empty files, special files, filesystems without mmap support) the
+ * file is read into a heap buffer instead. Either way the view stays valid until FileView_close.
+ */
+typedef struct {
+    const char* data;
+    size_t size;
+    void* mapping;  // mmap base, NULL if the view is backed by `buffer`
+    char* buffer;   // Heap copy for files that can't be mapped
+} FileView;
+
+// Fallback path, read(2)s the whole file into a heap buffer
 //@DS:NEEDS_FREE_AFTER_USE
-char *readFile(const char *filename, size_t *out_size) {
-    // First check if the file exists and is a regular file
-    if(!is_regular_file(filename)) {
-        fprintf(stderr, "Error: '%s' is not a regular file or does not exist.\n", filename);
-        return NULL;
+char* readFileBuffered(const int fd, const char* filename, const size_t size) {
+    char* buffer = malloc(MAX(size, 1));
+    size_t bytes_read = 0;
+    while(bytes_read < size) {
+        const ssize_t result = read(fd, buffer + bytes_read, size - bytes_read);
+        if(result < 0 && errno == EINTR) continue;
+        if(result <= 0) {
+            fprintf(stderr, "Error: Unable to read entire file '%s': %s\n", filename, strerror(errno));
+            free(buffer);
+            return NULL;
+        }
+        bytes_read += (size_t)result;
     }
+    return buffer;
+}
 
-    FILE *file = fopen(filename, "rb");
-    if(!file) {
+//@DS:NEEDS_FREE_AFTER_USE (FileView_close)
+bool FileView_open(const char* filename, FileView* out_view) {
+    memset(out_view, 0, sizeof(FileView));
+
+    const int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
         fprintf(stderr, "Error: Unable to open file '%s': %s\n", filename, strerror(errno));
-        return NULL;
+        return false;
     }
 
-    // Seek to the end to determine the file size
-    if(fseek(file, 0, SEEK_END) != 0) {
-        fprintf(stderr, "Error: Unable to seek to the end of file '%s'\n", filename);
-        fclose(file);
-        return NULL;
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        fprintf(stderr, "Error: '%s' is not a regular file or does not exist.\n", filename);
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t)file_stat.st_size;
+
+    if(size > 0) {
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED) {
+            close(fd); // The mapping keeps its own reference to the file
+            out_view->data = mapping;
+            out_view->size = size;
+            out_view->mapping = mapping;
+            return true;
+        }
+        fprintf(stderr, "Warning: Unable to mmap '%s' (%s), falling back to a buffered read.\n", filename, strerror(errno));
     }
 
-    const long fileSize = ftell(file);
-    if(fileSize == -1L) {
-        fprintf(stderr, "Error: Unable to get file size of '%s'\n", filename);
-        fclose(file);
-        return NULL;
+    out_view->buffer = readFileBuffered(fd, filename, size);
+    close(fd);
+    if(!out_view->buffer) return false;
+    out_view->data = out_view->buffer;
+    out_view->size = size;
+    return true;
+}
+
+void FileView_close(FileView* view) {
+    if(view->mapping) munmap(view->mapping, view->size);
+    if(view->buffer) free(view->buffer);
+    memset(view, 0, sizeof(FileView));
+}
+
+// Tells the kernel we are going to stream through the file front to back, so it can read ahead aggressively
+void FileView_adviseSequential(const FileView* view) {
+    if(view->mapping) madvise(view->mapping, view->size, MADV_SEQUENTIAL);
+}
+
+/*
+ * CPU tracing
+ *
+ * Zones are timed with CLOCK_MONOTONIC nanoseconds and land as one record each in the ring buffer of the thread that
+ * ran them. Every ring has a single producer, its thread, and a single consumer, the flusher thread, so neither side
+ * takes a lock. Zone names are interned once into a global table, a per thread cache keyed by the name's pointer
+ * keeps the lock off the hot path. The flusher drains all rings every TRACE_FLUSH_INTERVAL_MILLISECONDS into a
+ * Chrome trace (chrome://tracing or ui.perfetto.dev), using the same clock and process id as the GPU trace.
+ * A zone is stored as a single record with both timestamps rather than a begin and an end event: a full ring drops
+ * whole zones and the trace stays balanced. Nothing gets recorded until TRACE_START, and with TRACING_ENABLED false
+ * all TRACE_* macros compile to nothing.
+ */
+#if TRACING_ENABLED
+
+#define TRACE_RING_SIZE 16384 // Zones per thread, a power of two
+#define TRACE_MAX_THREADS 256
+#define TRACE_MAX_ZONES 1024
+#define TRACE_ZONE_CACHE_SIZE 64 // Per thread, direct mapped
+#define TRACE_FLUSH_INTERVAL_MILLISECONDS 100
+#define TRACE_NO_ZONE UINT32_UNINITIALIZED_VALUE
+
+typedef struct {
+    uint64_t start_nanoseconds;
+    uint64_t end_nanoseconds;
+    uint32_t zone;
+} TraceEvent;
+
+typedef struct {
+    TraceEvent events[TRACE_RING_SIZE];
+    // Free running, wrapped with TRACE_RING_SIZE - 1. Each index has a single writer, kept on separate cache lines.
+    uint32_t write_index __attribute__((aligned(64))); // Owning thread
+    uint32_t read_index __attribute__((aligned(64)));  // Flusher
+    uint32_t num_dropped; // Zones that found the ring full, read by the flusher
+
+    uint32_t thread_index;
+    char name[32];
+    const char* zone_cache_names[TRACE_ZONE_CACHE_SIZE];
+    uint32_t zone_cache_ids[TRACE_ZONE_CACHE_SIZE];
+} TraceThread;
+
+typedef struct {
+    bool is_recording;
+    const char* path;
+    FILE* file;
+    pthread_t flusher;
+    pthread_mutex_t mutex; // Guards registration of threads and zones, and the flusher's wake up
+    pthread_cond_t wake_flusher;
+    uint64_t num_written_zones;
+
+    TraceThread* threads[TRACE_MAX_THREADS];
+    uint32_t num_threads; // Published with release after the thread's entry is written
+
+    char* zone_names[TRACE_MAX_ZONES];
+    uint32_t num_zones; // Published with release after the zone's name is written
+} Tracer;
+
+Tracer g_tracer;
+__thread TraceThread* t_trace_thread = NULL;
+
+typedef struct {
+    uint64_t start_nanoseconds;
+    uint32_t zone; // TRACE_NO_ZONE if the zone started while nothing was recorded
+} TraceZone;
+
+uint64_t getNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// The calling thread's ring, created on its first zone. NULL if every ring is taken.
+TraceThread* Trace_getThread() {
+    if (t_trace_thread != NULL) return t_trace_thread;
+    pthread_mutex_lock(&g_tracer.mutex);
+    const uint32_t thread_index = g_tracer.num_threads;
+    if (thread_index < TRACE_MAX_THREADS) {
+        TraceThread* thread = calloc(1, sizeof(TraceThread));
+        thread->thread_index = thread_index;
+        snprintf(thread->name, sizeof(thread->name), thread_index == 0 ? "Main thread" : "Thread %u", thread_index);
+        g_tracer.threads[thread_index] = thread;
+        __atomic_store_n(&g_tracer.num_threads, thread_index + 1, __ATOMIC_RELEASE);
+        t_trace_thread = thread;
     }
+    pthread_mutex_unlock(&g_tracer.mutex);
+    return t_trace_thread;
+}
 
-    if(fileSize > LONG_MAX) {
-        fprintf(stderr, "Error: File size exceeds maximum supported size.\n");
-        fclose(file);
-        return NULL;
+uint32_t Trace_internZone(TraceThread* thread, const char* name) {
+    const uint32_t cache_slot = (uint32_t)(((uintptr_t)name >> 3) % TRACE_ZONE_CACHE_SIZE);
+    if (thread->zone_cache_names[cache_slot] == name) return thread->zone_cache_ids[cache_slot];
+
+    pthread_mutex_lock(&g_tracer.mutex);
+    uint32_t zone = TRACE_NO_ZONE;
+    for (uint32_t i = 0; i < g_tracer.num_zones && zone == TRACE_NO_ZONE; i++) {
+        if (strcmp(g_tracer.zone_names[i], name) == 0) zone = i;
+    }
+    if (zone == TRACE_NO_ZONE && g_tracer.num_zones < TRACE_MAX_ZONES) {
+        zone = g_tracer.num_zones;
+        g_tracer.zone_names[zone] = strdup(name);
+        __atomic_store_n(&g_tracer.num_zones, zone + 1, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&g_tracer.mutex);
 
-    *out_size = (size_t)fileSize;
+    thread->zone_cache_names[cache_slot] = name;
+    thread->zone_cache_ids[cache_slot] = zone;
+    return zone;
+}
 
-    // Go back to the beginning of the file
-    rewind(file);
+TraceZone TraceZone_begin(const char* name) {
+    TraceZone zone = {.start_nanoseconds = 0, .zone = TRACE_NO_ZONE};
+    if (!__atomic_load_n(&g_tracer.is_recording, __ATOMIC_RELAXED)) return zone;
+    TraceThread* thread = Trace_getThread();
+    if (thread == NULL) return zone;
+    zone.zone = Trace_internZone(thread, name);
+    zone.start_nanoseconds = getNanoseconds();
+    return zone;
+}
 
-    // Allocate buffer for the file content
-    char *buffer = malloc(*out_size);
-    if(!buffer) {
-        fprintf(stderr, "Error: Memory allocation failed for file '%s'\n", filename);
-        fclose(file);
-        return NULL;
+void TraceZone_end(const TraceZone* zone) {
+    if (zone->zone == TRACE_NO_ZONE || !__atomic_load_n(&g_tracer.is_recording, __ATOMIC_RELAXED)) return;
+    const uint64_t end_nanoseconds = getNanoseconds();
+    TraceThread* thread = t_trace_thread;
+    const uint32_t write_index = thread->write_index;
+    if (write_index - __atomic_load_n(&thread->read_index, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+        __atomic_add_fetch(&thread->num_dropped, 1, __ATOMIC_RELAXED);
+        return;
     }
+    thread->events[write_index & (TRACE_RING_SIZE - 1)] = (TraceEvent){
+        .start_nanoseconds = zone->start_nanoseconds,
+        .end_nanoseconds = end_nanoseconds,
+        .zone = zone->zone};
+    __atomic_store_n(&thread->write_index, write_index + 1, __ATOMIC_RELEASE);
+}
 
-    // Read the file into the buffer
-    const size_t bytesRead = fread(buffer, 1, *out_size, file);
-    if(bytesRead != *out_size) {
-        fprintf(stderr, "Error: Unable to read entire file '%s'\n", filename);
-        free(buffer);
-        fclose(file);
-        return NULL;
+// Names the calling thread in the trace, the name is copied
+void Trace_setThreadName(const char* name) {
+    if (!__atomic_load_n(&g_tracer.is_recording, __ATOMIC_RELAXED)) return;
+    TraceThread* thread = Trace_getThread();
+    if (thread != NULL) snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+// Writes every zone recorded so far, only ever runs on one thread at a time
+void Trace_drain() {
+    const uint32_t num_threads = __atomic_load_n(&g_tracer.num_threads, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        TraceThread* thread = g_tracer.threads[i];
+        const uint32_t write_index = __atomic_load_n(&thread->write_index, __ATOMIC_ACQUIRE);
+        for (uint32_t read_index = thread->read_index; read_index != write_index; read_index++) {
+            const TraceEvent* event = &thread->events[read_index & (TRACE_RING_SIZE - 1)];
+            fprintf(g_tracer.file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    g_tracer.zone_names[event->zone], thread->thread_index,
+                    (double)event->start_nanoseconds * 1e-3, (double)(event->end_nanoseconds - event->start_nanoseconds) * 1e-3);
+        }
+        g_tracer.num_written_zones += write_index - thread->read_index;
+        __atomic_store_n(&thread->read_index, write_index, __ATOMIC_RELEASE);
+    }
+}
+
+void* Trace_flusherMain(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_tracer.mutex);
+    while (__atomic_load_n(&g_tracer.is_recording, __ATOMIC_RELAXED)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline); // pthread_cond_timedwait's clock
+        deadline.tv_nsec += TRACE_FLUSH_INTERVAL_MILLISECONDS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&g_tracer.wake_flusher, &g_tracer.mutex, &deadline);
+
+        pthread_mutex_unlock(&g_tracer.mutex);
+        Trace_drain();
+        pthread_mutex_lock(&g_tracer.mutex);
     }
+    pthread_mutex_unlock(&g_tracer.mutex);
+    return NULL;
+}
 
-    fclose(file);
-    return buffer;
+//@DS:NEEDS_FREE_AFTER_USE (Trace_stop)
+void Trace_start(const char* path) {
+    memset(&g_tracer, 0, sizeof(Tracer));
+    pthread_mutex_init(&g_tracer.mutex, NULL);
+    pthread_cond_init(&g_tracer.wake_flusher, NULL);
+    if (path == NULL) return;
+
+    g_tracer.file = fopen(path, "w");
+    if (g_tracer.file == NULL) {
+        fprintf(stderr, "Error: Unable to open '%s' for writing: %s\n", path, strerror(errno));
+        return;
+    }
+    // Events are appended as they come in, the array gets closed in Trace_stop
+    fprintf(g_tracer.file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}}");
+    g_tracer.path = path;
+    g_tracer.is_recording = true;
+    Trace_getThread(); // The first registered thread is the main thread
+    if (pthread_create(&g_tracer.flusher, NULL, Trace_flusherMain, NULL) != 0) PANIC("Failed to spawn trace flusher thread");
+}
+
+// Every other thread that recorded zones must have been joined already
+void Trace_stop() {
+    if (g_tracer.is_recording) {
+        pthread_mutex_lock(&g_tracer.mutex);
+        __atomic_store_n(&g_tracer.is_recording, false, __ATOMIC_RELAXED);
+        pthread_cond_signal(&g_tracer.wake_flusher);
+        pthread_mutex_unlock(&g_tracer.mutex);
+        pthread_join(g_tracer.flusher, NULL);
+        Trace_drain();
+
+        uint32_t num_dropped = 0;
+        for (uint32_t i = 0; i < g_tracer.num_threads; i++) {
+            fprintf(g_tracer.file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    g_tracer.threads[i]->thread_index, g_tracer.threads[i]->name);
+            num_dropped += g_tracer.threads[i]->num_dropped;
+        }
+        fprintf(g_tracer.file, "\n]\n");
+        if (fclose(g_tracer.file) != 0) fprintf(stderr, "Error: Failed to write trace '%s': %s\n", g_tracer.path, strerror(errno));
+        else printf("[[DS-TRACE]] Wrote %llu zones of %u threads to '%s', dropped %u\n",
+                    (unsigned long long)g_tracer.num_written_zones, g_tracer.num_threads, g_tracer.path, num_dropped);
+    }
+
+    for (uint32_t i = 0; i < g_tracer.num_threads; i++) free(g_tracer.threads[i]);
+    for (uint32_t i = 0; i < g_tracer.num_zones; i++) free(g_tracer.zone_names[i]);
+    pthread_cond_destroy(&g_tracer.wake_flusher);
+    pthread_mutex_destroy(&g_tracer.mutex);
+    memset(&g_tracer, 0, sizeof(Tracer));
+    t_trace_thread = NULL;
+}
+
+#define TRACE_START(path) Trace_start(path)
+#define TRACE_STOP() Trace_stop()
+#define TRACE_THREAD_NAME(name) Trace_setThreadName(name)
+// Times the rest of the enclosing scope, use a nested block to time several phases of one function
+#define TRACE_ZONE(name) __attribute__((cleanup(TraceZone_end))) const TraceZone _trace_zone = TraceZone_begin(name)
+#define TRACE_FUNCTION() TRACE_ZONE(__func__)
+
+#else
+
+#define TRACE_START(path) ((void)(path))
+#define TRACE_STOP() ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)(name))
+#define TRACE_ZONE(name)
+#define TRACE_FUNCTION()
+
+#endif
+
+/*
+ * Thread pool
+ *
+ * A fixed set of worker threads pulling jobs from a FIFO. Jobs must not block on each other, anything that
+ * needs a result back on the main thread publishes it through its own state and gets polled from there.
+ */
+typedef void (*JobFunction)(void* user_data);
+
+typedef struct {
+    JobFunction function;
+    void* user_data;
+} Job;
+
+typedef struct {
+    const char* name; // Workers show up as "<name> <index>" in the CPU trace
+    pthread_t* threads;
+    uint32_t num_threads;
+    uint32_t num_started_threads;
+
+    Job* jobs; // Circular buffer
+    uint32_t capacity_jobs;
+    uint32_t first_job;
+    uint32_t num_jobs;
+    uint32_t num_running_jobs;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t job_available;
+    pthread_cond_t is_idle;
+    bool is_shutting_down;
+} ThreadPool;
+
+void* ThreadPool_workerMain(void* arg) {
+    ThreadPool* pool = arg;
+    char thread_name[32];
+    snprintf(thread_name, sizeof(thread_name), "%s %u", pool->name, __atomic_fetch_add(&pool->num_started_threads, 1, __ATOMIC_RELAXED));
+    TRACE_THREAD_NAME(thread_name);
+
+    pthread_mutex_lock(&pool->mutex);
+    while(true) {
+        while(pool->num_jobs == 0 && !pool->is_shutting_down) pthread_cond_wait(&pool->job_available, &pool->mutex);
+        if(pool->num_jobs == 0 && pool->is_shutting_down) break;
+
+        const Job job = pool->jobs[pool->first_job];
+        pool->first_job = (pool->first_job + 1) % pool->capacity_jobs;
+        pool->num_jobs--;
+        pool->num_running_jobs++;
+
+        pthread_mutex_unlock(&pool->mutex);
+        job.function(job.user_data);
+        pthread_mutex_lock(&pool->mutex);
+
+        pool->num_running_jobs--;
+        if(pool->num_jobs == 0 && pool->num_running_jobs == 0) pthread_cond_broadcast(&pool->is_idle);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+//@DS:NEEDS_FREE_AFTER_USE (ThreadPool_destroy)
+void ThreadPool_create(ThreadPool* pool, const char* name, const uint32_t num_threads) {
+    memset(pool, 0, sizeof(ThreadPool));
+    pool->name = name;
+    pool->num_threads = MAX(num_threads, 1u);
+    pool->capacity_jobs = 64;
+    pool->jobs = malloc(pool->capacity_jobs * sizeof(Job));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_available, NULL);
+    pthread_cond_init(&pool->is_idle, NULL);
+
+    pool->threads = malloc(pool->num_threads * sizeof(pthread_t));
+    for(uint32_t i = 0; i < pool->num_threads; i++) {
+        if(pthread_create(&pool->threads[i], NULL, ThreadPool_workerMain, pool) != 0) PANIC("Failed to spawn worker thread %u", i);
+    }
+}
+
+void ThreadPool_submit(ThreadPool* pool, const JobFunction function, void* user_data) {
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->num_jobs == pool->capacity_jobs) {
+        // Unroll the circular buffer into the front of the grown allocation
+        Job* jobs = malloc(2 * pool->capacity_jobs * sizeof(Job));
+        for(uint32_t i = 0; i < pool->num_jobs; i++) jobs[i] = pool->jobs[(pool->first_job + i) % pool->capacity_jobs];
+        free(pool->jobs);
+        pool->jobs = jobs;
+        pool->capacity_jobs *= 2;
+        pool->first_job = 0;
+    }
+    pool->jobs[(pool->first_job + pool->num_jobs) % pool->capacity_jobs] = (Job){.function = function, .user_data = user_data};
+    pool->num_jobs++;
+    pthread_cond_signal(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Blocks until the queue is drained and no job is running anymore
+void ThreadPool_waitIdle(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->num_jobs > 0 || pool->num_running_jobs > 0) pthread_cond_wait(&pool->is_idle, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Finishes all queued jobs and joins the workers
+void ThreadPool_destroy(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->is_shutting_down = true;
+    pthread_cond_broadcast(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+    for(uint32_t i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->is_idle);
+    pthread_cond_destroy(&pool->job_available);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads); pool->threads = NULL;
+    free(pool->jobs); pool->jobs = NULL;
+    pool->num_threads = 0;
 }
 
 typedef struct {
@@ -247,20 +853,55 @@ typedef struct {
     vec2 texCoord;
 } Vertex;
 
+// Compact vertex layout of the mesh cache and the vertex buffers, see Vertex quantization
+#ifndef MESH_QUANTIZE_VERTICES
+#define MESH_QUANTIZE_VERTICES 1
+#endif
+
+typedef struct {
+    int16_t pos[4];       // SNORM in the mesh's bounding cube, w is padding
+    int8_t normal[4];     // SNORM, w is padding
+    uint16_t texCoord[2]; // Half floats
+} QuantizedVertex;
+
+#if MESH_QUANTIZE_VERTICES
+typedef QuantizedVertex MeshVertex;
+#else
+typedef Vertex MeshVertex;
+#endif
+
 typedef struct {
     vec3 position    __attribute__((aligned(16)));
     quat rotation;
     vec3 scale       __attribute__((aligned(16)));
 } Transform;
 
+// Per instance vertex stream of the instanced pipeline, a tightly packed Transform.
+// The vertex shader rebuilds the model matrix from it, which halves the bandwidth compared to a mat4.
+// The bindless pipeline reads the same struct as its per object record from a storage buffer, so the fields
+// are laid out to match std430 (ObjectRecord in shaders/shader_bindless.vert).
+typedef struct {
+    float position[3];
+    uint32_t texture_slot; // Index into the bindless texture array, unused by the instanced pipeline
+    float rotation[4]; // Quaternion, xyzw
+    float scale[3];
+    float padding;
+} InstanceData;
+
+// The camera block duplicates the per frame part of PushConstants, so command buffers that get reused across
+// frames still see the current values. Shaders that only declare the matrices simply ignore it.
 typedef struct {
     mat4 model;
     mat4 view;
     mat4 proj;
+    vec4 cameraEye; // w is unused
+    float time;
+    int stage;
 } UniformBufferObject ;
 
 UniformBufferObject UniformBufferObject_create(mat4 model, mat4 view, mat4 proj) {
     UniformBufferObject ubo;
+    memset(&ubo, 0, sizeof(ubo));
     glm_mat4_copy(model, ubo.model);
     glm_mat4_copy(view, ubo.view);
     glm_mat4_copy(proj, ubo.proj);
@@ -276,87 +917,1798 @@ typedef struct {
     int stage;
 } PushConstants;
 
+/*
+ * Binary mesh cache
+ *
+ * OBJ text parsing dominates startup for anything bigger than a handful of triangles, so every OBJ is imported once,
+ * deduplicated into an indexed vertex / index buffer pair and written next to the source as a .dsmesh file.
+ * At startup the cache gets mmap'ed and its payload is memcpy'ed straight into the staging buffer.
+ * The cache is rebuilt whenever the OBJ is newer than it or its header doesn't match the current MeshVertex layout.
+ * The index payload holds the whole LOD chain back to back, the header records where each LOD starts.
+ */
+#define MESH_CACHE_MAGIC 0x48534D44u // "DMSH" when read byte by byte
+#define MESH_CACHE_VERSION 3u
+#define MESH_CACHE_EXTENSION ".dsmesh"
+#define MESH_CACHE_PAYLOAD_ALIGNMENT 16
+#define MESH_MAX_LODS 6
+
+// A range of the index buffer, all LODs of a mesh share its vertices. error is how far the surface may be off
+// compared to LOD 0, in object space units
+typedef struct {
+    uint32_t first_index;
+    uint32_t num_indices;
+    float error;
+} MeshLod;
 
-SDL_Window* g_window;
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_stride; // sizeof(MeshVertex) at bake time, a layout change invalidates the cache
+    uint32_t index_size;    // 2 or 4 bytes
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint64_t vertex_offset; // Byte offsets relative to the start of the file
+    uint64_t index_offset;
+    float bounds_min[3];
+    float bounds_max[3];
+    float dequantization[4]; // See getMeshDequantization
+    uint32_t num_lods;
+    MeshLod lods[MESH_MAX_LODS];
+} MeshCacheHeader;
+
+// CPU side view of a mesh, the pointers point into the mmap'ed cache file and stay valid until unmapMesh
+typedef struct {
+    const MeshVertex* vertices;
+    uint32_t num_vertices;
+    const void* indices;
+    uint32_t num_indices; // Of all LODs together
+    VkIndexType index_type;
+    vec3 bounds_min;
+    vec3 bounds_max;
+    vec4 dequantization;
+    MeshLod lods[MESH_MAX_LODS];
+    uint32_t num_lods;
+    FileView file; // Backing storage of vertices and indices
+} Mesh;
+
+uint32_t Mesh_indexSize(const Mesh* mesh) {
+    return mesh->index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-VkInstance g_instance = VK_NULL_HANDLE;
-VkSurfaceKHR g_surface = VK_NULL_HANDLE;
-VkPhysicalDevice g_physical_device = VK_NULL_HANDLE;
-VkDevice g_device = VK_NULL_HANDLE;
+// OBJ indexes position, texcoord and normal separately, so a vertex is uniquely identified by that triplet
+typedef struct {
+    int32_t v_idx;
+    int32_t vt_idx;
+    int32_t vn_idx;
+    uint32_t vertex_idx; // UINT32_UNINITIALIZED_VALUE marks an empty slot
+} VertexDedupEntry;
 
-VkSwapchainKHR g_swap_chain = VK_NULL_HANDLE;
-VkImage* g_swap_chain_images = NULL;
-uint32_t g_num_swap_chain_images = UINT32_UNINITIALIZED_VALUE;
-VkFormat g_swap_chain_image_format = VK_NULL_HANDLE;
-VkImageView* g_swap_chain_image_views = VK_NULL_HANDLE;
-uint32_t g_num_swap_chain_image_views = UINT32_UNINITIALIZED_VALUE;
-VkExtent2D g_swap_chain_extent = {.width = UINT32_UNINITIALIZED_VALUE, .height = UINT32_UNINITIALIZED_VALUE};
-VkFramebuffer* g_swap_chain_framebuffers = VK_NULL_HANDLE;
-uint32_t g_num_swap_chain_framebuffers = UINT32_UNINITIALIZED_VALUE;
+typedef struct {
+    VertexDedupEntry* entries;
+    uint32_t capacity; // Always a power of two
+    uint32_t count;
+} VertexDedupTable;
 
-VkImage g_color_image;
-VkDeviceMemory g_color_image_memory;
-VkImageView g_color_image_view;
+//@DS:NEEDS_FREE_AFTER_USE
+VertexDedupTable VertexDedupTable_create(const uint32_t max_entries) {
+    // Keeping the load factor at or below 0.5 means we never have to grow
+    uint32_t capacity = 16;
+    while(capacity < 2 * (uint64_t)max_entries) capacity *= 2;
+
+    VertexDedupTable table = {
+        .entries = malloc(capacity * sizeof(VertexDedupEntry)),
+        .capacity = capacity,
+        .count = 0};
+    for(uint32_t i = 0; i < capacity; i++) table.entries[i].vertex_idx = UINT32_UNINITIALIZED_VALUE;
+    return table;
+}
 
-VkImage g_depth_image;
-VkDeviceMemory g_depth_image_memory;
-VkImageView g_depth_image_view;
+void VertexDedupTable_free(VertexDedupTable* table) {
+    free(table->entries); table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
 
-VkDescriptorSetLayout g_descriptor_set_layout = VK_NULL_HANDLE;
-VkRenderPass g_render_pass = VK_NULL_HANDLE;
+// Returns the vertex index stored for the triplet, if it isn't known yet it gets assigned the next free index
+// (which is equal to the number of unique vertices seen so far) and *out_inserted is set.
+uint32_t VertexDedupTable_findOrInsert(VertexDedupTable* table, const int32_t v_idx, const int32_t vt_idx, const int32_t vn_idx, bool* out_inserted) {
+    uint32_t hash = (uint32_t)v_idx * 0x9E3779B1u;
+    hash ^= (uint32_t)vt_idx * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+    hash ^= (uint32_t)vn_idx * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+
+    const uint32_t mask = table->capacity - 1;
+    for(uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        VertexDedupEntry* entry = &table->entries[slot];
+        if(entry->vertex_idx == UINT32_UNINITIALIZED_VALUE) {
+            if(2 * (uint64_t)(table->count + 1) > table->capacity) PANIC("VertexDedupTable is full (capacity %u)", table->capacity);
+            entry->v_idx = v_idx;
+            entry->vt_idx = vt_idx;
+            entry->vn_idx = vn_idx;
+            entry->vertex_idx = table->count++;
+            *out_inserted = true;
+            return entry->vertex_idx;
+        }
+        if(entry->v_idx == v_idx && entry->vt_idx == vt_idx && entry->vn_idx == vn_idx) {
+            *out_inserted = false;
+            return entry->vertex_idx;
+        }
+    }
+}
 
-VkPipeline g_graphics_pipeline = VK_NULL_HANDLE;
-VkPipelineLayout g_pipeline_layout = VK_NULL_HANDLE;
+// Assembles a Vertex from 0-based OBJ attribute indices, missing or out of range attributes are zeroed
+Vertex Vertex_fromObjAttributes(
+    const float* positions, const uint32_t num_positions,
+    const float* normals, const uint32_t num_normals,
+    const float* texcoords, const uint32_t num_texcoords,
+    const int32_t v_idx, const int32_t vt_idx, const int32_t vn_idx)
+{
+    Vertex vertex = {0};
+    if(v_idx >= 0 && (uint32_t)v_idx < num_positions) {
+        vertex.pos[0] = positions[3 * v_idx + 0];
+        vertex.pos[1] = positions[3 * v_idx + 1];
+        vertex.pos[2] = positions[3 * v_idx + 2];
+    }
+    if(vn_idx >= 0 && (uint32_t)vn_idx < num_normals) {
+        vertex.normal[0] = normals[3 * vn_idx + 0];
+        vertex.normal[1] = normals[3 * vn_idx + 1];
+        vertex.normal[2] = normals[3 * vn_idx + 2];
+    }
+    if(vt_idx >= 0 && (uint32_t)vt_idx < num_texcoords) {
+        vertex.texCoord[0] = texcoords[2 * vt_idx + 0];
+        vertex.texCoord[1] = 1.0f - texcoords[2 * vt_idx + 1]; // OBJ has the origin bottom left, Vulkan top left
+    }
+    return vertex;
+}
 
-VkCommandPool g_command_pool = VK_NULL_HANDLE;
+void getMeshCachePath(const char* obj_path, char* out_path, const size_t out_path_size) {
+    const char* extension = strrchr(obj_path, '.');
+    const char* separator = strrchr(obj_path, '/');
+    const size_t stem_length = (extension && (!separator || extension > separator)) ? (size_t)(extension - obj_path) : strlen(obj_path);
+    const int written = snprintf(out_path, out_path_size, "%.*s%s", (int)stem_length, obj_path, MESH_CACHE_EXTENSION);
+    if(written < 0 || (size_t)written >= out_path_size) PANIC("Mesh cache path for '%s' is too long", obj_path);
+}
 
-VkCommandBuffer* g_command_buffers;
-uint32_t g_num_command_buffers;
+bool writeMeshCache(
+    const char* cache_path,
+    const MeshVertex* vertices, const uint32_t num_vertices,
+    const uint32_t* indices, const uint32_t num_indices,
+    const MeshLod* lods, const uint32_t num_lods,
+    const vec3 bounds_min, const vec3 bounds_max, const vec4 dequantization)
+{
+    const uint32_t index_size = (num_vertices <= UINT16_MAX) ? sizeof(uint16_t) : sizeof(uint32_t);
+    const uint64_t vertex_bytes = (uint64_t)num_vertices * sizeof(MeshVertex);
+
+    MeshCacheHeader header = {
+        .magic = MESH_CACHE_MAGIC,
+        .version = MESH_CACHE_VERSION,
+        .vertex_stride = sizeof(MeshVertex),
+        .index_size = index_size,
+        .num_vertices = num_vertices,
+        .num_indices = num_indices,
+        .vertex_offset = sizeof(MeshCacheHeader),
+        .index_offset = sizeof(MeshCacheHeader) + vertex_bytes,
+        .bounds_min = {bounds_min[0], bounds_min[1], bounds_min[2]},
+        .bounds_max = {bounds_max[0], bounds_max[1], bounds_max[2]},
+        .dequantization = {dequantization[0], dequantization[1], dequantization[2], dequantization[3]},
+        .num_lods = num_lods};
+    memcpy(header.lods, lods, num_lods * sizeof(MeshLod));
+    header.index_offset = (header.index_offset + MESH_CACHE_PAYLOAD_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_PAYLOAD_ALIGNMENT - 1);
+
+    // Write to a temporary file and rename it over the old cache, so a crash never leaves a truncated cache behind
+    char tmp_path[PATH_MAX];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path) >= (int)sizeof(tmp_path)) return false;
+    FILE* file = fopen(tmp_path, "wb");
+    if(!file) {
+        fprintf(stderr, "Error: Unable to open '%s' for writing: %s\n", tmp_path, strerror(errno));
+        return false;
+    }
 
-VkSampleCountFlagBits g_MSAASamples;
+    static const uint8_t padding[MESH_CACHE_PAYLOAD_ALIGNMENT] = {0};
+    const size_t padding_size = header.index_offset - header.vertex_offset - vertex_bytes;
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    success = success && fwrite(vertices, sizeof(MeshVertex), num_vertices, file) == num_vertices;
+    success = success && fwrite(padding, 1, padding_size, file) == padding_size;
+    if(index_size == sizeof(uint16_t)) {
+        uint16_t* narrow_indices = malloc(num_indices * sizeof(uint16_t));
+        for(uint32_t i = 0; i < num_indices; i++) narrow_indices[i] = (uint16_t)indices[i];
+        success = success && fwrite(narrow_indices, sizeof(uint16_t), num_indices, file) == num_indices;
+        free(narrow_indices);
+    } else {
+        success = success && fwrite(indices, sizeof(uint32_t), num_indices, file) == num_indices;
+    }
+    success = (fclose(file) == 0) && success;
 
-VkQueue g_graphics_queue = VK_NULL_HANDLE;
-VkQueue g_presentation_queue = VK_NULL_HANDLE;
+    if(!success || rename(tmp_path, cache_path) != 0) {
+        fprintf(stderr, "Error: Failed to write mesh cache '%s': %s\n", cache_path, strerror(errno));
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
 
-VkDebugUtilsMessengerEXT g_debug_messenger;
+/*
+ * Multithreaded OBJ importer
+ *
+ * The file is mapped through a FileView and split into line aligned chunks which get parsed in parallel, one thread per chunk.
+ * Every chunk collects its own attribute arrays and triangulated face corners. OBJ indices are global to the file,
+ * so negative (relative) indices are stored relative to the chunk and resolved in the merge step once the
+ * attribute counts of all preceding chunks are known. The merge step then deduplicates the corners into
+ * Vertex / index arrays through the VertexDedupTable.
+ */
+#define OBJ_IMPORT_MIN_CHUNK_SIZE (1u << 20) // Smaller files are not worth spinning up threads for
+#define OBJ_IMPORT_MAX_THREADS 64
+#define OBJ_INDEX_MISSING INT32_MIN
+
+// Bits of ObjRawCorner::relative_mask, a set bit means the index is relative to the start of the chunk
+#define OBJ_RELATIVE_V  (1u << 0)
+#define OBJ_RELATIVE_VT (1u << 1)
+#define OBJ_RELATIVE_VN (1u << 2)
 
-bool g_is_running = false;
+typedef struct {
+    int32_t v_idx;
+    int32_t vt_idx;
+    int32_t vn_idx;
+    uint32_t relative_mask;
+} ObjRawCorner;
 
-uint32_t g_mip_levels = UINT32_UNINITIALIZED_VALUE;
-VkImage g_texture_image;
-VkDeviceMemory g_texture_image_memory;
-VkImageView g_texture_image_view;
-VkSampler g_texture_sampler;
+typedef struct {
+    const char* begin;
+    const char* end;
 
-VkBuffer* g_uniform_buffers;
-VkDeviceMemory* g_uniform_buffers_memory;
-void** g_uniform_buffers_mapped;
+    float* positions; uint32_t num_positions; uint32_t capacity_positions;    // num_* count floats, not attributes
+    float* normals;   uint32_t num_normals;   uint32_t capacity_normals;
+    float* texcoords; uint32_t num_texcoords; uint32_t capacity_texcoords;
+    ObjRawCorner* corners; uint32_t num_corners; uint32_t capacity_corners;
+} ObjChunk;
 
-VkDescriptorPool g_descriptor_pool;
-VkDescriptorSet* g_descriptor_sets;
-uint32_t g_num_descriptor_sets;
+//@DS:NEEDS_FREE_AFTER_USE (ImportedMesh_free)
+typedef struct {
+    Vertex* vertices;
+    uint32_t num_vertices;
+    uint32_t* indices;
+    uint32_t num_indices;
+    vec3 bounds_min;
+    vec3 bounds_max;
+} ImportedMesh;
+
+void ImportedMesh_free(ImportedMesh* mesh) {
+    free(mesh->vertices); mesh->vertices = NULL;
+    free(mesh->indices); mesh->indices = NULL;
+    mesh->num_vertices = 0;
+    mesh->num_indices = 0;
+}
 
-VkSemaphore* g_image_available_semaphores;
-uint32_t g_num_image_available_semaphores;
+// Makes room for at least `required` elements, growing geometrically so pushes stay amortized O(1)
+void growArray(void** array, uint32_t* capacity, const uint32_t required, const size_t element_size) {
+    if(required <= *capacity) return;
+    uint32_t new_capacity = MAX(*capacity, 64u);
+    while(new_capacity < required) new_capacity *= 2;
+    *array = realloc(*array, new_capacity * element_size);
+    *capacity = new_capacity;
+}
 
-VkSemaphore* g_render_finished_semaphores;
-uint32_t g_num_render_finished_semaphores;
+bool isObjDigit(const char c) { return c >= '0' && c <= '9'; }
 
-VkFence* g_in_flight_fences;
-uint32_t g_num_in_flight_fences;
+const char* skipObjWhitespace(const char* cursor, const char* end) {
+    while(cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++;
+    return cursor;
+}
 
-uint32_t g_current_frame_idx; // 0 <= m_CurrentFrameIdx < Max Frames in Flight
-uint32_t g_frame_counter;    // How many frames have been rendered in total
+// Locale independent replacement for strtof, which is the bottleneck when parsing OBJ files
+float parseObjFloat(const char** cursor, const char* end) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    const char* c = skipObjWhitespace(*cursor, end);
+    bool is_negative = false;
+    if(c < end && (*c == '-' || *c == '+')) { is_negative = (*c == '-'); c++; }
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    for(; c < end && isObjDigit(*c); c++) {
+        if(mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+        else exponent++;
+    }
+    if(c < end && *c == '.') {
+        for(c++; c < end && isObjDigit(*c); c++) {
+            if(mantissa < 100000000000000000ull) { mantissa = mantissa * 10 + (uint64_t)(*c - '0'); exponent--; }
+        }
+    }
+    if(c < end && (*c == 'e' || *c == 'E')) {
+        c++;
+        bool exponent_is_negative = false;
+        if(c < end && (*c == '-' || *c == '+')) { exponent_is_negative = (*c == '-'); c++; }
+        int32_t explicit_exponent = 0;
+        for(; c < end && isObjDigit(*c); c++) {
+            if(explicit_exponent < 10000) explicit_exponent = explicit_exponent * 10 + (*c - '0');
+        }
+        exponent += exponent_is_negative ? -explicit_exponent : explicit_exponent;
+    }
+    *cursor = c;
 
-PushConstants g_push_constants;
+    double value = (double)mantissa;
+    if(exponent < 0) value = (exponent >= -22) ? value / powers_of_ten[-exponent] : value * pow(10.0, exponent);
+    else if(exponent > 0) value = (exponent <= 22) ? value * powers_of_ten[exponent] : value * pow(10.0, exponent);
+    return (float)(is_negative ? -value : value);
+}
 
-int g_rendering_stage = 3;
+// Parses one OBJ index and converts it to 0-based, relative indices are returned chunk relative with is_relative set
+int32_t parseObjIndex(const char** cursor, const char* end, const uint32_t num_attributes_in_chunk, bool* is_relative) {
+    const char* c = *cursor;
+    bool is_negative = false;
+    if(c < end && *c == '-') { is_negative = true; c++; }
+    if(c >= end || !isObjDigit(*c)) {
+        *is_relative = false;
+        return OBJ_INDEX_MISSING;
+    }
+    int64_t value = 0;
+    for(; c < end && isObjDigit(*c); c++) {
+        if(value < INT32_MAX) value = value * 10 + (*c - '0');
+    }
+    *cursor = c;
 
-bool g_did_framebuffer_resize = false;
+    if(value == 0 || value > INT32_MAX) {
+        *is_relative = false;
+        return OBJ_INDEX_MISSING;
+    }
+    *is_relative = is_negative;
+    return is_negative ? (int32_t)((int64_t)num_attributes_in_chunk - value) : (int32_t)(value - 1);
+}
 
-vec3 g_camera_eye = {2.0f, 4.0f, 2.0f};
-vec3 g_camera_center = {0.0f, 0.0f, 0.0f};
-vec3 g_camera_up = {0.0f, 0.0f, 1.0f};
+// Parses a single "v", "v/vt", "v//vn" or "v/vt/vn" face corner
+bool parseObjCorner(const char** cursor, const char* end, const ObjChunk* chunk, ObjRawCorner* out_corner) {
+    const char* c = skipObjWhitespace(*cursor, end);
+    if(c >= end || *c == '\n' || *c == '\r') return false;
+
+    bool is_relative = false;
+    out_corner->relative_mask = 0;
+    out_corner->vt_idx = OBJ_INDEX_MISSING;
+    out_corner->vn_idx = OBJ_INDEX_MISSING;
+
+    out_corner->v_idx = parseObjIndex(&c, end, chunk->num_positions / 3, &is_relative);
+    if(is_relative) out_corner->relative_mask |= OBJ_RELATIVE_V;
+    if(c < end && *c == '/') {
+        c++;
+        out_corner->vt_idx = parseObjIndex(&c, end, chunk->num_texcoords / 2, &is_relative);
+        if(is_relative) out_corner->relative_mask |= OBJ_RELATIVE_VT;
+        if(c < end && *c == '/') {
+            c++;
+            out_corner->vn_idx = parseObjIndex(&c, end, chunk->num_normals / 3, &is_relative);
+            if(is_relative) out_corner->relative_mask |= OBJ_RELATIVE_VN;
+        }
+    }
+    // Skip whatever is left of a malformed token so we can't get stuck on it
+    while(c < end && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r') c++;
+    *cursor = c;
+    return true;
+}
+
+void pushObjFloats(float** array, uint32_t* count, uint32_t* capacity, const char** cursor, const char* end, const uint32_t num_components) {
+    growArray((void**)array, capacity, *count + num_components, sizeof(float));
+    for(uint32_t i = 0; i < num_components; i++) (*array)[(*count)++] = parseObjFloat(cursor, end);
+}
+
+void pushObjCorner(ObjChunk* chunk, const ObjRawCorner* corner) {
+    growArray((void**)&chunk->corners, &chunk->capacity_corners, chunk->num_corners + 1, sizeof(ObjRawCorner));
+    chunk->corners[chunk->num_corners++] = *corner;
+}
+
+void* parseObjChunk(void* arg) {
+    ObjChunk* chunk = arg;
+    const char* end = chunk->end;
+
+    // Rough guess of ~32 bytes per line, avoids most of the reallocations for typical files
+    const uint32_t estimated_lines = (uint32_t)MAX((chunk->end - chunk->begin) / 32, 1);
+    growArray((void**)&chunk->positions, &chunk->capacity_positions, estimated_lines, sizeof(float));
+    growArray((void**)&chunk->corners, &chunk->capacity_corners, estimated_lines, sizeof(ObjRawCorner));
+
+    for(const char* line = chunk->begin; line < end;) {
+        const char* c = skipObjWhitespace(line, end);
+        const char* line_end = memchr(c, '\n', (size_t)(end - c));
+        if(!line_end) line_end = end;
+
+        if(c + 1 < line_end && c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+            c += 1;
+            pushObjFloats(&chunk->positions, &chunk->num_positions, &chunk->capacity_positions, &c, line_end, 3);
+        } else if(c + 2 < line_end && c[0] == 'v' && c[1] == 'n' && (c[2] == ' ' || c[2] == '\t')) {
+            c += 2;
+            pushObjFloats(&chunk->normals, &chunk->num_normals, &chunk->capacity_normals, &c, line_end, 3);
+        } else if(c + 2 < line_end && c[0] == 'v' && c[1] == 't' && (c[2] == ' ' || c[2] == '\t')) {
+            c += 2;
+            pushObjFloats(&chunk->texcoords, &chunk->num_texcoords, &chunk->capacity_texcoords, &c, line_end, 2);
+        } else if(c + 1 < line_end && c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+            c += 1;
+            // Polygons get triangulated as a fan around their first corner
+            ObjRawCorner first;
+            ObjRawCorner previous;
+            ObjRawCorner current;
+            uint32_t num_face_corners = 0;
+            while(parseObjCorner(&c, line_end, chunk, &current)) {
+                if(num_face_corners == 0) first = current;
+                if(num_face_corners >= 2) {
+                    pushObjCorner(chunk, &first);
+                    pushObjCorner(chunk, &previous);
+                    pushObjCorner(chunk, &current);
+                }
+                previous = current;
+                num_face_corners++;
+            }
+        }
+        // Everything else (comments, o, g, s, usemtl, mtllib, ...) doesn't contribute to the mesh
+        line = line_end < end ? line_end + 1 : end; // The last line may lack its newline
+    }
+    return NULL;
+}
+
+int32_t resolveObjIndex(const int32_t raw_idx, const bool is_relative, const uint32_t chunk_base) {
+    if(raw_idx == OBJ_INDEX_MISSING) return -1;
+    return is_relative ? (int32_t)((int64_t)chunk_base + raw_idx) : raw_idx;
+}
+
+// Copies the per chunk attribute arrays into one, out_chunk_bases receives the attribute offset of every chunk
+//@DS:NEEDS_FREE_AFTER_USE
+float* concatenateObjAttributes(
+    float* const* chunk_arrays,
+    const uint32_t* chunk_num_floats,
+    const uint32_t num_chunks,
+    const uint32_t num_components,
+    uint32_t* out_chunk_bases,
+    uint32_t* out_num_attributes)
+{
+    uint64_t num_floats = 0;
+    for(uint32_t i = 0; i < num_chunks; i++) {
+        out_chunk_bases[i] = (uint32_t)(num_floats / num_components);
+        num_floats += chunk_num_floats[i];
+    }
+    if(num_floats / num_components > INT32_MAX) PANIC("OBJ file has too many attributes");
+
+    float* attributes = malloc(MAX(num_floats, 1) * sizeof(float));
+    uint64_t write_offset = 0;
+    for(uint32_t i = 0; i < num_chunks; i++) {
+        if(chunk_num_floats[i]) memcpy(attributes + write_offset, chunk_arrays[i], chunk_num_floats[i] * sizeof(float));
+        write_offset += chunk_num_floats[i];
+    }
+    *out_num_attributes = (uint32_t)(num_floats / num_components);
+    return attributes;
+}
+
+bool importObj(const char* obj_path, ImportedMesh* out_mesh) {
+    TRACE_ZONE("OBJ import: total");
+
+    FileView obj_file;
+    if(!FileView_open(obj_path, &obj_file)) return false;
+    FileView_adviseSequential(&obj_file);
+    const char* file_data = obj_file.data;
+    const size_t file_size = obj_file.size;
+
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cores < 1) num_cores = 1;
+    uint32_t num_chunks = (uint32_t)MAX(file_size / OBJ_IMPORT_MIN_CHUNK_SIZE, 1);
+    if(num_chunks > (uint32_t)num_cores) num_chunks = (uint32_t)num_cores;
+    if(num_chunks > OBJ_IMPORT_MAX_THREADS) num_chunks = OBJ_IMPORT_MAX_THREADS;
+
+    ObjChunk chunks[OBJ_IMPORT_MAX_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    {
+        TRACE_ZONE("OBJ import: parse");
+        // Chunk boundaries are pushed forward to the next line start, so no line is split between two chunks
+        const char* file_end = file_data + file_size;
+        const char* chunk_begin = file_data;
+        for(uint32_t i = 0; i < num_chunks; i++) {
+            const char* chunk_end = (i == num_chunks - 1) ? file_end : file_data + (file_size / num_chunks) * (i + 1);
+            if(chunk_end < chunk_begin) chunk_end = chunk_begin;
+            if(chunk_end < file_end) {
+                const char* newline = memchr(chunk_end, '\n', (size_t)(file_end - chunk_end));
+                chunk_end = newline ? newline + 1 : file_end;
+            }
+            chunks[i].begin = chunk_begin;
+            chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+
+        pthread_t threads[OBJ_IMPORT_MAX_THREADS];
+        for(uint32_t i = 1; i < num_chunks; i++) {
+            if(pthread_create(&threads[i], NULL, parseObjChunk, &chunks[i]) != 0) PANIC("Failed to spawn OBJ parser thread");
+        }
+        parseObjChunk(&chunks[0]); // The calling thread takes the first chunk itself
+        for(uint32_t i = 1; i < num_chunks; i++) pthread_join(threads[i], NULL);
+        printf("Parsed '%s' (%zu bytes) in %u chunks.\n", obj_path, file_size, num_chunks);
+    }
+    FileView_close(&obj_file);
+
+    {
+        TRACE_ZONE("OBJ import: merge and deduplicate");
+        float* chunk_arrays[3][OBJ_IMPORT_MAX_THREADS];
+        uint32_t chunk_num_floats[3][OBJ_IMPORT_MAX_THREADS];
+        for(uint32_t i = 0; i < num_chunks; i++) {
+            chunk_arrays[0][i] = chunks[i].positions; chunk_num_floats[0][i] = chunks[i].num_positions;
+            chunk_arrays[1][i] = chunks[i].normals;   chunk_num_floats[1][i] = chunks[i].num_normals;
+            chunk_arrays[2][i] = chunks[i].texcoords; chunk_num_floats[2][i] = chunks[i].num_texcoords;
+        }
+        uint32_t position_bases[OBJ_IMPORT_MAX_THREADS];
+        uint32_t normal_bases[OBJ_IMPORT_MAX_THREADS];
+        uint32_t texcoord_bases[OBJ_IMPORT_MAX_THREADS];
+        uint32_t num_positions = 0;
+        uint32_t num_normals = 0;
+        uint32_t num_texcoords = 0;
+        float* positions = concatenateObjAttributes(chunk_arrays[0], chunk_num_floats[0], num_chunks, 3, position_bases, &num_positions);
+        float* normals = concatenateObjAttributes(chunk_arrays[1], chunk_num_floats[1], num_chunks, 3, normal_bases, &num_normals);
+        float* texcoords = concatenateObjAttributes(chunk_arrays[2], chunk_num_floats[2], num_chunks, 2, texcoord_bases, &num_texcoords);
+
+        uint64_t total_corners = 0;
+        for(uint32_t i = 0; i < num_chunks; i++) total_corners += chunks[i].num_corners;
+        if(total_corners > UINT32_MAX / 2) PANIC("OBJ file '%s' has too many face corners", obj_path);
+        const uint32_t num_indices = (uint32_t)total_corners;
+
+        out_mesh->vertices = malloc(MAX(num_indices, 1) * sizeof(Vertex)); // Upper bound, every corner unique
+        out_mesh->indices = malloc(MAX(num_indices, 1) * sizeof(uint32_t));
+        out_mesh->num_indices = num_indices;
+        out_mesh->num_vertices = 0;
+        glm_vec3_copy((vec3){FLT_MAX, FLT_MAX, FLT_MAX}, out_mesh->bounds_min);
+        glm_vec3_copy((vec3){-FLT_MAX, -FLT_MAX, -FLT_MAX}, out_mesh->bounds_max);
+
+        VertexDedupTable dedup_table = VertexDedupTable_create(num_indices);
+        uint32_t index_cursor = 0;
+        for(uint32_t i = 0; i < num_chunks; i++) {
+            for(uint32_t j = 0; j < chunks[i].num_corners; j++) {
+                const ObjRawCorner* corner = &chunks[i].corners[j];
+                const int32_t v_idx = resolveObjIndex(corner->v_idx, corner->relative_mask & OBJ_RELATIVE_V, position_bases[i]);
+                const int32_t vt_idx = resolveObjIndex(corner->vt_idx, corner->relative_mask & OBJ_RELATIVE_VT, texcoord_bases[i]);
+                const int32_t vn_idx = resolveObjIndex(corner->vn_idx, corner->relative_mask & OBJ_RELATIVE_VN, normal_bases[i]);
+
+                bool inserted = false;
+                out_mesh->indices[index_cursor++] = VertexDedupTable_findOrInsert(&dedup_table, v_idx, vt_idx, vn_idx, &inserted);
+                if(!inserted) continue;
+
+                Vertex* vertex = &out_mesh->vertices[out_mesh->num_vertices++];
+                *vertex = Vertex_fromObjAttributes(
+                    positions, num_positions,
+                    normals, num_normals,
+                    texcoords, num_texcoords,
+                    v_idx, vt_idx, vn_idx);
+                glm_vec3_minv(out_mesh->bounds_min, vertex->pos, out_mesh->bounds_min);
+                glm_vec3_maxv(out_mesh->bounds_max, vertex->pos, out_mesh->bounds_max);
+            }
+        }
+        VertexDedupTable_free(&dedup_table);
+        free(positions);
+        free(normals);
+        free(texcoords);
+
+        if(out_mesh->num_vertices == 0) {
+            glm_vec3_zero(out_mesh->bounds_min);
+            glm_vec3_zero(out_mesh->bounds_max);
+        }
+    }
+
+    for(uint32_t i = 0; i < num_chunks; i++) {
+        free(chunks[i].positions);
+        free(chunks[i].normals);
+        free(chunks[i].texcoords);
+        free(chunks[i].corners);
+    }
+    return true;
+}
+
+/*
+ * Mesh LOD generation
+ *
+ * Every mesh is baked with a chain of up to MESH_MAX_LODS index lists that all index the same vertices, LOD 0 being
+ * the imported mesh. Each LOD is simplified from the previous one by quadric error edge collapses (Garland and
+ * Heckbert). A vertex is only ever collapsed onto one of its neighbours, never moved, so no new vertices are needed
+ * and the attributes stay exact. Vertices on UV / normal seams (several vertices at one position) and on open
+ * borders are locked, which keeps the silhouette of open meshes and the texture mapping intact.
+ * Collapses happen in passes: all candidate edges are sorted by cost and applied cheapest first, skipping vertices
+ * whose neighbourhood already changed in this pass, until the triangle target is met or nothing can collapse.
+ * The error stored per LOD is the square root of the worst applied quadric error, summed along the chain, which
+ * bounds how far the surface moved in object space.
+ */
+#define LOD_TARGET_RATIO 0.5f // Each LOD aims for this fraction of the previous LOD's triangles
+#define LOD_MIN_REDUCTION 0.8f // The chain ends once a LOD keeps more than this fraction of the previous triangles
+#define LOD_MIN_TRIANGLES 64
+#define LOD_MAX_PASSES 32
+
+// Symmetric 4x4 matrix of a sum of squared plane distances, stored as its upper triangle
+typedef struct {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+} Quadric;
+
+typedef struct {
+    uint32_t from; // Collapsed onto `to`, always unlocked
+    uint32_t to;
+    float cost;
+} LodCollapse;
+
+void Quadric_addPlane(Quadric* q, const double a, const double b, const double c, const double d) {
+    q->a2 += a * a; q->ab += a * b; q->ac += a * c; q->ad += a * d;
+    q->b2 += b * b; q->bc += b * c; q->bd += b * d;
+    q->c2 += c * c; q->cd += c * d;
+    q->d2 += d * d;
+}
+
+void Quadric_add(Quadric* q, const Quadric* other) {
+    q->a2 += other->a2; q->ab += other->ab; q->ac += other->ac; q->ad += other->ad;
+    q->b2 += other->b2; q->bc += other->bc; q->bd += other->bd;
+    q->c2 += other->c2; q->cd += other->cd;
+    q->d2 += other->d2;
+}
+
+double Quadric_evaluate(const Quadric* q, const float* p) {
+    const double x = p[0], y = p[1], z = p[2];
+    const double error =
+        q->a2 * x * x + 2.0 * q->ab * x * y + 2.0 * q->ac * x * z + 2.0 * q->ad * x +
+        q->b2 * y * y + 2.0 * q->bc * y * z + 2.0 * q->bd * y +
+        q->c2 * z * z + 2.0 * q->cd * z +
+        q->d2;
+    return error > 0.0 ? error : 0.0;
+}
+
+void triangleNormal(const float* p0, const float* p1, const float* p2, double* out_normal) {
+    const double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    const double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    out_normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    out_normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    out_normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+int compareLodCollapses(const void* a, const void* b) {
+    const float cost_a = ((const LodCollapse*)a)->cost;
+    const float cost_b = ((const LodCollapse*)b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+int compareUint64(const void* a, const void* b) {
+    const uint64_t value_a = *(const uint64_t*)a;
+    const uint64_t value_b = *(const uint64_t*)b;
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+// Maps every vertex onto the first vertex with a bitwise identical position
+//@DS:NEEDS_FREE_AFTER_USE
+uint32_t* weldVertexPositions(const Vertex* vertices, const uint32_t num_vertices) {
+    uint32_t capacity = 16;
+    while(capacity < 2 * (uint64_t)num_vertices) capacity *= 2;
+    uint32_t* table = malloc(capacity * sizeof(uint32_t));
+    for(uint32_t i = 0; i < capacity; i++) table[i] = UINT32_UNINITIALIZED_VALUE;
+
+    uint32_t* weld = malloc(MAX(num_vertices, 1) * sizeof(uint32_t));
+    for(uint32_t v = 0; v < num_vertices; v++) {
+        uint32_t bits[3];
+        memcpy(bits, vertices[v].pos, sizeof(bits));
+        uint32_t hash = bits[0] * 0x9E3779B1u;
+        hash ^= bits[1] * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+        hash ^= bits[2] * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+        for(uint32_t slot = hash & (capacity - 1);; slot = (slot + 1) & (capacity - 1)) {
+            if(table[slot] == UINT32_UNINITIALIZED_VALUE) {
+                table[slot] = v;
+                weld[v] = v;
+                break;
+            }
+            if(memcmp(vertices[table[slot]].pos, vertices[v].pos, sizeof(vec3)) == 0) {
+                weld[v] = table[slot];
+                break;
+            }
+        }
+    }
+    free(table);
+    return weld;
+}
+
+// Seam vertices share their position with another vertex, border vertices sit on an edge used by a single triangle
+//@DS:NEEDS_FREE_AFTER_USE
+bool* findLockedVertices(const uint32_t* weld, const uint32_t num_vertices, const uint32_t* indices, const uint32_t num_indices) {
+    bool* locked = calloc(MAX(num_vertices, 1), sizeof(bool));
+    uint32_t* num_wedges = calloc(MAX(num_vertices, 1), sizeof(uint32_t));
+    for(uint32_t v = 0; v < num_vertices; v++) num_wedges[weld[v]] += 1;
+    for(uint32_t v = 0; v < num_vertices; v++) locked[v] = num_wedges[weld[v]] > 1;
+    free(num_wedges);
+
+    uint64_t* edges = malloc(MAX(num_indices, 1) * sizeof(uint64_t));
+    for(uint32_t i = 0; i < num_indices; i++) {
+        const uint32_t a = weld[indices[i]];
+        const uint32_t b = weld[indices[i - i % 3 + (i + 1) % 3]];
+        edges[i] = a < b ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
+    }
+    qsort(edges, num_indices, sizeof(uint64_t), compareUint64);
+    for(uint32_t i = 0; i < num_indices;) {
+        uint32_t end = i + 1;
+        while(end < num_indices && edges[end] == edges[i]) end++;
+        if(end - i == 1) {
+            locked[edges[i] >> 32] = true;
+            locked[edges[i] & UINT32_MAX] = true;
+        }
+        i = end;
+    }
+    free(edges);
+
+    // Welded positions share the lock, a border through one wedge locks all of them
+    for(uint32_t v = 0; v < num_vertices; v++) locked[weld[v]] |= locked[v];
+    for(uint32_t v = 0; v < num_vertices; v++) locked[v] |= locked[weld[v]];
+    return locked;
+}
+
+// Would moving `from` onto the position of `to` flip or collapse any of its triangles that survive the collapse
+bool isLodCollapseFlipping(
+    const Vertex* vertices, const uint32_t* indices,
+    const uint32_t* adjacency_offsets, const uint32_t* adjacency,
+    const uint32_t from, const uint32_t to)
+{
+    for(uint32_t i = adjacency_offsets[from]; i < adjacency_offsets[from + 1]; i++) {
+        const uint32_t* triangle = &indices[3 * adjacency[i]];
+        if(triangle[0] == to || triangle[1] == to || triangle[2] == to) continue; // Degenerates and goes away
+
+        const float* before[3];
+        const float* after[3];
+        for(uint32_t k = 0; k < 3; k++) {
+            before[k] = vertices[triangle[k]].pos;
+            after[k] = triangle[k] == from ? vertices[to].pos : before[k];
+        }
+        double normal_before[3], normal_after[3];
+        triangleNormal(before[0], before[1], before[2], normal_before);
+        triangleNormal(after[0], after[1], after[2], normal_after);
+        const double dot = normal_before[0] * normal_after[0] + normal_before[1] * normal_after[1] + normal_before[2] * normal_after[2];
+        const double length_before = sqrt(normal_before[0] * normal_before[0] + normal_before[1] * normal_before[1] + normal_before[2] * normal_before[2]);
+        const double length_after = sqrt(normal_after[0] * normal_after[0] + normal_after[1] * normal_after[1] + normal_after[2] * normal_after[2]);
+        // Rejects flips as well as slivers, the face may turn by at most ~60 degrees
+        if(dot <= 0.5 * length_before * length_after) return true;
+    }
+    return false;
+}
+
+// Simplifies the triangle list towards target_indices and writes the result to out_indices (at most num_indices).
+// Returns the number of indices written, *out_error receives the square root of the worst applied collapse cost.
+uint32_t simplifyMesh(
+    const Vertex* vertices, const uint32_t num_vertices,
+    const uint32_t* indices, const uint32_t num_indices,
+    const uint32_t target_indices,
+    uint32_t* out_indices, float* out_error)
+{
+    uint32_t* weld = weldVertexPositions(vertices, num_vertices);
+    bool* locked = findLockedVertices(weld, num_vertices, indices, num_indices);
+
+    // Plane quadrics accumulate on the welded vertex, so every wedge of a seam sees the same error
+    Quadric* quadrics = calloc(MAX(num_vertices, 1), sizeof(Quadric));
+    for(uint32_t t = 0; t < num_indices / 3; t++) {
+        const float* p0 = vertices[indices[3 * t + 0]].pos;
+        double normal[3];
+        triangleNormal(p0, vertices[indices[3 * t + 1]].pos, vertices[indices[3 * t + 2]].pos, normal);
+        const double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if(length == 0.0) continue;
+        const double a = normal[0] / length, b = normal[1] / length, c = normal[2] / length;
+        const double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+        for(uint32_t k = 0; k < 3; k++) Quadric_addPlane(&quadrics[weld[indices[3 * t + k]]], a, b, c, d);
+    }
+
+    memcpy(out_indices, indices, num_indices * sizeof(uint32_t));
+    uint32_t num_result_indices = num_indices;
+    double max_cost = 0.0;
+
+    uint32_t* adjacency_offsets = malloc((num_vertices + 1) * sizeof(uint32_t));
+    uint32_t* adjacency = malloc(MAX(num_indices, 1) * sizeof(uint32_t));
+    uint32_t* collapse_target = malloc(MAX(num_vertices, 1) * sizeof(uint32_t));
+    bool* touched = malloc(MAX(num_vertices, 1) * sizeof(bool));
+    LodCollapse* collapses = malloc(MAX(2 * num_indices, 1) * sizeof(LodCollapse));
+
+    for(uint32_t pass = 0; pass < LOD_MAX_PASSES && num_result_indices > target_indices; pass++) {
+        // Vertex to triangle adjacency of the current result, counting sort into offsets
+        memset(adjacency_offsets, 0, (num_vertices + 1) * sizeof(uint32_t));
+        for(uint32_t i = 0; i < num_result_indices; i++) adjacency_offsets[out_indices[i] + 1] += 1;
+        for(uint32_t v = 0; v < num_vertices; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+        for(uint32_t i = 0; i < num_result_indices; i++) adjacency[adjacency_offsets[out_indices[i]]++] = i / 3;
+        for(uint32_t v = num_vertices; v > 0; v--) adjacency_offsets[v] = adjacency_offsets[v - 1];
+        adjacency_offsets[0] = 0;
+
+        uint32_t num_collapses = 0;
+        for(uint32_t i = 0; i < num_result_indices; i++) {
+            const uint32_t a = out_indices[i];
+            const uint32_t b = out_indices[i - i % 3 + (i + 1) % 3];
+            for(uint32_t direction = 0; direction < 2; direction++) {
+                const uint32_t from = direction == 0 ? a : b;
+                const uint32_t to = direction == 0 ? b : a;
+                if(locked[from]) continue;
+                Quadric combined = quadrics[from];
+                Quadric_add(&combined, &quadrics[weld[to]]);
+                collapses[num_collapses++] = (LodCollapse){.from = from, .to = to, .cost = (float)Quadric_evaluate(&combined, vertices[to].pos)};
+            }
+        }
+        if(num_collapses == 0) break;
+        qsort(collapses, num_collapses, sizeof(LodCollapse), compareLodCollapses);
+
+        for(uint32_t v = 0; v < num_vertices; v++) collapse_target[v] = v;
+        memset(touched, 0, num_vertices * sizeof(bool));
+        uint32_t num_remaining_indices = num_result_indices;
+        uint32_t num_applied = 0;
+        for(uint32_t c = 0; c < num_collapses && num_remaining_indices > target_indices; c++) {
+            const LodCollapse* collapse = &collapses[c];
+            if(touched[collapse->from] || touched[weld[collapse->to]]) continue;
+            if(isLodCollapseFlipping(vertices, out_indices, adjacency_offsets, adjacency, collapse->from, collapse->to)) continue;
+
+            // Every vertex around `from` sees its triangles change, so none of them may collapse again this pass
+            for(uint32_t i = adjacency_offsets[collapse->from]; i < adjacency_offsets[collapse->from + 1]; i++) {
+                const uint32_t* triangle = &out_indices[3 * adjacency[i]];
+                const bool degenerates = triangle[0] == collapse->to || triangle[1] == collapse->to || triangle[2] == collapse->to;
+                if(degenerates) num_remaining_indices -= 3;
+                for(uint32_t k = 0; k < 3; k++) touched[weld[triangle[k]]] = true;
+            }
+            touched[weld[collapse->to]] = true;
+            collapse_target[collapse->from] = collapse->to;
+            Quadric_add(&quadrics[weld[collapse->to]], &quadrics[collapse->from]);
+            max_cost = MAX(max_cost, (double)collapse->cost);
+            num_applied += 1;
+        }
+        if(num_applied == 0) break;
+
+        // Remaps the indices and drops triangles that lost their area, including ones folded across a seam
+        uint32_t write = 0;
+        for(uint32_t t = 0; t < num_result_indices / 3; t++) {
+            const uint32_t a = collapse_target[out_indices[3 * t + 0]];
+            const uint32_t b = collapse_target[out_indices[3 * t + 1]];
+            const uint32_t c = collapse_target[out_indices[3 * t + 2]];
+            if(weld[a] == weld[b] || weld[b] == weld[c] || weld[a] == weld[c]) continue;
+            out_indices[write++] = a;
+            out_indices[write++] = b;
+            out_indices[write++] = c;
+        }
+        num_result_indices = write;
+    }
+
+    free(collapses);
+    free(touched);
+    free(collapse_target);
+    free(adjacency);
+    free(adjacency_offsets);
+    free(quadrics);
+    free(locked);
+    free(weld);
+    *out_error = (float)sqrt(max_cost);
+    return num_result_indices;
+}
+
+// Appends the LOD chain of the imported mesh to its index list, LOD 0 keeps the original indices at the front.
+// Returns the number of LODs written to out_lods.
+uint32_t buildMeshLods(ImportedMesh* mesh, MeshLod* out_lods) {
+    TRACE_ZONE("OBJ import: build LOD chain");
+    out_lods[0] = (MeshLod){.first_index = 0, .num_indices = mesh->num_indices, .error = 0.0f};
+    uint32_t num_lods = 1;
+
+    // Every LOD has at most as many indices as LOD 0, so the worst case chain fits without regrowing
+    const uint32_t base_indices = mesh->num_indices;
+    mesh->indices = realloc(mesh->indices, MAX((uint64_t)base_indices * MESH_MAX_LODS, 1) * sizeof(uint32_t));
+    while(num_lods < MESH_MAX_LODS) {
+        const MeshLod* previous = &out_lods[num_lods - 1];
+        if(previous->num_indices / 3 <= LOD_MIN_TRIANGLES) break;
+
+        const uint32_t target_indices = (uint32_t)((float)(previous->num_indices / 3) * LOD_TARGET_RATIO) * 3;
+        float error = 0.0f;
+        const uint32_t first_index = previous->first_index + previous->num_indices;
+        const uint32_t num_indices = simplifyMesh(
+            mesh->vertices, mesh->num_vertices,
+            &mesh->indices[previous->first_index], previous->num_indices,
+            target_indices,
+            &mesh->indices[first_index], &error);
+        if(num_indices == 0 || (float)num_indices > (float)previous->num_indices * LOD_MIN_REDUCTION) break;
+
+        out_lods[num_lods] = (MeshLod){.first_index = first_index, .num_indices = num_indices, .error = previous->error + error};
+        num_lods += 1;
+    }
+    mesh->num_indices = out_lods[num_lods - 1].first_index + out_lods[num_lods - 1].num_indices;
+    return num_lods;
+}
+
+/*
+ * Mesh optimization
+ *
+ * Runs on every bake after the LOD chain is built. Each LOD's triangles are reordered for the post-transform vertex
+ * cache with Tipsify (Sander et al. 2007). The resulting clusters, split wherever Tipsify had to restart with a cold
+ * cache, are sorted outside-in, so front faces tend to be drawn before the faces they occlude. Vertices are then
+ * renumbered in order of first use, which turns vertex fetches into a mostly linear walk through the buffer.
+ */
+#define VERTEX_CACHE_SIZE 16 // Post-transform cache entries Tipsify optimizes for, also used to measure the result
+
+typedef struct {
+    float sort_key; // Larger faces outwards more, drawn first
+    uint32_t first_triangle;
+    uint32_t num_triangles;
+} TriangleCluster;
+
+int compareTriangleClusters(const void* a, const void* b) {
+    const TriangleCluster* lhs = a;
+    const TriangleCluster* rhs = b;
+    if(lhs->sort_key != rhs->sort_key) return lhs->sort_key > rhs->sort_key ? -1 : 1;
+    return lhs->first_triangle < rhs->first_triangle ? -1 : (lhs->first_triangle > rhs->first_triangle);
+}
+
+// Average cache misses per triangle of a FIFO cache with VERTEX_CACHE_SIZE entries, 3 is the worst, 0.5 the ideal for large meshes
+float computeAcmr(const uint32_t* indices, const uint32_t num_indices, const uint32_t num_vertices) {
+    if(num_indices < 3) return 0.0f;
+    uint32_t* timestamps = calloc(MAX(num_vertices, 1), sizeof(uint32_t)); // FIFO time the vertex was inserted, 0 if never
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+    uint32_t num_misses = 0;
+    for(uint32_t i = 0; i < num_indices; i++) {
+        const uint32_t v = indices[i];
+        if(time - timestamps[v] > VERTEX_CACHE_SIZE) {
+            timestamps[v] = time++;
+            num_misses += 1;
+        }
+    }
+    free(timestamps);
+    return (float)num_misses / (float)(num_indices / 3);
+}
+
+// Next fanning vertex for Tipsify: the live candidate that stays longest in the cache once its remaining triangles
+// are emitted, otherwise the most recent dead end, otherwise the next live vertex in input order.
+// Returns UINT32_UNINITIALIZED_VALUE once all triangles are emitted.
+uint32_t Tipsify_nextVertex(
+    const uint32_t* candidates, const uint32_t num_candidates,
+    const uint32_t* cache_times, const uint32_t time, const uint32_t* live_triangles,
+    uint32_t* dead_ends, uint32_t* num_dead_ends, uint32_t* cursor, const uint32_t num_vertices)
+{
+    uint32_t best_vertex = UINT32_UNINITIALIZED_VALUE;
+    int64_t best_priority = -1;
+    for(uint32_t i = 0; i < num_candidates; i++) {
+        const uint32_t v = candidates[i];
+        if(live_triangles[v] == 0) continue;
+        int64_t priority = 0;
+        if((int64_t)time - cache_times[v] + 2 * (int64_t)live_triangles[v] <= VERTEX_CACHE_SIZE) priority = (int64_t)time - cache_times[v];
+        if(priority > best_priority) {
+            best_priority = priority;
+            best_vertex = v;
+        }
+    }
+    if(best_vertex != UINT32_UNINITIALIZED_VALUE) return best_vertex;
+
+    while(*num_dead_ends > 0) {
+        const uint32_t v = dead_ends[--*num_dead_ends];
+        if(live_triangles[v] > 0) return v;
+    }
+    while(*cursor < num_vertices) {
+        const uint32_t v = (*cursor)++;
+        if(live_triangles[v] > 0) return v;
+    }
+    return UINT32_UNINITIALIZED_VALUE;
+}
+
+// Reorders the triangles of indices in place for the vertex cache and then sorts the clusters against overdraw.
+// The winding of every triangle is kept.
+void optimizeTriangleOrder(const Vertex* vertices, const uint32_t num_vertices, uint32_t* indices, const uint32_t num_indices) {
+    const uint32_t num_triangles = num_indices / 3;
+    if(num_triangles == 0) return;
+
+    // Vertex to triangle adjacency, counting sort into offsets
+    uint32_t* offsets = calloc(num_vertices + 1, sizeof(uint32_t));
+    for(uint32_t i = 0; i < num_indices; i++) offsets[indices[i] + 1] += 1;
+    for(uint32_t v = 0; v < num_vertices; v++) offsets[v + 1] += offsets[v];
+    uint32_t* adjacency = malloc(num_indices * sizeof(uint32_t));
+    uint32_t* live_triangles = calloc(num_vertices, sizeof(uint32_t));
+    for(uint32_t i = 0; i < num_indices; i++) adjacency[offsets[indices[i]] + live_triangles[indices[i]]++] = i / 3;
+
+    uint32_t* cache_times = calloc(num_vertices, sizeof(uint32_t));
+    bool* is_emitted = calloc(num_triangles, sizeof(bool));
+    uint32_t* dead_ends = malloc(num_indices * sizeof(uint32_t)); // Every emitted corner is pushed once
+    uint32_t* candidates = malloc(num_indices * sizeof(uint32_t));
+    uint32_t* triangle_order = malloc(num_triangles * sizeof(uint32_t));
+    TriangleCluster* clusters = malloc(num_triangles * sizeof(TriangleCluster));
+    uint32_t num_dead_ends = 0, cursor = 0, num_emitted = 0, num_clusters = 0;
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+
+    // LODs past the first index into the shared vertex array, so vertex 0 isn't necessarily part of this range
+    uint32_t fanning_vertex = indices[0];
+    while(fanning_vertex != UINT32_UNINITIALIZED_VALUE) {
+        // A fanning vertex that already left the cache starts a new cluster, the order inside a cluster stays untouched
+        if(num_clusters == 0 || time - cache_times[fanning_vertex] > VERTEX_CACHE_SIZE) {
+            if(num_clusters > 0) clusters[num_clusters - 1].num_triangles = num_emitted - clusters[num_clusters - 1].first_triangle;
+            clusters[num_clusters++] = (TriangleCluster){.first_triangle = num_emitted};
+        }
+
+        uint32_t num_candidates = 0;
+        for(uint32_t a = offsets[fanning_vertex]; a < offsets[fanning_vertex + 1]; a++) {
+            const uint32_t t = adjacency[a];
+            if(is_emitted[t]) continue;
+            for(uint32_t c = 0; c < 3; c++) {
+                const uint32_t v = indices[3 * t + c];
+                dead_ends[num_dead_ends++] = v;
+                candidates[num_candidates++] = v;
+                live_triangles[v] -= 1;
+                if(time - cache_times[v] > VERTEX_CACHE_SIZE) cache_times[v] = time++;
+            }
+            is_emitted[t] = true;
+            triangle_order[num_emitted++] = t;
+        }
+        fanning_vertex = Tipsify_nextVertex(candidates, num_candidates, cache_times, time, live_triangles, dead_ends, &num_dead_ends, &cursor, num_vertices);
+    }
+    clusters[num_clusters - 1].num_triangles = num_emitted - clusters[num_clusters - 1].first_triangle;
+
+    // An empty cluster has no center or normal to sort by and nothing to draw
+    uint32_t num_nonempty_clusters = 0;
+    for(uint32_t c = 0; c < num_clusters; c++) {
+        if(clusters[c].num_triangles > 0) clusters[num_nonempty_clusters++] = clusters[c];
+    }
+    num_clusters = num_nonempty_clusters;
+
+    // Clusters facing away from the mesh center are likely in front of the ones facing towards it
+    vec3 mesh_center = {0.0f, 0.0f, 0.0f};
+    for(uint32_t i = 0; i < num_indices; i++) glm_vec3_add(mesh_center, (float*)vertices[indices[i]].pos, mesh_center);
+    glm_vec3_scale(mesh_center, 1.0f / (float)num_indices, mesh_center);
+    for(uint32_t c = 0; c < num_clusters; c++) {
+        vec3 center = {0.0f, 0.0f, 0.0f}, normal = {0.0f, 0.0f, 0.0f};
+        for(uint32_t i = 0; i < clusters[c].num_triangles; i++) {
+            const uint32_t* triangle = &indices[3 * triangle_order[clusters[c].first_triangle + i]];
+            const float* p0 = vertices[triangle[0]].pos;
+            const float* p1 = vertices[triangle[1]].pos;
+            const float* p2 = vertices[triangle[2]].pos;
+            vec3 edge0, edge1, area_normal;
+            glm_vec3_sub((float*)p1, (float*)p0, edge0);
+            glm_vec3_sub((float*)p2, (float*)p0, edge1);
+            glm_vec3_cross(edge0, edge1, area_normal);
+            glm_vec3_add(normal, area_normal, normal);
+            glm_vec3_add(center, (float*)p0, center);
+            glm_vec3_add(center, (float*)p1, center);
+            glm_vec3_add(center, (float*)p2, center);
+        }
+        glm_vec3_scale(center, 1.0f / (float)(3 * clusters[c].num_triangles), center);
+        glm_vec3_sub(center, mesh_center, center);
+        glm_vec3_normalize(normal);
+        clusters[c].sort_key = glm_vec3_dot(center, normal);
+    }
+    qsort(clusters, num_clusters, sizeof(TriangleCluster), compareTriangleClusters);
+
+    uint32_t* reordered = malloc(num_indices * sizeof(uint32_t));
+    uint32_t num_reordered = 0;
+    for(uint32_t c = 0; c < num_clusters; c++) {
+        for(uint32_t i = 0; i < clusters[c].num_triangles; i++) {
+            memcpy(&reordered[num_reordered], &indices[3 * triangle_order[clusters[c].first_triangle + i]], 3 * sizeof(uint32_t));
+            num_reordered += 3;
+        }
+    }
+    memcpy(indices, reordered, num_reordered * sizeof(uint32_t));
+
+    free(reordered); free(clusters); free(triangle_order); free(candidates); free(dead_ends);
+    free(is_emitted); free(cache_times); free(live_triangles); free(adjacency); free(offsets);
+}
+
+// Renumbers the vertices in order of first use across all LODs and drops the ones no index refers to
+void optimizeVertexFetch(ImportedMesh* mesh) {
+    uint32_t* remap = malloc(MAX(mesh->num_vertices, 1) * sizeof(uint32_t));
+    memset(remap, 0xFF, mesh->num_vertices * sizeof(uint32_t)); // UINT32_UNINITIALIZED_VALUE
+    Vertex* vertices = malloc(MAX(mesh->num_vertices, 1) * sizeof(Vertex));
+    uint32_t num_vertices = 0;
+    for(uint32_t i = 0; i < mesh->num_indices; i++) {
+        const uint32_t v = mesh->indices[i];
+        if(remap[v] == UINT32_UNINITIALIZED_VALUE) {
+            remap[v] = num_vertices;
+            vertices[num_vertices++] = mesh->vertices[v];
+        }
+        mesh->indices[i] = remap[v];
+    }
+    free(mesh->vertices);
+    mesh->vertices = vertices;
+    mesh->num_vertices = num_vertices;
+    free(remap);
+}
+
+void optimizeMesh(ImportedMesh* mesh, const MeshLod* lods, const uint32_t num_lods) {
+    TRACE_ZONE("OBJ import: optimize mesh");
+    const float acmr_before = computeAcmr(mesh->indices, lods[0].num_indices, mesh->num_vertices);
+    for(uint32_t i = 0; i < num_lods; i++) {
+        optimizeTriangleOrder(mesh->vertices, mesh->num_vertices, &mesh->indices[lods[i].first_index], lods[i].num_indices);
+    }
+    optimizeVertexFetch(mesh);
+    printf("[[DS-MESHOPT]] LOD 0 ACMR %.3f -> %.3f (%u entry FIFO)\n",
+           acmr_before, computeAcmr(mesh->indices, lods[0].num_indices, mesh->num_vertices), VERTEX_CACHE_SIZE);
+}
+
+/*
+ * Vertex quantization
+ *
+ * With MESH_QUANTIZE_VERTICES the mesh cache stores QuantizedVertex instead of Vertex, half the size.
+ * Every attribute uses a format the vertex input stage converts to float by itself, so shaders read
+ * the same vec3 / vec2 inputs either way. Positions are normalized into the mesh's bounding cube, the
+ * dequantization (offset, uniform scale) is folded into the model matrix or the instance placement.
+ */
+// Round to nearest even, overflows become infinity
+uint16_t floatToHalf(const float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t float_exponent = (bits >> 23) & 0xFFu;
+    const int32_t exponent = (int32_t)float_exponent - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+    if(float_exponent == 0xFFu) return (uint16_t)(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    if(exponent >= 31) return (uint16_t)(sign | 0x7C00u);
+
+    uint32_t shift = 13;
+    uint32_t half = ((uint32_t)MAX(exponent, 0) << 10);
+    if(exponent <= 0) {
+        // Subnormal, the implicit leading one becomes explicit
+        if(exponent < -10) return (uint16_t)sign;
+        mantissa |= 0x800000u;
+        shift = (uint32_t)(14 - exponent);
+    }
+    half |= mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (half & 1u))) half += 1; // A carry into the exponent rounds correctly
+    return (uint16_t)(sign | half);
+}
+
+int16_t quantizeSnorm16(const float value) {
+    return (int16_t)lroundf(glm_clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+int8_t quantizeSnorm8(const float value) {
+    return (int8_t)lroundf(glm_clamp(value, -1.0f, 1.0f) * 127.0f);
+}
+
+// The dequantization maps the normalized positions back into object space, xyz is the offset and w the uniform scale.
+// A uniform scale keeps normals valid under the model matrix it is folded into.
+void getMeshDequantization(const vec3 bounds_min, const vec3 bounds_max, vec4 out_dequantization) {
+#if MESH_QUANTIZE_VERTICES
+    vec3 center, extent;
+    glm_vec3_add((float*)bounds_min, (float*)bounds_max, center);
+    glm_vec3_scale(center, 0.5f, center);
+    glm_vec3_sub((float*)bounds_max, (float*)bounds_min, extent);
+    const float half_extent = 0.5f * MAX(extent[0], MAX(extent[1], extent[2]));
+    glm_vec4(center, half_extent > 0.0f ? half_extent : 1.0f, out_dequantization);
+#else
+    glm_vec4((vec3){0.0f, 0.0f, 0.0f}, 1.0f, out_dequantization);
+#endif
+}
+
+//@DS:NEEDS_FREE_AFTER_USE
+MeshVertex* packMeshVertices(const Vertex* vertices, const uint32_t num_vertices, const vec4 dequantization) {
+    MeshVertex* packed = malloc(MAX(num_vertices, 1) * sizeof(MeshVertex));
+#if MESH_QUANTIZE_VERTICES
+    const float inverse_scale = 1.0f / dequantization[3];
+    for(uint32_t i = 0; i < num_vertices; i++) {
+        const Vertex* vertex = &vertices[i];
+        vec3 normal;
+        glm_vec3_copy((float*)vertex->normal, normal);
+        glm_vec3_normalize(normal);
+        packed[i] = (QuantizedVertex){
+            .pos = {
+                quantizeSnorm16((vertex->pos[0] - dequantization[0]) * inverse_scale),
+                quantizeSnorm16((vertex->pos[1] - dequantization[1]) * inverse_scale),
+                quantizeSnorm16((vertex->pos[2] - dequantization[2]) * inverse_scale),
+                0},
+            .normal = {quantizeSnorm8(normal[0]), quantizeSnorm8(normal[1]), quantizeSnorm8(normal[2]), 0},
+            .texCoord = {floatToHalf(vertex->texCoord[0]), floatToHalf(vertex->texCoord[1])}};
+    }
+#else
+    (void)dequantization;
+    memcpy(packed, vertices, num_vertices * sizeof(Vertex));
+#endif
+    return packed;
+}
+
+bool buildMeshCache(const char* obj_path, const char* cache_path) {
+    ImportedMesh mesh;
+    if(!importObj(obj_path, &mesh)) return false;
+
+    printf("Baked '%s' into '%s' (%u face corners -> %u unique vertices).\n", obj_path, cache_path, mesh.num_indices, mesh.num_vertices);
+    MeshLod lods[MESH_MAX_LODS];
+    const uint32_t num_lods = buildMeshLods(&mesh, lods);
+    for(uint32_t i = 0; i < num_lods; i++) {
+        printf("[[DS-LOD]] '%s' LOD %u: %u triangles, error %.5f\n", obj_path, i, lods[i].num_indices / 3, lods[i].error);
+    }
+    optimizeMesh(&mesh, lods, num_lods);
+
+    bool success = false;
+    {
+        TRACE_ZONE("OBJ import: write mesh cache");
+        vec4 dequantization;
+        getMeshDequantization(mesh.bounds_min, mesh.bounds_max, dequantization);
+        MeshVertex* vertices = packMeshVertices(mesh.vertices, mesh.num_vertices, dequantization);
+        success = writeMeshCache(cache_path, vertices, mesh.num_vertices, mesh.indices, mesh.num_indices, lods, num_lods, mesh.bounds_min, mesh.bounds_max, dequantization);
+        free(vertices);
+    }
+    ImportedMesh_free(&mesh);
+    return success;
+}
+
+// Maps the cache file and validates its header, returns false if the file is missing, truncated or outdated
+bool mapMeshCache(const char* cache_path, Mesh* out_mesh) {
+    FileView cache_file;
+    if(!FileView_open(cache_path, &cache_file)) return false;
+    const size_t file_size = cache_file.size;
+    if(file_size < sizeof(MeshCacheHeader)) {
+        FileView_close(&cache_file);
+        return false;
+    }
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)cache_file.data;
+    const bool header_is_valid =
+        header->magic == MESH_CACHE_MAGIC &&
+        header->version == MESH_CACHE_VERSION &&
+        header->vertex_stride == sizeof(MeshVertex) &&
+        (header->index_size == sizeof(uint16_t) || header->index_size == sizeof(uint32_t)) &&
+        header->vertex_offset + (uint64_t)header->num_vertices * sizeof(MeshVertex) <= file_size &&
+        header->index_offset + (uint64_t)header->num_indices * header->index_size <= file_size &&
+        header->num_lods >= 1 && header->num_lods <= MESH_MAX_LODS;
+    bool lods_are_valid = header_is_valid;
+    for(uint32_t i = 0; lods_are_valid && i < header->num_lods; i++) {
+        lods_are_valid = (uint64_t)header->lods[i].first_index + header->lods[i].num_indices <= header->num_indices;
+    }
+    if(!lods_are_valid) {
+        fprintf(stderr, "Mesh cache '%s' has an invalid or outdated header.\n", cache_path);
+        FileView_close(&cache_file);
+        return false;
+    }
+
+    out_mesh->vertices = (const MeshVertex*)(cache_file.data + header->vertex_offset);
+    out_mesh->num_vertices = header->num_vertices;
+    out_mesh->indices = cache_file.data + header->index_offset;
+    out_mesh->num_indices = header->num_indices;
+    out_mesh->index_type = (header->index_size == sizeof(uint16_t)) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    memcpy(out_mesh->bounds_min, header->bounds_min, sizeof(vec3));
+    memcpy(out_mesh->bounds_max, header->bounds_max, sizeof(vec3));
+    memcpy(out_mesh->dequantization, header->dequantization, sizeof(vec4));
+    memcpy(out_mesh->lods, header->lods, sizeof(out_mesh->lods));
+    out_mesh->num_lods = header->num_lods;
+    out_mesh->file = cache_file;
+    return true;
+}
+
+void unmapMesh(Mesh* mesh) {
+    FileView_close(&mesh->file);
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+}
+
+// Loads the mesh behind obj_path through its binary cache, (re)baking the cache first if it is missing or stale.
+//@DS:NEEDS_FREE_AFTER_USE (unmapMesh)
+void loadMesh(const char* obj_path, Mesh* out_mesh) {
+    char cache_path[PATH_MAX];
+    getMeshCachePath(obj_path, cache_path, sizeof(cache_path));
+
+    struct stat obj_stat;
+    struct stat cache_stat;
+    const bool has_obj = stat(obj_path, &obj_stat) == 0;
+    const bool has_cache = stat(cache_path, &cache_stat) == 0;
+    if(!has_obj && !has_cache) PANIC("Neither '%s' nor its mesh cache '%s' exist", obj_path, cache_path);
+
+    // Equal timestamps are treated as stale as well, st_mtime only has second granularity
+    bool did_rebuild = false;
+    if(has_obj && (!has_cache || cache_stat.st_mtime <= obj_stat.st_mtime)) {
+        printf("Mesh cache '%s' is missing or older than '%s', rebuilding it.\n", cache_path, obj_path);
+        if(!buildMeshCache(obj_path, cache_path)) PANIC("Failed to build mesh cache for '%s'", obj_path);
+        did_rebuild = true;
+    }
+
+    if(mapMeshCache(cache_path, out_mesh)) return;
+    if(!has_obj || did_rebuild) PANIC("Failed to load mesh cache '%s'", cache_path);
+
+    printf("Rebuilding unusable mesh cache '%s'.\n", cache_path);
+    if(!buildMeshCache(obj_path, cache_path)) PANIC("Failed to build mesh cache for '%s'", obj_path);
+    if(!mapMeshCache(cache_path, out_mesh)) PANIC("Failed to load freshly built mesh cache '%s'", cache_path);
+}
+
+
+/*
+ * Scene store
+ *
+ * Local transforms are kept as structure of arrays next to parent indices and per node flags. A parent is always
+ * created before its children, so a single pass in index order sees every parent's world matrix before its children.
+ * Scene_update only touches what changed. Local matrices are rebuilt in SIMD batches of SCENE_BATCH_SIZE nodes
+ * for every batch that contains a modified node. World matrices are only recomputed for modified nodes and for the
+ * subtrees below them.
+ */
+#define SCENE_NO_PARENT UINT32_MAX
+#define SCENE_BATCH_SIZE 4 // Nodes per matrix batch, capacity is always a multiple of it
+#define SCENE_LOCAL_DIRTY   0x1 // Local transform changed since the last Scene_update
+#define SCENE_WORLD_CHANGED 0x2 // World matrix was recomputed by the last Scene_update
+
+typedef struct {
+    float* position_x;
+    float* position_y;
+    float* position_z;
+    float* rotation_x; // Rotations are expected to be unit quaternions
+    float* rotation_y;
+    float* rotation_z;
+    float* rotation_w;
+    float* scale_x;
+    float* scale_y;
+    float* scale_z;
+    uint32_t* parent; // Always smaller than the node's own index, or SCENE_NO_PARENT
+    uint8_t* flags;
+    mat4* local_matrices;
+    mat4* world_matrices;
+    uint32_t num_nodes;
+    uint32_t capacity;
+} Scene;
+
+//@DS:NEEDS_FREE_AFTER_USE (free)
+void* reallocAligned(void* old_memory, const size_t old_size, const size_t new_size) {
+    void* memory = NULL;
+    if(posix_memalign(&memory, SIMD_ALIGNMENT, new_size) != 0) PANIC("Out of memory (%zu bytes)", new_size);
+    if(old_memory != NULL) memcpy(memory, old_memory, old_size);
+    free(old_memory);
+    return memory;
+}
+
+void Scene_reserve(Scene* scene, uint32_t capacity) {
+    capacity = (capacity + SCENE_BATCH_SIZE - 1) / SCENE_BATCH_SIZE * SCENE_BATCH_SIZE;
+    if(capacity <= scene->capacity) return;
+
+    float** components[] = {
+        &scene->position_x, &scene->position_y, &scene->position_z,
+        &scene->rotation_x, &scene->rotation_y, &scene->rotation_z, &scene->rotation_w,
+        &scene->scale_x, &scene->scale_y, &scene->scale_z};
+    for(uint32_t i = 0; i < sizeof(components) / sizeof(components[0]); i++) {
+        *components[i] = reallocAligned(*components[i], scene->capacity * sizeof(float), capacity * sizeof(float));
+        memset(*components[i] + scene->capacity, 0, (capacity - scene->capacity) * sizeof(float));
+    }
+    scene->parent = reallocAligned(scene->parent, scene->capacity * sizeof(uint32_t), capacity * sizeof(uint32_t));
+    scene->flags = reallocAligned(scene->flags, scene->capacity * sizeof(uint8_t), capacity * sizeof(uint8_t));
+    memset(scene->flags + scene->capacity, 0, capacity - scene->capacity);
+    scene->local_matrices = reallocAligned(scene->local_matrices, scene->capacity * sizeof(mat4), capacity * sizeof(mat4));
+    scene->world_matrices = reallocAligned(scene->world_matrices, scene->capacity * sizeof(mat4), capacity * sizeof(mat4));
+    scene->capacity = capacity;
+}
+
+void Scene_setTransform(Scene* scene, const uint32_t node, const Transform* transform) {
+    scene->position_x[node] = transform->position[0];
+    scene->position_y[node] = transform->position[1];
+    scene->position_z[node] = transform->position[2];
+    scene->rotation_x[node] = transform->rotation[0];
+    scene->rotation_y[node] = transform->rotation[1];
+    scene->rotation_z[node] = transform->rotation[2];
+    scene->rotation_w[node] = transform->rotation[3];
+    scene->scale_x[node] = transform->scale[0];
+    scene->scale_y[node] = transform->scale[1];
+    scene->scale_z[node] = transform->scale[2];
+    scene->flags[node] |= SCENE_LOCAL_DIRTY;
+}
+
+void Scene_setRotation(Scene* scene, const uint32_t node, const quat rotation) {
+    scene->rotation_x[node] = rotation[0];
+    scene->rotation_y[node] = rotation[1];
+    scene->rotation_z[node] = rotation[2];
+    scene->rotation_w[node] = rotation[3];
+    scene->flags[node] |= SCENE_LOCAL_DIRTY;
+}
+
+// Returns the index of the new node, its world matrix is valid after the next Scene_update
+uint32_t Scene_addNode(Scene* scene, const Transform* transform, const uint32_t parent) {
+    if(parent != SCENE_NO_PARENT && parent >= scene->num_nodes) PANIC("Scene parent %u does not exist", parent);
+    if(scene->num_nodes == scene->capacity) Scene_reserve(scene, MAX(scene->capacity * 2, SCENE_BATCH_SIZE));
+    const uint32_t node = scene->num_nodes++;
+    scene->parent[node] = parent;
+    scene->flags[node] = 0;
+    Scene_setTransform(scene, node, transform);
+    return node;
+}
+
+bool Scene_isWorldChanged(const Scene* scene, const uint32_t node) {
+    return (scene->flags[node] & SCENE_WORLD_CHANGED) != 0;
+}
+
+void Scene_free(Scene* scene) {
+    free(scene->position_x); free(scene->position_y); free(scene->position_z);
+    free(scene->rotation_x); free(scene->rotation_y); free(scene->rotation_z); free(scene->rotation_w);
+    free(scene->scale_x); free(scene->scale_y); free(scene->scale_z);
+    free(scene->parent); free(scene->flags); free(scene->local_matrices); free(scene->world_matrices);
+    memset(scene, 0, sizeof(Scene));
+}
+
+// Scale, then rotate, then translate, the same matrix glm_translate * glm_quat_rotate * glm_scale would produce
+void composeLocalMatricesScalar(Scene* scene, const uint32_t first) {
+    for(uint32_t i = first; i < first + SCENE_BATCH_SIZE; i++) {
+        const float x = scene->rotation_x[i], y = scene->rotation_y[i], z = scene->rotation_z[i], w = scene->rotation_w[i];
+        const float sx = scene->scale_x[i], sy = scene->scale_y[i], sz = scene->scale_z[i];
+        float* m = (float*)scene->local_matrices[i];
+        m[0]  = (1.0f - 2.0f * (y * y + z * z)) * sx;
+        m[1]  = 2.0f * (x * y + w * z) * sx;
+        m[2]  = 2.0f * (x * z - w * y) * sx;
+        m[3]  = 0.0f;
+        m[4]  = 2.0f * (x * y - w * z) * sy;
+        m[5]  = (1.0f - 2.0f * (x * x + z * z)) * sy;
+        m[6]  = 2.0f * (y * z + w * x) * sy;
+        m[7]  = 0.0f;
+        m[8]  = 2.0f * (x * z + w * y) * sz;
+        m[9]  = 2.0f * (y * z - w * x) * sz;
+        m[10] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+        m[11] = 0.0f;
+        m[12] = scene->position_x[i];
+        m[13] = scene->position_y[i];
+        m[14] = scene->position_z[i];
+        m[15] = 1.0f;
+    }
+}
+
+#if defined(__SSE2__)
+// Every register holds one matrix element of 4 nodes, each column is transposed back into the 4 mat4s
+void composeLocalMatricesSSE(Scene* scene, const uint32_t first) {
+    const __m128 x = _mm_load_ps(&scene->rotation_x[first]);
+    const __m128 y = _mm_load_ps(&scene->rotation_y[first]);
+    const __m128 z = _mm_load_ps(&scene->rotation_z[first]);
+    const __m128 w = _mm_load_ps(&scene->rotation_w[first]);
+    const __m128 sx = _mm_load_ps(&scene->scale_x[first]);
+    const __m128 sy = _mm_load_ps(&scene->scale_y[first]);
+    const __m128 sz = _mm_load_ps(&scene->scale_z[first]);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+    const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+    const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+    __m128 columns[4][4] = {
+        {_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+         _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+         _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+         _mm_setzero_ps()},
+        {_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+         _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+         _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+         _mm_setzero_ps()},
+        {_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+         _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+         _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+         _mm_setzero_ps()},
+        {_mm_load_ps(&scene->position_x[first]),
+         _mm_load_ps(&scene->position_y[first]),
+         _mm_load_ps(&scene->position_z[first]),
+         one}};
+
+    for(uint32_t column = 0; column < 4; column++) {
+        _MM_TRANSPOSE4_PS(columns[column][0], columns[column][1], columns[column][2], columns[column][3]);
+        for(uint32_t i = 0; i < 4; i++) _mm_store_ps(scene->local_matrices[first + i][column], columns[column][i]);
+    }
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+void composeLocalMatricesNEON(Scene* scene, const uint32_t first) {
+    const float32x4_t x = vld1q_f32(&scene->rotation_x[first]);
+    const float32x4_t y = vld1q_f32(&scene->rotation_y[first]);
+    const float32x4_t z = vld1q_f32(&scene->rotation_z[first]);
+    const float32x4_t w = vld1q_f32(&scene->rotation_w[first]);
+    const float32x4_t sx = vld1q_f32(&scene->scale_x[first]);
+    const float32x4_t sy = vld1q_f32(&scene->scale_y[first]);
+    const float32x4_t sz = vld1q_f32(&scene->scale_z[first]);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    const float32x4_t xx = vmulq_f32(x, x), yy = vmulq_f32(y, y), zz = vmulq_f32(z, z);
+    const float32x4_t xy = vmulq_f32(x, y), xz = vmulq_f32(x, z), yz = vmulq_f32(y, z);
+    const float32x4_t wx = vmulq_f32(w, x), wy = vmulq_f32(w, y), wz = vmulq_f32(w, z);
+
+    const float32x4_t columns[4][4] = {
+        {vmulq_f32(vfmsq_n_f32(one, vaddq_f32(yy, zz), 2.0f), sx),
+         vmulq_f32(vmulq_n_f32(vaddq_f32(xy, wz), 2.0f), sx),
+         vmulq_f32(vmulq_n_f32(vsubq_f32(xz, wy), 2.0f), sx),
+         zero},
+        {vmulq_f32(vmulq_n_f32(vsubq_f32(xy, wz), 2.0f), sy),
+         vmulq_f32(vfmsq_n_f32(one, vaddq_f32(xx, zz), 2.0f), sy),
+         vmulq_f32(vmulq_n_f32(vaddq_f32(yz, wx), 2.0f), sy),
+         zero},
+        {vmulq_f32(vmulq_n_f32(vaddq_f32(xz, wy), 2.0f), sz),
+         vmulq_f32(vmulq_n_f32(vsubq_f32(yz, wx), 2.0f), sz),
+         vmulq_f32(vfmsq_n_f32(one, vaddq_f32(xx, yy), 2.0f), sz),
+         zero},
+        {vld1q_f32(&scene->position_x[first]),
+         vld1q_f32(&scene->position_y[first]),
+         vld1q_f32(&scene->position_z[first]),
+         one}};
+
+    for(uint32_t column = 0; column < 4; column++) {
+        const float32x4x2_t t01 = vtrnq_f32(columns[column][0], columns[column][1]);
+        const float32x4x2_t t23 = vtrnq_f32(columns[column][2], columns[column][3]);
+        vst1q_f32(scene->local_matrices[first + 0][column], vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+        vst1q_f32(scene->local_matrices[first + 1][column], vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+        vst1q_f32(scene->local_matrices[first + 2][column], vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+        vst1q_f32(scene->local_matrices[first + 3][column], vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+    }
+}
+#endif
+
+void composeLocalMatrices(Scene* scene, const uint32_t first) {
+#if defined(__SSE2__)
+    composeLocalMatricesSSE(scene, first);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    composeLocalMatricesNEON(scene, first);
+#else
+    composeLocalMatricesScalar(scene, first);
+#endif
+}
+
+void Scene_update(Scene* scene) {
+    // Flags of a batch are read as one word, capacity is a multiple of SCENE_BATCH_SIZE so this never reads past the end
+    for(uint32_t first = 0; first < scene->num_nodes; first += SCENE_BATCH_SIZE) {
+        uint32_t batch_flags;
+        memcpy(&batch_flags, &scene->flags[first], sizeof(batch_flags));
+        if(batch_flags & (SCENE_LOCAL_DIRTY * 0x01010101u)) composeLocalMatrices(scene, first);
+    }
+
+    for(uint32_t i = 0; i < scene->num_nodes; i++) {
+        const uint32_t parent = scene->parent[i];
+        const bool is_parent_changed = parent != SCENE_NO_PARENT && (scene->flags[parent] & SCENE_WORLD_CHANGED);
+        const bool is_changed = (scene->flags[i] & SCENE_LOCAL_DIRTY) || is_parent_changed;
+        scene->flags[i] = is_changed ? SCENE_WORLD_CHANGED : 0;
+        if(!is_changed) continue;
+
+        if(parent == SCENE_NO_PARENT) glm_mat4_copy(scene->local_matrices[i], scene->world_matrices[i]);
+        else glm_mat4_mul(scene->world_matrices[parent], scene->local_matrices[i], scene->world_matrices[i]);
+    }
+}
+
+
+/*
+ * GPU memory allocator
+ *
+ * vkAllocateMemory is slow and drivers only guarantee maxMemoryAllocationCount (often just 4096) live allocations,
+ * so resources are sub-allocated from large blocks instead. Every memory type gets its own blocks and linear
+ * resources (buffers) never share a block with optimally tiled images, which sidesteps bufferImageGranularity.
+ * Inside a block the free space is managed by a TLSF allocator (two level segregated fit): free regions are binned
+ * by size into TLSF_FL_COUNT x TLSF_SL_COUNT lists with bitmaps on top, so allocating and freeing are O(1) and
+ * neighbouring free regions get merged right away.
+ * Resources larger than half a block, or that the driver wants on their own, get a dedicated VkDeviceMemory.
+ * Host visible blocks stay mapped for their whole lifetime, GpuAllocation.mapped points at the resource itself.
+ * Not thread safe, GPU resources are only ever created and destroyed on the main thread.
+ */
+#define GPU_BLOCK_SIZE (64ull << 20)
+#define GPU_ALLOCATION_GRANULARITY 256 // Every offset and size inside a block is a multiple of this
+#define TLSF_FL_COUNT 32
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1u << TLSF_SL_LOG2)
+#define TLSF_NONE UINT32_MAX
+
+typedef enum {
+    GPU_RESOURCE_LINEAR,  // Buffers and linearly tiled images
+    GPU_RESOURCE_OPTIMAL, // Optimally tiled images
+    GPU_RESOURCE_KIND_COUNT,
+} GpuResourceKind;
+
+// A contiguous piece of a block, offsets and sizes are in units of GPU_ALLOCATION_GRANULARITY
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t prev_physical; // Neighbours in address order
+    uint32_t next_physical;
+    uint32_t prev_free;     // Links inside the size class list, next_free also links the unused region slots
+    uint32_t next_free;
+    bool is_free;
+} TlsfRegion;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    char* mapped;
+    uint32_t memory_type;
+    GpuResourceKind kind;
+    VkDeviceSize used;
+    uint32_t num_allocations;
+
+    TlsfRegion* regions;
+    uint32_t num_regions;
+    uint32_t regions_capacity;
+    uint32_t first_unused_region;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmaps[TLSF_FL_COUNT];
+    uint32_t free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} GpuMemoryBlock;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize offset; // Where the resource is bound inside memory
+    VkDeviceSize size;
+    void* mapped;        // NULL unless the memory is host visible
+    GpuMemoryBlock* block; // NULL for dedicated allocations
+    uint32_t region;
+    uint32_t memory_type;
+} GpuAllocation;
+
+typedef struct {
+    GpuMemoryBlock** blocks;
+    uint32_t num_blocks;
+    uint32_t blocks_capacity;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize block_sizes[VK_MAX_MEMORY_TYPES];
+    uint32_t num_device_memory_objects; // Live vkAllocateMemory results, blocks and dedicated allocations alike
+    uint32_t max_device_memory_objects;
+    uint32_t num_dedicated_allocations;
+    VkDeviceSize dedicated_bytes;
+} GpuAllocator;
+
+// GPU side of a mesh together with its placement in the scene
+typedef struct {
+    VkBuffer vertex_buffer;
+    GpuAllocation vertex_buffer_allocation;
+    VkBuffer index_buffer;
+    GpuAllocation index_buffer_allocation;
+    VkIndexType index_type;
+    MeshLod lods[MESH_MAX_LODS]; // Ranges of index_buffer, see Mesh LOD generation
+    uint32_t num_lods;
+    vec4 dequantization; // Maps vertex buffer positions into object space, see Vertex quantization
+    vec3 bounds_min;
+    vec3 bounds_max;
+    uint32_t scene_node; // Placement in g_scene
+} Model;
+
+// Push constants of shaders/cull_instances.comp, first_visible_instance changes with the frame in flight
+typedef struct {
+    uint32_t num_objects;
+    uint32_t first_source_instance; // InstanceData of object 0, see InstancedModel.first_object_record
+    uint32_t first_visible_instance; // Bucket of LOD 0 in the compacted output, each bucket holds num_objects
+    uint32_t num_lods;
+    float mesh_radius; // Bounding radius at scale 1, an instance's bounding radius divided by it is its scale
+    MeshLod lods[MESH_MAX_LODS];
+} CullingPushConstants;
+
+// Per frame input of shaders/cull_instances.comp, rewritten every frame in the batch's slot of the frame uniform ring.
+// Planes are (normal, distance) pairs in the batch's space pointing inwards.
+typedef struct {
+    vec4 frustum_planes[6];
+    vec4 camera_position; // xyz in the batch's space, w is the LOD scale (see getLodScale)
+} CullingUniforms;
+
+// One mesh drawn many times with a single vkCmdDrawIndexed, placements live in a per instance vertex buffer
+typedef struct {
+    Model model;
+    VkBuffer instance_buffer;
+    GpuAllocation instance_buffer_allocation;
+    uint32_t num_instances;
+
+    // GPU driven path, only created if g_gpu_culling_enabled. World space bounding spheres feed the culling pass,
+    // which fills one indirect buffer (a command per LOD) and one compacted instance stream per frame in flight.
+    // In bindless mode the compacted records live in g_object_record_buffer instead of visible_instance_buffers
+    VkBuffer bounds_buffer;
+    GpuAllocation bounds_buffer_allocation;
+    VkBuffer indirect_buffers[MAX_FRAMES_IN_FLIGHT];
+    GpuAllocation indirect_buffer_allocations[MAX_FRAMES_IN_FLIGHT];
+    VkBuffer visible_instance_buffers[MAX_FRAMES_IN_FLIGHT];
+    GpuAllocation visible_instance_buffer_allocations[MAX_FRAMES_IN_FLIGHT];
+    VkDescriptorSet culling_descriptor_sets[MAX_FRAMES_IN_FLIGHT];
+    uint32_t culling_slot; // Index of its CullingUniforms in the frame uniform rings
+
+    // Bindless path, only used if g_bindless_enabled. The InstanceData live in g_object_record_buffer
+    // instead of instance_buffer, starting at this record. With GPU culling every frame in flight's compacted
+    // buckets follow them, starting at first_visible_records
+    uint32_t first_object_record;
+    uint32_t first_visible_records[MAX_FRAMES_IN_FLIGHT];
+} InstancedModel;
+
+SDL_Window* g_window;
+
+// --headless WxH renders into offscreen targets without SDL, surface or swap chain, see Headless rendering
+bool g_headless = false;
+VkExtent2D g_headless_extent;
+uint32_t g_headless_num_frames = HEADLESS_DEFAULT_FRAMES;
+const char* g_headless_output_path = HEADLESS_DEFAULT_OUTPUT_PATH;
+GpuAllocation* g_offscreen_image_allocations = NULL; // Backing memory of g_swap_chain_images in headless mode
+
+VkInstance g_instance = VK_NULL_HANDLE;
+VkSurfaceKHR g_surface = VK_NULL_HANDLE;
+VkPhysicalDevice g_physical_device = VK_NULL_HANDLE;
+VkDevice g_device = VK_NULL_HANDLE;
+
+VkSwapchainKHR g_swap_chain = VK_NULL_HANDLE;
+VkImage* g_swap_chain_images = NULL;
+uint32_t g_num_swap_chain_images = UINT32_UNINITIALIZED_VALUE;
+VkFormat g_swap_chain_image_format = VK_NULL_HANDLE;
+VkImageView* g_swap_chain_image_views = VK_NULL_HANDLE;
+uint32_t g_num_swap_chain_image_views = UINT32_UNINITIALIZED_VALUE;
+VkExtent2D g_swap_chain_extent = {.width = UINT32_UNINITIALIZED_VALUE, .height = UINT32_UNINITIALIZED_VALUE};
+VkFramebuffer* g_swap_chain_framebuffers = VK_NULL_HANDLE;
+uint32_t g_num_swap_chain_framebuffers = UINT32_UNINITIALIZED_VALUE;
+
+VkImage g_color_image;
+GpuAllocation g_color_image_allocation;
+VkImageView g_color_image_view;
+
+VkImage g_depth_image;
+GpuAllocation g_depth_image_allocation;
+VkImageView g_depth_image_view;
+
+VkDescriptorSetLayout g_descriptor_set_layout = VK_NULL_HANDLE;
+VkRenderPass g_render_pass = VK_NULL_HANDLE;
+
+VkPipeline g_graphics_pipeline = VK_NULL_HANDLE;
+VkPipeline g_instanced_pipeline = VK_NULL_HANDLE;
+VkPipelineLayout g_pipeline_layout = VK_NULL_HANDLE;
+VkPipelineCache g_pipeline_cache = VK_NULL_HANDLE;
+
+VkDescriptorSetLayout g_culling_descriptor_set_layout = VK_NULL_HANDLE;
+VkPipelineLayout g_culling_pipeline_layout = VK_NULL_HANDLE;
+VkPipeline g_culling_pipeline = VK_NULL_HANDLE;
+
+VkDescriptorSetLayout g_bindless_descriptor_set_layout = VK_NULL_HANDLE;
+VkPipelineLayout g_bindless_pipeline_layout = VK_NULL_HANDLE;
+VkPipeline g_bindless_pipeline = VK_NULL_HANDLE;
+VkDescriptorPool g_bindless_descriptor_pool = VK_NULL_HANDLE;
+VkDescriptorSet g_bindless_descriptor_sets[MAX_FRAMES_IN_FLIGHT];
+VkBuffer g_object_record_buffer = VK_NULL_HANDLE;
+GpuAllocation g_object_record_buffer_allocation;
+uint32_t g_num_object_records = 0;
+
+VkCommandPool g_command_pool = VK_NULL_HANDLE;
+
+VkCommandBuffer* g_command_buffers;
+uint32_t g_num_command_buffers;
+
+VkSampleCountFlagBits g_MSAASamples;
+
+VkQueue g_graphics_queue = VK_NULL_HANDLE;
+VkQueue g_presentation_queue = VK_NULL_HANDLE;
+VkQueue g_transfer_queue = VK_NULL_HANDLE; // Same handle as g_graphics_queue if there is no separate transfer family
+uint32_t g_graphics_queue_family = UINT32_UNINITIALIZED_VALUE;
+uint32_t g_transfer_queue_family = UINT32_UNINITIALIZED_VALUE;
+bool g_texture_compression_bc_enabled = false;
+bool g_gpu_culling_enabled = false; // Needs multiDrawIndirect and drawIndirectFirstInstance
+bool g_bindless_enabled = false; // Needs the descriptor indexing features, see createLogicalDevice
+
+VkDebugUtilsMessengerEXT g_debug_messenger;
+
+bool g_is_running = false;
+
+uint32_t g_mip_levels = UINT32_UNINITIALIZED_VALUE;
+VkImage g_texture_image;
+GpuAllocation g_texture_image_allocation;
+VkImageView g_texture_image_view;
+VkSampler g_texture_sampler;
+uint32_t g_diffuse_texture = UINT32_UNINITIALIZED_VALUE;
+
+Scene g_scene;
+Model g_models[NUM_MODELS];
+uint32_t g_model_lods[NUM_MODELS]; // LOD picked for each visible model this frame
+InstancedModel g_instanced_spheres;
+
+// Per frame in flight. It holds the CullingUniforms of every GPU culled batch (CULLING_MAX_BATCHES slots),
+// followed by one UniformBufferObject per draw list item, bound with a dynamic offset.
+// The slots are fixed, so a recorded command buffer stays valid while its data is rewritten every frame.
+typedef struct {
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    char* mapped;
+    VkDeviceSize size;
+} FrameUniformRing;
+
+FrameUniformRing g_frame_uniform_rings[MAX_FRAMES_IN_FLIGHT];
+VkDeviceSize g_uniform_offset_alignment = 0; // minUniformBufferOffsetAlignment
+uint32_t g_num_culling_slots = 0;
+
+VkDescriptorSet* g_descriptor_sets;
+uint32_t g_num_descriptor_sets;
+
+VkSemaphore* g_image_available_semaphores;
+uint32_t g_num_image_available_semaphores;
+
+VkSemaphore* g_render_finished_semaphores;
+uint32_t g_num_render_finished_semaphores;
+
+VkFence* g_in_flight_fences;
+uint32_t g_num_in_flight_fences;
+
+uint32_t g_frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT; // 1 to MAX_FRAMES_IN_FLIGHT, see "Frame pacing"
+VkPresentModeKHR g_requested_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+uint32_t g_current_frame_idx; // 0 <= g_current_frame_idx < g_frames_in_flight
+uint32_t g_frame_counter;    // How many frames have been rendered in total
+uint64_t g_frame_allocations; // Main thread allocations during the last drawFrame, see "Memory tracking"
+
+PushConstants g_push_constants;
+
+int g_rendering_stage = 3;
+
+bool g_use_cached_command_buffers = false; // Toggled with C, see "Cached command buffers"
+uint64_t g_command_cache_generation = 0; // Bumped whenever recorded command buffers may have gone stale
+
+typedef enum {
+    CAPTURE_FORMAT_QOI,
+    CAPTURE_FORMAT_PNG,
+} CaptureFormat;
+
+#define CAPTURE_DEFAULT_DIRECTORY "./Screencaps"
+bool g_capture_enabled = false; // Toggled with R or --capture, see "Frame capture"
+const char* g_capture_directory = CAPTURE_DEFAULT_DIRECTORY;
+CaptureFormat g_capture_format = CAPTURE_FORMAT_QOI;
+
+bool g_did_framebuffer_resize = false;
+bool g_is_recreating_swap_chain = false; // Silences the creation logs, a drag resize recreates every frame
+
+vec3 g_camera_eye = {2.0f, 4.0f, 2.0f};
+vec3 g_camera_center = {0.0f, 0.0f, 0.0f};
+vec3 g_camera_up = {0.0f, 0.0f, 1.0f};
 
 clock_t g_start_time;
 
@@ -379,7 +2731,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 }
 
 void initWindow() {
-    SCOPE_TIMER;
+    TRACE_FUNCTION();
     printf("Trying to initialize window.\n");
 
     if(SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -401,7 +2753,7 @@ void initWindow() {
         SDL_WINDOWPOS_CENTERED,
         DEFAULT_WINDOW_WIDTH,
         DEFAULT_WINDOW_HEIGHT,
-        SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN
+        SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
     );
 
     if(!g_window) {
@@ -409,8 +2761,6 @@ void initWindow() {
         PANIC_STR(error_message);
     }
 
-    SDL_SetWindowResizable(g_window, SDL_FALSE);
-
     printf("Successfully initialized window.\n");
 }
 
@@ -424,30 +2774,49 @@ void handleInput(const SDL_Event e) {
             printf("Escape key pressed, exiting...\n"),
             g_is_running = false;
         }
+        if(e.key.keysym.sym == SDLK_c) {
+            g_use_cached_command_buffers = !g_use_cached_command_buffers;
+            printf("Cached command buffers %s.\n", g_use_cached_command_buffers ? "enabled" : "disabled");
+        }
+        if(e.key.keysym.sym == SDLK_r) {
+            g_capture_enabled = !g_capture_enabled;
+            printf("Frame capture %s.\n", g_capture_enabled ? "started" : "stopped");
+        }
+    }
+    if(e.type == SDL_WINDOWEVENT) {
+        // The next frame recreates the swap chain, see "Swap chain recreation"
+        if(e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) g_did_framebuffer_resize = true;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        if(e.window.event == SDL_WINDOWEVENT_DISPLAY_CHANGED) g_did_framebuffer_resize = true;
+#endif
     }
 }
 
 //@DS:NEEDS_FREE_AFTER_USE
 const char** getRequiredExtensions(uint32_t* extensionCount) {
     unsigned int sdlExtensionCount = 0;
+    const char** sdlExtensions = NULL;
 
-    if(!SDL_Vulkan_GetInstanceExtensions(NULL, &sdlExtensionCount, NULL)) {
-        SDL_Log("Could not get Vulkan instance extensions: %s", SDL_GetError());
-        return NULL;
-    }
+    // Without a window there is no surface, so none of the extensions SDL asks for are needed
+    if(!g_headless) {
+        if(!SDL_Vulkan_GetInstanceExtensions(NULL, &sdlExtensionCount, NULL)) {
+            SDL_Log("Could not get Vulkan instance extensions: %s", SDL_GetError());
+            return NULL;
+        }
 
-    const char** sdlExtensions = malloc(sdlExtensionCount * sizeof(const char*));
+        sdlExtensions = malloc(sdlExtensionCount * sizeof(const char*));
 
-    // Get the actual extension names
-    if(!SDL_Vulkan_GetInstanceExtensions(NULL, &sdlExtensionCount, sdlExtensions)) {
-        SDL_Log("Could not get Vulkan instance extensions: %s", SDL_GetError());
-        free(sdlExtensions);
-        return NULL;
+        // Get the actual extension names
+        if(!SDL_Vulkan_GetInstanceExtensions(NULL, &sdlExtensionCount, sdlExtensions)) {
+            SDL_Log("Could not get Vulkan instance extensions: %s", SDL_GetError());
+            free(sdlExtensions);
+            return NULL;
+        }
     }
 
     *extensionCount = sdlExtensionCount;
-    const char** extensions = malloc(sdlExtensionCount * sizeof(const char*));
-    memcpy(extensions, sdlExtensions, sdlExtensionCount * sizeof(const char*));
+    const char** extensions = malloc(MAX(sdlExtensionCount, 1) * sizeof(const char*));
+    if(sdlExtensionCount > 0) memcpy(extensions, sdlExtensions, sdlExtensionCount * sizeof(const char*)); // sdlExtensions is NULL when headless
     free(sdlExtensions);
 
     if(ENABLE_VALIDATION_LAYERS) {
@@ -580,6 +2949,7 @@ void initInstance() {
 typedef struct {
     uint32_t graphicsFamily;
     uint32_t presentationFamily;
+    uint32_t transferFamily; // Dedicated transfer family if the device has one, graphicsFamily otherwise
 } QueueFamilyIndices;
 
 bool QueueFamilyIndices_isComplete(const QueueFamilyIndices* pQFI) {
@@ -591,7 +2961,8 @@ bool QueueFamilyIndices_isComplete(const QueueFamilyIndices* pQFI) {
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
     QueueFamilyIndices indices = {
         .graphicsFamily = UINT32_UNINITIALIZED_VALUE,
-        .presentationFamily = UINT32_UNINITIALIZED_VALUE};
+        .presentationFamily = UINT32_UNINITIALIZED_VALUE,
+        .transferFamily = UINT32_UNINITIALIZED_VALUE};
 
     uint32_t num_queue_families = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(device, &num_queue_families, NULL);
@@ -604,12 +2975,28 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
             indices.graphicsFamily = i;
         }
 
+        // Nothing gets presented in headless mode, the graphics family stands in for the presentation family
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_surface, &presentSupport);
+        if(g_headless) presentSupport = (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        else vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_surface, &presentSupport);
         if(presentSupport) indices.presentationFamily = i;
 
         if(QueueFamilyIndices_isComplete(&indices)) break;
     }
+
+    // Prefer a transfer-only family (DMA engine), then anything without graphics, then share the graphics family
+    uint32_t best_transfer_score = 0;
+    for(uint32_t i = 0; i < num_queue_families; i++) {
+        const VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if(!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+        const uint32_t score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+        if(score > best_transfer_score) {
+            best_transfer_score = score;
+            indices.transferFamily = i;
+        }
+    }
+    if(indices.transferFamily == UINT32_UNINITIALIZED_VALUE) indices.transferFamily = indices.graphicsFamily;
+
     free(queueFamilies);
     return indices;
 }
@@ -671,6 +3058,28 @@ void querySwapChainSupport(VkPhysicalDevice device, SwapChainSupportDetails* det
     }
 }
 
+bool isDeviceExtensionSupported(VkPhysicalDevice device, const char* extension_name) {
+    uint32_t num_available_extensions = 0;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &num_available_extensions, NULL);
+    VkExtensionProperties* available_extensions = malloc(num_available_extensions * sizeof(VkExtensionProperties));
+    vkEnumerateDeviceExtensionProperties(device, NULL, &num_available_extensions, available_extensions);
+    bool found = false;
+    for(size_t i = 0; i < num_available_extensions && !found; i++) {
+        found = strcmp(available_extensions[i].extensionName, extension_name) == 0;
+    }
+    free(available_extensions);
+    return found;
+}
+
+// The swap chain is only needed with a window. The portability subset has to be enabled whenever a device
+// advertises it (MoltenVK), other implementations such as lavapipe don't have it at all.
+uint32_t getDeviceExtensions(VkPhysicalDevice device, const char* out_extensions[MAX_DEVICE_EXTENSIONS]) {
+    uint32_t num_extensions = 0;
+    if(!g_headless) out_extensions[num_extensions++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    if(isDeviceExtensionSupported(device, VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME)) out_extensions[num_extensions++] = VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME;
+    return num_extensions;
+}
+
 bool isDeviceSuitable(VkPhysicalDevice device) {
     VkPhysicalDeviceProperties deviceProperties;
     vkGetPhysicalDeviceProperties(device, &deviceProperties);
@@ -684,36 +3093,22 @@ bool isDeviceSuitable(VkPhysicalDevice device) {
     }
     printf("Device supports suitable queue families.\n");
 
-    uint32_t num_available_extensions = 0;
-    vkEnumerateDeviceExtensionProperties(device, NULL, &num_available_extensions, NULL);
-    VkExtensionProperties* available_extensions = malloc(num_available_extensions * sizeof(VkExtensionProperties));
-    vkEnumerateDeviceExtensionProperties(device, NULL, &num_available_extensions, available_extensions);
-
-    const char* required_extensions[] = REQUIRED_DEVICE_EXTENSIONS;
-    size_t num_required_extensions = sizeof(required_extensions) / sizeof(required_extensions[0]);
-    for(size_t i = 0; i < num_required_extensions; i++) {
-        bool found = false;
-        for(size_t j = 0; j < num_available_extensions; j++) {
-            if(strcmp(available_extensions[j].extensionName, required_extensions[i]) == 0) {
-                found = true;
-                break;
-            }
-        }
-        if(!found) {
-            free(available_extensions);
-            return false;
-        }
+    const char* required_extensions[MAX_DEVICE_EXTENSIONS];
+    const uint32_t num_required_extensions = getDeviceExtensions(device, required_extensions);
+    for(uint32_t i = 0; i < num_required_extensions; i++) {
+        if(!isDeviceExtensionSupported(device, required_extensions[i])) return false;
     }
-    free(available_extensions);
     printf("Device supports the necessary extensions.\n");
 
-    SwapChainSupportDetails details;
-    querySwapChainSupport(device, &details);
-    bool swapchain_is_supported = (details.num_formats > 0) && (details.num_present_modes > 0);
-    SwapChainSupportDetails_free(&details);
-    if(!swapchain_is_supported) {
-        fprintf(stderr, "Device does not support swapchain.");
-        return false;
+    if(!g_headless) {
+        SwapChainSupportDetails details;
+        querySwapChainSupport(device, &details);
+        bool swapchain_is_supported = (details.num_formats > 0) && (details.num_present_modes > 0);
+        SwapChainSupportDetails_free(&details);
+        if(!swapchain_is_supported) {
+            fprintf(stderr, "Device does not support swapchain.");
+            return false;
+        }
     }
 
     VkPhysicalDeviceFeatures supported_features;
@@ -722,6 +3117,16 @@ bool isDeviceSuitable(VkPhysicalDevice device) {
         fprintf(stderr, "Device does not support samplerAnisotropy.");
         return false;
     }
+
+    VkPhysicalDeviceVulkan12Features supported_vulkan12_features = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 supported_features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_vulkan12_features};
+    vkGetPhysicalDeviceFeatures2(device, &supported_features2);
+    if(!supported_vulkan12_features.timelineSemaphore) {
+        fprintf(stderr, "Device does not support timelineSemaphore.");
+        return false;
+    }
     return true;
 }
 
@@ -762,45 +3167,76 @@ void pickPhysicalDevice() {
 
 void createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(g_physical_device);
-
-    bool indices_are_same = (indices.presentationFamily == indices.graphicsFamily);
     if(!QueueFamilyIndices_isComplete(&indices)) PANIC("Invalid QueueFamilyIndices");
 
-    VkDeviceQueueCreateInfo* queue_create_infos;
-    uint32_t num_queue_create_infos;
+    // One queue per distinct family, graphics, presentation and transfer may all share the same one
+    const uint32_t families[] = {indices.graphicsFamily, indices.presentationFamily, indices.transferFamily};
+    VkDeviceQueueCreateInfo queue_create_infos[3];
+    uint32_t num_queue_create_infos = 0;
     float queuePriority = 1.0f;
-    if(indices_are_same) {
-        VkDeviceQueueCreateInfo graphics_queue_create_info = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = indices.graphicsFamily,
-            .queueCount = 1,
-            .pQueuePriorities = &queuePriority};
-        queue_create_infos = malloc(sizeof(VkDeviceQueueCreateInfo));
-        queue_create_infos[0] = graphics_queue_create_info;
-        num_queue_create_infos = 1;
-    } else {
-        VkDeviceQueueCreateInfo graphics_queue_create_info = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = indices.graphicsFamily,
-            .queueCount = 1,
-            .pQueuePriorities = &queuePriority};
-        VkDeviceQueueCreateInfo presentation_queue_create_info = {
+    for(uint32_t i = 0; i < 3; i++) {
+        bool is_duplicate = false;
+        for(uint32_t j = 0; j < num_queue_create_infos; j++) {
+            if(queue_create_infos[j].queueFamilyIndex == families[i]) is_duplicate = true;
+        }
+        if(is_duplicate) continue;
+        queue_create_infos[num_queue_create_infos++] = (VkDeviceQueueCreateInfo){
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = indices.graphicsFamily,
+            .queueFamilyIndex = families[i],
             .queueCount = 1,
             .pQueuePriorities = &queuePriority};
-        queue_create_infos = malloc(sizeof(VkDeviceQueueCreateInfo));
-        queue_create_infos[0] = graphics_queue_create_info;
-        queue_create_infos[1] = presentation_queue_create_info;
-        num_queue_create_infos = 2;
     }
 
-    VkPhysicalDeviceFeatures device_features = {.samplerAnisotropy = VK_TRUE};
-
-    const char* required_extensions[] = REQUIRED_DEVICE_EXTENSIONS;
-    size_t num_required_extensions = sizeof(required_extensions) / sizeof(required_extensions[0]);
+    // BC textures are optional, devices without them get their baked textures transcoded on the CPU
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(g_physical_device, &supported_features);
+    g_texture_compression_bc_enabled = supported_features.textureCompressionBC == VK_TRUE;
+
+    // GPU driven culling is optional as well, without it instanced models are drawn in full.
+    // The culling pass draws every LOD bucket with one command whose firstInstance points at the bucket
+    g_gpu_culling_enabled = supported_features.multiDrawIndirect == VK_TRUE && supported_features.drawIndirectFirstInstance == VK_TRUE;
+
+    // Bindless textures need a runtime sized, partially bound sampler array that can be written while it's bound.
+    // Without it instanced models keep their per instance vertex stream and the single texture of set 0
+    VkPhysicalDeviceVulkan12Features supported_vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 supported_features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_vulkan12_features};
+    vkGetPhysicalDeviceFeatures2(g_physical_device, &supported_features2);
+    VkPhysicalDeviceVulkan12Properties vulkan12_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &vulkan12_properties};
+    vkGetPhysicalDeviceProperties2(g_physical_device, &properties2);
+    g_bindless_enabled =
+        supported_vulkan12_features.runtimeDescriptorArray == VK_TRUE &&
+        supported_vulkan12_features.shaderSampledImageArrayNonUniformIndexing == VK_TRUE &&
+        supported_vulkan12_features.descriptorBindingPartiallyBound == VK_TRUE &&
+        supported_vulkan12_features.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+        vulkan12_properties.maxPerStageDescriptorUpdateAfterBindSamplers >= BINDLESS_MAX_TEXTURES &&
+        vulkan12_properties.maxPerStageDescriptorUpdateAfterBindSampledImages >= BINDLESS_MAX_TEXTURES &&
+        vulkan12_properties.maxDescriptorSetUpdateAfterBindSampledImages >= BINDLESS_MAX_TEXTURES;
+
+    VkPhysicalDeviceFeatures device_features = {
+        .samplerAnisotropy = VK_TRUE,
+        .multiDrawIndirect = g_gpu_culling_enabled ? VK_TRUE : VK_FALSE,
+        .drawIndirectFirstInstance = g_gpu_culling_enabled ? VK_TRUE : VK_FALSE,
+        .textureCompressionBC = supported_features.textureCompressionBC};
+    VkPhysicalDeviceVulkan12Features vulkan12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .runtimeDescriptorArray = g_bindless_enabled ? VK_TRUE : VK_FALSE,
+        .shaderSampledImageArrayNonUniformIndexing = g_bindless_enabled ? VK_TRUE : VK_FALSE,
+        .descriptorBindingPartiallyBound = g_bindless_enabled ? VK_TRUE : VK_FALSE,
+        .descriptorBindingSampledImageUpdateAfterBind = g_bindless_enabled ? VK_TRUE : VK_FALSE,
+        .timelineSemaphore = VK_TRUE};
+
+    const char* required_extensions[MAX_DEVICE_EXTENSIONS];
+    const uint32_t num_required_extensions = getDeviceExtensions(g_physical_device, required_extensions);
     VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &vulkan12_features,
         .queueCreateInfoCount = num_queue_create_infos,
         .pQueueCreateInfos = queue_create_infos,
         .enabledExtensionCount = num_required_extensions,
@@ -817,6 +3253,12 @@ void createLogicalDevice() {
 
     vkGetDeviceQueue(g_device, indices.graphicsFamily, 0, &g_graphics_queue);
     vkGetDeviceQueue(g_device, indices.presentationFamily, 0, &g_presentation_queue);
+    vkGetDeviceQueue(g_device, indices.transferFamily, 0, &g_transfer_queue);
+    g_graphics_queue_family = indices.graphicsFamily;
+    g_transfer_queue_family = indices.transferFamily;
+    printf("Using queue family %u for graphics and %u for transfers.\n", g_graphics_queue_family, g_transfer_queue_family);
+    printf("GPU driven culling is %s.\n", g_gpu_culling_enabled ? "enabled" : "not supported, drawing instanced models in full");
+    printf("Bindless textures are %s.\n", g_bindless_enabled ? "enabled" : "not supported, instanced models use the per instance vertex stream");
 }
 
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(const VkSurfaceFormatKHR* available_formats, const uint32_t num_available_formats) {
@@ -836,23 +3278,25 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const VkSurfaceFormatKHR* available_f
     return current_format;
 }
 
+const char* getPresentModeName(const VkPresentModeKHR present_mode) {
+    switch(present_mode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+        case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+        default: return "UNKNOWN";
+    }
+}
+
+// The mode asked for with --present-mode if the surface supports it, FIFO otherwise, which every surface supports
 VkPresentModeKHR chooseSwapPresentMode(const VkPresentModeKHR* available_present_modes, const uint32_t num_available_present_modes) {
     if(num_available_present_modes == 0) PANIC("No presentation modes available!");
 
-    bool found = false;
-    VkPresentModeKHR current_present_mode;
-    for(int i = 0; i < num_available_present_modes; i++) {
-        current_present_mode = available_present_modes[i];
-        if(current_present_mode == VK_PRESENT_MODE_FIFO_KHR) {
-            found = true;
-            break;
-        }
+    for(uint32_t i = 0; i < num_available_present_modes; i++) {
+        if(available_present_modes[i] == g_requested_present_mode) return g_requested_present_mode;
     }
-    if(!found) {
-        fprintf(stderr, "Presentation mode VK_PRESENT_MODE_MAILBOX_KHR is not supported, falling back to a random presentation mode.\n");
-        return available_present_modes[0];
-    }
-    return current_present_mode;
+    fprintf(stderr, "Presentation mode %s is not supported, falling back to FIFO.\n", getPresentModeName(g_requested_present_mode));
+    return VK_PRESENT_MODE_FIFO_KHR;
 }
 
 VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR* capabilities) {
@@ -920,14 +3364,14 @@ void createTextureSampler() {
         .compareEnable = VK_FALSE,
         .compareOp = VK_COMPARE_OP_ALWAYS,
         .minLod = 0,
-        .maxLod = (float)g_mip_levels,
+        .maxLod = VK_LOD_CLAMP_NONE, // Streamed textures come with their own mip count
         .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
         .unnormalizedCoordinates = VK_FALSE};
 
     if (vkCreateSampler(g_device, &samplerInfo, NULL, &g_texture_sampler) != VK_SUCCESS) PANIC("failed to create texture sampler!");
 }
 
-void createSwapChain() {
+void createSwapChain(const VkSwapchainKHR oldSwapChain) {
     SwapChainSupportDetails details;
     querySwapChainSupport(g_physical_device, &details);
 
@@ -935,12 +3379,11 @@ void createSwapChain() {
     const VkPresentModeKHR presentMode = chooseSwapPresentMode(details.present_modes, details.num_present_modes);
     const VkExtent2D extent = chooseSwapExtent(&details.capabilities);
 
-    // Limit the number of swap chain images to MAX_FRAMES_IN_FLIGHT
-    g_num_swap_chain_images = MAX_FRAMES_IN_FLIGHT;
-
-    // Ensure imageCount is within the allowed range
-    if(g_num_swap_chain_images < details.capabilities.minImageCount) g_num_swap_chain_images = details.capabilities.minImageCount;
-    if(g_num_swap_chain_images > details.capabilities.maxImageCount) g_num_swap_chain_images = details.capabilities.maxImageCount;
+    // One image per frame in flight, MAILBOX needs a spare one to replace while another one is scanned out
+    const uint32_t min_image_count = details.capabilities.minImageCount + (presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? 1 : 0);
+    g_num_swap_chain_images = MAX(g_frames_in_flight, min_image_count);
+    // A maxImageCount of 0 means there is no upper limit
+    if(details.capabilities.maxImageCount > 0 && g_num_swap_chain_images > details.capabilities.maxImageCount) g_num_swap_chain_images = details.capabilities.maxImageCount;
     if(g_num_swap_chain_images == 0) PANIC("swap chain image count is 0!");
 
     VkSwapchainCreateInfoKHR createInfo = {
@@ -956,19 +3399,19 @@ void createSwapChain() {
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = presentMode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE,
+        .oldSwapchain = oldSwapChain,
     };
 
     QueueFamilyIndices queue_family_indices = findQueueFamilies(g_physical_device);
     if(!QueueFamilyIndices_isComplete(&queue_family_indices)) PANIC("queueFamilies is not complete!");
 
     if(queue_family_indices.graphicsFamily != queue_family_indices.presentationFamily) {
-        fprintf(stdout, "Setting imageSharingMode to Concurrent.\n");
+        if(!g_is_recreating_swap_chain) fprintf(stdout, "Setting imageSharingMode to Concurrent.\n");
         createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
         createInfo.queueFamilyIndexCount = 2;
         createInfo.pQueueFamilyIndices = (uint32_t[]){ queue_family_indices.graphicsFamily, queue_family_indices.presentationFamily };
     } else {
-        fprintf(stdout, "Setting imageSharingMode to Exclusive.\n");
+        if(!g_is_recreating_swap_chain) fprintf(stdout, "Setting imageSharingMode to Exclusive.\n");
         createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
         createInfo.queueFamilyIndexCount = 0;
         createInfo.pQueueFamilyIndices = NULL;
@@ -982,6 +3425,7 @@ void createSwapChain() {
 
     g_swap_chain_image_format = surfaceFormat.format;
     g_swap_chain_extent = extent;
+    if(!g_is_recreating_swap_chain) printf("Presenting with %s through %u swap chain images, %u frames in flight.\n", getPresentModeName(presentMode), g_num_swap_chain_images, g_frames_in_flight);
 
     SwapChainSupportDetails_free(&details);
 
@@ -1056,7 +3500,7 @@ void createRenderPass() {
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+        .finalLayout = g_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
 
     VkAttachmentReference colorAttachmentRef = {
         .attachment = 0,
@@ -1101,7 +3545,7 @@ void createRenderPass() {
 void createDescriptorSetLayout() {
     VkDescriptorSetLayoutBinding uboLayoutBinding = {
         .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .descriptorCount = 1,
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT};
 
@@ -1118,6 +3562,27 @@ void createDescriptorSetLayout() {
         .pBindings = (VkDescriptorSetLayoutBinding[]){uboLayoutBinding, samplerLayoutBinding}};
 
     if(vkCreateDescriptorSetLayout(g_device, &layoutInfo, NULL, &g_descriptor_set_layout) != VK_SUCCESS) PANIC("failed to create descriptor set layout!");
+    if(!g_bindless_enabled) return;
+
+    // Set 1 of the bindless pipeline. Texture slots may be written while the set is bound and don't all have to
+    // be valid, only the ones that are actually sampled
+    const VkDescriptorSetLayoutBinding bindlessBindings[2] = {
+        {.binding = 0, .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = BINDLESS_MAX_TEXTURES, .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT},
+        {.binding = 1, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_VERTEX_BIT}};
+    const VkDescriptorBindingFlags bindlessBindingFlags[2] = {
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+        0};
+    const VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindingFlags = bindlessBindingFlags};
+    const VkDescriptorSetLayoutCreateInfo bindlessLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &bindingFlagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 2,
+        .pBindings = bindlessBindings};
+    if(vkCreateDescriptorSetLayout(g_device, &bindlessLayoutInfo, NULL, &g_bindless_descriptor_set_layout) != VK_SUCCESS) PANIC("failed to create bindless descriptor set layout!");
 }
 
 VkShaderModule createShaderModule(const char* code, size_t code_length) {
@@ -1135,46 +3600,247 @@ VkShaderModule createShaderModule(const char* code, size_t code_length) {
 VkVertexInputBindingDescription getVertexBindingDescription() {
     const VkVertexInputBindingDescription bindingDescription = {
         .binding = 0,
-        .stride = sizeof(Vertex),
+        .stride = sizeof(MeshVertex),
         .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
     };
     return bindingDescription;
 }
 
+// Follows MeshVertex, the formats convert to the same float inputs for both layouts
 VkVertexInputAttributeDescription* getVertexAttributeDescription(uint32_t* num_attribute_descriptions) {
+#if MESH_QUANTIZE_VERTICES
+    const VkFormat formats[3] = {VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R8G8B8A8_SNORM, VK_FORMAT_R16G16_SFLOAT};
+#else
+    const VkFormat formats[3] = {VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT};
+#endif
     *num_attribute_descriptions = 3;
     static VkVertexInputAttributeDescription attributes[3];
     attributes[0] = (VkVertexInputAttributeDescription){
         .binding = 0,
         .location = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(Vertex, pos)};
+        .format = formats[0],
+        .offset = offsetof(MeshVertex, pos)};
     attributes[1] = (VkVertexInputAttributeDescription){
         .binding = 0,
         .location = 1,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(Vertex, normal)};
+        .format = formats[1],
+        .offset = offsetof(MeshVertex, normal)};
     attributes[2] = (VkVertexInputAttributeDescription){
         .binding = 0,
         .location = 2,
-        .format = VK_FORMAT_R32G32_SFLOAT,
-        .offset = offsetof(Vertex, texCoord)};
+        .format = formats[2],
+        .offset = offsetof(MeshVertex, texCoord)};
     return attributes;
 }
 
-void createGraphicsPipeline() {
+VkVertexInputBindingDescription getInstanceBindingDescription() {
+    const VkVertexInputBindingDescription bindingDescription = {
+        .binding = 1,
+        .stride = sizeof(InstanceData),
+        .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE};
+    return bindingDescription;
+}
+
+// Locations continue after the ones of getVertexAttributeDescription
+VkVertexInputAttributeDescription* getInstanceAttributeDescription(uint32_t* num_attribute_descriptions) {
+    *num_attribute_descriptions = 3;
+    static VkVertexInputAttributeDescription attributes[3];
+    attributes[0] = (VkVertexInputAttributeDescription){
+        .binding = 1,
+        .location = 3,
+        .format = VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = offsetof(InstanceData, position)};
+    attributes[1] = (VkVertexInputAttributeDescription){
+        .binding = 1,
+        .location = 4,
+        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .offset = offsetof(InstanceData, rotation)};
+    attributes[2] = (VkVertexInputAttributeDescription){
+        .binding = 1,
+        .location = 5,
+        .format = VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = offsetof(InstanceData, scale)};
+    return attributes;
+}
+
+/*
+ * Persistent pipeline cache
+ *
+ * Without a cache the driver compiles the shaders of every pipeline from scratch on every launch. The cache data is
+ * written on shutdown and seeded back in on startup. The file name is keyed by vendor and device, the header
+ * additionally pins the driver version and the pipelineCacheUUID, since drivers are not required to reject
+ * foreign or corrupt blobs gracefully. Anything that doesn't match exactly is discarded and the cache starts cold.
+ */
+#define PIPELINE_CACHE_MAGIC 0x43505344u // "DSPC" when read byte by byte
+#define PIPELINE_CACHE_VERSION 1u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t data_hash; // FNV-1a of the driver blob, catches truncated or otherwise damaged files
+} PipelineCacheFileHeader;
+
+size_t g_pipeline_cache_seed_size = 0; // 0 if the cache started cold
+
+uint64_t hashFNV1a(const void* data, const size_t size) {
+    const uint8_t* bytes = data;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void getPipelineCachePath(const VkPhysicalDeviceProperties* properties, char* out_path, const size_t out_path_size) {
+    const int written = snprintf(out_path, out_path_size, "./pipeline_cache_%04x_%04x.bin", properties->vendorID, properties->deviceID);
+    if(written < 0 || (size_t)written >= out_path_size) PANIC("Pipeline cache path is too long");
+}
+
+// Returns true if the file belongs to this exact device and driver and its payload is intact
+bool validatePipelineCacheFile(const FileView* file, const VkPhysicalDeviceProperties* properties) {
+    if(file->size < sizeof(PipelineCacheFileHeader)) return false;
+    const PipelineCacheFileHeader* header = (const PipelineCacheFileHeader*)file->data;
+    if(header->magic != PIPELINE_CACHE_MAGIC || header->version != PIPELINE_CACHE_VERSION) return false;
+    if(header->vendor_id != properties->vendorID || header->device_id != properties->deviceID) return false;
+    if(header->driver_version != properties->driverVersion) return false;
+    if(memcmp(header->pipeline_cache_uuid, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0) return false;
+    if(header->data_size != file->size - sizeof(PipelineCacheFileHeader)) return false;
+
+    // The driver blob starts with its own header, check it against the device as well
+    const char* data = file->data + sizeof(PipelineCacheFileHeader);
+    VkPipelineCacheHeaderVersionOne driver_header;
+    if(header->data_size < sizeof(driver_header)) return false;
+    memcpy(&driver_header, data, sizeof(driver_header));
+    if(driver_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driver_header.headerSize < sizeof(driver_header)) return false;
+    if(driver_header.vendorID != properties->vendorID || driver_header.deviceID != properties->deviceID) return false;
+    if(memcmp(driver_header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0) return false;
+
+    return hashFNV1a(data, header->data_size) == header->data_hash;
+}
+
+void createPipelineCache() {
+    TRACE_ZONE("Pipeline cache: load");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(g_physical_device, &properties);
+    char cache_path[PATH_MAX];
+    getPipelineCachePath(&properties, cache_path, sizeof(cache_path));
+
+    VkPipelineCacheCreateInfo cacheInfo = {.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    FileView file;
+    const bool has_file = FileView_open(cache_path, &file);
+    if(has_file && validatePipelineCacheFile(&file, &properties)) {
+        cacheInfo.initialDataSize = file.size - sizeof(PipelineCacheFileHeader);
+        cacheInfo.pInitialData = file.data + sizeof(PipelineCacheFileHeader);
+    } else if(has_file) {
+        printf("Pipeline cache '%s' belongs to a different device or driver or is damaged, starting cold.\n", cache_path);
+    }
+
+    VkResult result = vkCreatePipelineCache(g_device, &cacheInfo, NULL, &g_pipeline_cache);
+    if(result != VK_SUCCESS && cacheInfo.initialDataSize > 0) {
+        fprintf(stderr, "Error: Driver rejected pipeline cache '%s', starting cold.\n", cache_path);
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = NULL;
+        result = vkCreatePipelineCache(g_device, &cacheInfo, NULL, &g_pipeline_cache);
+    }
+    if(result != VK_SUCCESS) PANIC("failed to create pipeline cache!");
+
+    g_pipeline_cache_seed_size = cacheInfo.initialDataSize;
+    if(has_file) FileView_close(&file);
+    printf("[[DS-PIPELINE_CACHE]] %s (%zu bytes seeded from '%s').\n",
+           g_pipeline_cache_seed_size > 0 ? "Warm start" : "Cold start", g_pipeline_cache_seed_size, cache_path);
+}
+
+// Writes the cache data next to the executable, through a temporary file so a crash never leaves a truncated cache
+bool savePipelineCache() {
+    TRACE_ZONE("Pipeline cache: save");
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(g_physical_device, &properties);
+    char cache_path[PATH_MAX];
+    getPipelineCachePath(&properties, cache_path, sizeof(cache_path));
+
+    size_t data_size = 0;
+    if(vkGetPipelineCacheData(g_device, g_pipeline_cache, &data_size, NULL) != VK_SUCCESS || data_size == 0) return false;
+    char* data = malloc(data_size);
+    if(vkGetPipelineCacheData(g_device, g_pipeline_cache, &data_size, data) != VK_SUCCESS) {
+        free(data);
+        return false;
+    }
+
+    PipelineCacheFileHeader header = {
+        .magic = PIPELINE_CACHE_MAGIC,
+        .version = PIPELINE_CACHE_VERSION,
+        .vendor_id = properties.vendorID,
+        .device_id = properties.deviceID,
+        .driver_version = properties.driverVersion,
+        .data_size = data_size,
+        .data_hash = hashFNV1a(data, data_size)};
+    memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    char tmp_path[PATH_MAX];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path) >= (int)sizeof(tmp_path)) {
+        free(data);
+        return false;
+    }
+    FILE* file = fopen(tmp_path, "wb");
+    if(!file) {
+        fprintf(stderr, "Error: Unable to open '%s' for writing: %s\n", tmp_path, strerror(errno));
+        free(data);
+        return false;
+    }
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    success = success && fwrite(data, 1, data_size, file) == data_size;
+    success = (fclose(file) == 0) && success;
+    free(data);
+
+    if(!success || rename(tmp_path, cache_path) != 0) {
+        fprintf(stderr, "Error: Failed to write pipeline cache '%s': %s\n", cache_path, strerror(errno));
+        remove(tmp_path);
+        return false;
+    }
+    printf("[[DS-PIPELINE_CACHE]] Saved %zu bytes to '%s'.\n", data_size, cache_path);
+    return true;
+}
+
+void createPipelineLayout() {
+    // Define the push constant range
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        .offset = 0,
+        .size = sizeof(PushConstants)};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &g_descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange};
+
+    if(vkCreatePipelineLayout(g_device, &pipelineLayoutInfo, NULL, &g_pipeline_layout) != VK_SUCCESS) PANIC("failed to create pipeline layout!");
+    if(!g_bindless_enabled) return;
+
+    // Set 0 and the push constants are identical, so both layouts stay compatible and nothing has to be rebound
+    // when switching between them
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = (VkDescriptorSetLayout[]){g_descriptor_set_layout, g_bindless_descriptor_set_layout};
+    if(vkCreatePipelineLayout(g_device, &pipelineLayoutInfo, NULL, &g_bindless_pipeline_layout) != VK_SUCCESS) PANIC("failed to create bindless pipeline layout!");
+}
+
+// Builds one pipeline on top of layout, the instanced variant additionally consumes InstanceData per instance
+VkPipeline buildGraphicsPipeline(VkPipelineLayout layout, const char* vertex_shader_path, const char* fragment_shader_path, const bool is_instanced) {
     fprintf(stdout, "Trying to create Shader modules.\n");
     fprintf(stdout, "Trying to read .spv files.\n");
-    size_t vertShaderCode_length; size_t fragShaderCode_length;
-    // ReSharper disable once CppDFAMemoryLeak
-    const char* vertShaderCode = readFile("shaders/compiled/shader_phong_stages.vert.spv", &vertShaderCode_length);
-    if(!vertShaderCode) PANIC("Could not read vertex shader file.");
-    // ReSharper disable once CppDFAMemoryLeak
-    const char* fragShaderCode = readFile("shaders/compiled/shader_phong_stages.frag.spv", &fragShaderCode_length);
-    if(!fragShaderCode) PANIC("Could not read fragment shader file.");
+    FileView vertShaderFile; FileView fragShaderFile;
+    if(!FileView_open(vertex_shader_path, &vertShaderFile)) PANIC("Could not read vertex shader file '%s'.", vertex_shader_path);
+    if(!FileView_open(fragment_shader_path, &fragShaderFile)) PANIC("Could not read fragment shader file '%s'.", fragment_shader_path);
 
     fprintf(stdout, "\tTrying to create Vertex Shader.\n");
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode, vertShaderCode_length);
+    VkShaderModule vertShaderModule = createShaderModule(vertShaderFile.data, vertShaderFile.size);
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
@@ -1182,28 +3848,36 @@ void createGraphicsPipeline() {
         .pName = "main"};
 
     fprintf(stdout, "\tTrying to create Fragment Shader.\n");
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode, fragShaderCode_length);
+    VkShaderModule fragShaderModule = createShaderModule(fragShaderFile.data, fragShaderFile.size);
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
         .module = fragShaderModule,
         .pName = "main"};
 
-    free((char *)vertShaderCode); vertShaderCode = NULL; free((char *)fragShaderCode); fragShaderCode = NULL;
-    vertShaderCode_length = UINT32_INVALIDED_VALUE; fragShaderCode_length = UINT32_INVALIDED_VALUE;
+    // The driver copies the SPIR-V during vkCreateShaderModule, so the mappings can go right away
+    FileView_close(&vertShaderFile); FileView_close(&fragShaderFile);
     fprintf(stdout, "Successfully created the shader modules.\n");
 
 
     fprintf(stdout, "Trying to Initialize Fixed Functions.\n");
     fprintf(stdout, "\tInitializing Vertex Input.\n");
-    VkVertexInputBindingDescription bindingDescription = getVertexBindingDescription();
+    VkVertexInputBindingDescription bindingDescriptions[2] = {getVertexBindingDescription(), getInstanceBindingDescription()};
     uint32_t num_attribute_descriptions;
-    VkVertexInputAttributeDescription* attribute_descriptions = getVertexAttributeDescription(&num_attribute_descriptions);
+    VkVertexInputAttributeDescription* vertex_attribute_descriptions = getVertexAttributeDescription(&num_attribute_descriptions);
+    VkVertexInputAttributeDescription attribute_descriptions[6];
+    memcpy(attribute_descriptions, vertex_attribute_descriptions, num_attribute_descriptions * sizeof(VkVertexInputAttributeDescription));
+    if(is_instanced) {
+        uint32_t num_instance_attribute_descriptions;
+        VkVertexInputAttributeDescription* instance_attribute_descriptions = getInstanceAttributeDescription(&num_instance_attribute_descriptions);
+        memcpy(&attribute_descriptions[num_attribute_descriptions], instance_attribute_descriptions, num_instance_attribute_descriptions * sizeof(VkVertexInputAttributeDescription));
+        num_attribute_descriptions += num_instance_attribute_descriptions;
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindingDescription,
+        .vertexBindingDescriptionCount = is_instanced ? 2 : 1,
+        .pVertexBindingDescriptions = bindingDescriptions,
         .vertexAttributeDescriptionCount = num_attribute_descriptions,
         .pVertexAttributeDescriptions = attribute_descriptions};
 
@@ -1273,22 +3947,7 @@ void createGraphicsPipeline() {
         .pAttachments = &colorBlendAttachment,
         .blendConstants = {0.0F, 0.0F, 0.0F, 0.0F}};
 
-    // Define the push constant range
-    VkPushConstantRange pushConstantRange = {
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-        .offset = 0,
-        .size = sizeof(PushConstants)};
-
     fprintf(stdout, "\tInitializing Render Pipeline.\n");
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &g_descriptor_set_layout,
-        .pushConstantRangeCount = 1,
-        .pPushConstantRanges = &pushConstantRange};
-
-    if(vkCreatePipelineLayout(g_device, &pipelineLayoutInfo, NULL, &g_pipeline_layout) != VK_SUCCESS) PANIC("failed to create pipeline layout!");
-
     VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .stageCount = 2,
@@ -1301,16 +3960,395 @@ void createGraphicsPipeline() {
         .pDepthStencilState = &depthStencil,
         .pColorBlendState = &colorBlending,
         .pDynamicState = &dynamicState,
-        .layout = g_pipeline_layout,
+        .layout = layout,
         .renderPass = g_render_pass,
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE};
 
-    if(vkCreateGraphicsPipelines(g_device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &g_graphics_pipeline) != VK_SUCCESS) PANIC("failed to create graphics pipeline!");
+    // Creation feedback is core since 1.3, it tells whether the driver actually found the pipeline in the cache
+    VkPipelineCreationFeedback pipelineFeedback = {0};
+    VkPipelineCreationFeedback stageFeedbacks[2] = {{0}};
+    VkPipelineCreationFeedbackCreateInfo feedbackInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+        .pPipelineCreationFeedback = &pipelineFeedback,
+        .pipelineStageCreationFeedbackCount = 2,
+        .pPipelineStageCreationFeedbacks = stageFeedbacks};
+    pipelineInfo.pNext = &feedbackInfo;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    {
+        TRACE_ZONE(g_pipeline_cache_seed_size > 0 ? "Graphics pipeline creation (warm cache)" : "Graphics pipeline creation (cold cache)");
+        if(vkCreateGraphicsPipelines(g_device, g_pipeline_cache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) PANIC("failed to create graphics pipeline!");
+    }
+    if(pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) {
+        printf("[[DS-PIPELINE_CACHE]] Graphics pipeline '%s': cache %s, driver reported %.3f milliseconds.\n",
+               vertex_shader_path,
+               (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) ? "hit" : "miss",
+               (double)pipelineFeedback.duration * 1e-6);
+    }
+
+    fprintf(stdout, "Cleaning up shader modules.\n");
+    vkDestroyShaderModule(g_device, fragShaderModule, NULL);
+    vkDestroyShaderModule(g_device, vertShaderModule, NULL);
+    return pipeline;
+}
+
+void createGraphicsPipeline() {
+    createPipelineLayout();
+    g_graphics_pipeline = buildGraphicsPipeline(
+        g_pipeline_layout,
+        "shaders/compiled/shader_phong_stages.vert.spv",
+        "shaders/compiled/shader_phong_stages.frag.spv",
+        false);
+    g_instanced_pipeline = buildGraphicsPipeline(
+        g_pipeline_layout,
+        "shaders/compiled/shader_instanced.vert.spv",
+        "shaders/compiled/shader_instanced.frag.spv",
+        true);
+    // Pulls its InstanceData out of the object record buffer, so only the per vertex stream is bound
+    if(g_bindless_enabled) {
+        g_bindless_pipeline = buildGraphicsPipeline(
+            g_bindless_pipeline_layout,
+            "shaders/compiled/shader_bindless.vert.spv",
+            "shaders/compiled/shader_bindless.frag.spv",
+            false);
+    }
+}
+
+/*
+ * GPU driven culling
+ *
+ * Instanced models keep a world space bounding sphere per instance in a storage buffer. Every frame a compute pass
+ * tests them against the view frustum, picks a LOD for every visible instance and copies its InstanceData into that
+ * LOD's bucket of a compacted instance stream. Each bucket is sized for every instance, so no counts are needed up
+ * front. The indirect buffer holds one VkDrawIndexedIndirectCommand per LOD, its firstInstance points at the bucket
+ * and the pass counts instanceCount up. A batch is drawn with at most MESH_MAX_LODS instanced draws no matter how
+ * many instances survive, and the CPU records the same handful of commands every frame.
+ */
+void createCullingPipeline() {
+    if(!g_gpu_culling_enabled) return;
+
+    const VkDescriptorSetLayoutBinding bindings[5] = {
+        {.binding = 0, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        {.binding = 1, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        {.binding = 2, .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        {.binding = 3, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT},
+        {.binding = 4, .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT}};
+    const VkDescriptorSetLayoutCreateInfo layoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 5,
+        .pBindings = bindings};
+    if(vkCreateDescriptorSetLayout(g_device, &layoutInfo, NULL, &g_culling_descriptor_set_layout) != VK_SUCCESS) PANIC("failed to create culling descriptor set layout!");
+
+    const VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(CullingPushConstants)};
+    const VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &g_culling_descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange};
+    if(vkCreatePipelineLayout(g_device, &pipelineLayoutInfo, NULL, &g_culling_pipeline_layout) != VK_SUCCESS) PANIC("failed to create culling pipeline layout!");
+
+    FileView compShaderFile;
+    if(!FileView_open("shaders/compiled/cull_instances.comp.spv", &compShaderFile)) PANIC("Could not read culling compute shader file.");
+    VkShaderModule compShaderModule = createShaderModule(compShaderFile.data, compShaderFile.size);
+    FileView_close(&compShaderFile);
+
+    const VkComputePipelineCreateInfo pipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = compShaderModule,
+            .pName = "main"},
+        .layout = g_culling_pipeline_layout};
+    if(vkCreateComputePipelines(g_device, g_pipeline_cache, 1, &pipelineInfo, NULL, &g_culling_pipeline) != VK_SUCCESS) PANIC("failed to create culling pipeline!");
+    vkDestroyShaderModule(g_device, compShaderModule, NULL);
+}
+
+void destroyCullingPipeline() {
+    if(!g_gpu_culling_enabled) return;
+    vkDestroyPipeline           (g_device, g_culling_pipeline             , NULL); g_culling_pipeline              = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout     (g_device, g_culling_pipeline_layout      , NULL); g_culling_pipeline_layout       = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(g_device, g_culling_descriptor_set_layout, NULL); g_culling_descriptor_set_layout = VK_NULL_HANDLE;
+}
+
+/*
+ * Descriptor allocator
+ *
+ * Descriptor sets come out of a growing list of pools instead of one pool sized for a fixed number of objects.
+ * Once a pool reports VK_ERROR_OUT_OF_POOL_MEMORY (or VK_ERROR_FRAGMENTED_POOL) the allocator moves on to the next
+ * one, every new pool holds twice as many sets as the one before, up to DESCRIPTOR_POOL_MAX_SETS. Sets are never
+ * freed one by one, an allocator is only ever reset as a whole, which keeps the pools free of fragmentation.
+ *
+ * There are three owners: g_descriptor_allocator for long lived sets that get rewritten, one transient allocator per
+ * frame in flight that is reset once the frame's fence has signalled, and the DescriptorCache, which hands out the
+ * same set again for identical contents and is meant for sets that are never written after creation.
+ */
+#define DESCRIPTOR_POOL_INITIAL_SETS 16
+#define DESCRIPTOR_POOL_MAX_SETS 4096
+#define DESCRIPTOR_CACHE_MAX_BINDINGS 5
+
+// Descriptors per set of each pool, enough for every layout allocated through it. The largest are set 0 (one dynamic
+// uniform buffer, one sampler) and the culling sets (four storage buffers, one uniform buffer). The bindless set
+// needs an UPDATE_AFTER_BIND pool and keeps its own
+const VkDescriptorPoolSize DESCRIPTOR_POOL_RATIOS[] = {
+    {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1},
+    {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1},
+    {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 4},
+    {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 1}};
+#define NUM_DESCRIPTOR_POOL_RATIOS (sizeof(DESCRIPTOR_POOL_RATIOS) / sizeof(DESCRIPTOR_POOL_RATIOS[0]))
+
+typedef struct {
+    VkDescriptorPool* pools;
+    uint32_t num_pools;
+    uint32_t pools_capacity;
+    uint32_t current_pool; // The pools before it are full until the next reset
+    uint32_t next_pool_sets;
+} DescriptorAllocator;
+
+typedef struct {
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo buffer_info;
+    VkDescriptorImageInfo image_info;
+} DescriptorBindingContents;
+
+// Everything a cached set is written with. Hashed and compared bytewise, so it must be built with
+// DescriptorSetContents_init and the add functions, which keep the padding zeroed.
+typedef struct {
+    VkDescriptorSetLayout layout;
+    uint32_t num_bindings;
+    DescriptorBindingContents bindings[DESCRIPTOR_CACHE_MAX_BINDINGS];
+} DescriptorSetContents;
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty slot
+    DescriptorSetContents contents;
+    VkDescriptorSet set;
+} DescriptorCacheEntry;
+
+typedef struct {
+    DescriptorCacheEntry* entries; // Open addressing with linear probing, capacity is a power of two
+    uint32_t capacity;
+    uint32_t num_entries;
+    DescriptorAllocator allocator; // Owns the cached sets, never reset
+    uint32_t num_hits;
+    uint32_t num_misses;
+} DescriptorCache;
+
+DescriptorAllocator g_descriptor_allocator;
+DescriptorAllocator g_frame_descriptor_allocators[MAX_FRAMES_IN_FLIGHT];
+DescriptorCache g_descriptor_cache;
+
+void DescriptorAllocator_init(DescriptorAllocator* allocator) {
+    memset(allocator, 0, sizeof(DescriptorAllocator));
+    allocator->next_pool_sets = DESCRIPTOR_POOL_INITIAL_SETS;
+}
+
+void DescriptorAllocator_createPool(DescriptorAllocator* allocator) {
+    const uint32_t num_sets = allocator->next_pool_sets;
+    allocator->next_pool_sets = MIN(num_sets * 2, (uint32_t)DESCRIPTOR_POOL_MAX_SETS);
+
+    VkDescriptorPoolSize poolSizes[NUM_DESCRIPTOR_POOL_RATIOS];
+    for(uint32_t i = 0; i < NUM_DESCRIPTOR_POOL_RATIOS; i++) {
+        poolSizes[i] = (VkDescriptorPoolSize){
+            .type = DESCRIPTOR_POOL_RATIOS[i].type,
+            .descriptorCount = DESCRIPTOR_POOL_RATIOS[i].descriptorCount * num_sets};
+    }
+    const VkDescriptorPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = NUM_DESCRIPTOR_POOL_RATIOS,
+        .pPoolSizes = poolSizes,
+        .maxSets = num_sets};
+
+    growArray((void**)&allocator->pools, &allocator->pools_capacity, allocator->num_pools + 1, sizeof(VkDescriptorPool));
+    if(vkCreateDescriptorPool(g_device, &poolInfo, NULL, &allocator->pools[allocator->num_pools]) != VK_SUCCESS) PANIC("failed to create descriptor pool!");
+    allocator->num_pools += 1;
+}
+
+VkDescriptorSet DescriptorAllocator_allocate(DescriptorAllocator* allocator, VkDescriptorSetLayout layout) {
+    VkDescriptorSetAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout};
+
+    while(true) {
+        const bool is_new_pool = allocator->current_pool == allocator->num_pools;
+        if(is_new_pool) DescriptorAllocator_createPool(allocator);
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        allocInfo.descriptorPool = allocator->pools[allocator->current_pool];
+        const VkResult result = vkAllocateDescriptorSets(g_device, &allocInfo, &set);
+        if(result == VK_SUCCESS) return set;
+        if(result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) PANIC("failed to allocate descriptor set (%d)!", result);
+        if(is_new_pool) PANIC("Descriptor set layout doesn't fit into an empty pool, DESCRIPTOR_POOL_RATIOS is missing a type");
+        allocator->current_pool += 1;
+    }
+}
+
+// Every set allocated so far becomes invalid, none of them may still be in use by the GPU
+void DescriptorAllocator_reset(DescriptorAllocator* allocator) {
+    for(uint32_t i = 0; i < allocator->num_pools; i++) vkResetDescriptorPool(g_device, allocator->pools[i], 0);
+    allocator->current_pool = 0;
+}
+
+void DescriptorAllocator_destroy(DescriptorAllocator* allocator) {
+    for(uint32_t i = 0; i < allocator->num_pools; i++) vkDestroyDescriptorPool(g_device, allocator->pools[i], NULL);
+    free(allocator->pools);
+    memset(allocator, 0, sizeof(DescriptorAllocator));
+}
+
+// Sets from here live until this frame's fence has signalled again, so they must not end up in cached command buffers
+VkDescriptorSet allocateFrameDescriptorSet(VkDescriptorSetLayout layout) {
+    return DescriptorAllocator_allocate(&g_frame_descriptor_allocators[g_current_frame_idx], layout);
+}
+
+void DescriptorSetContents_init(DescriptorSetContents* contents, VkDescriptorSetLayout layout) {
+    memset(contents, 0, sizeof(DescriptorSetContents));
+    contents->layout = layout;
+}
+
+void DescriptorSetContents_addBuffer(DescriptorSetContents* contents, const uint32_t binding, const VkDescriptorType type, VkBuffer buffer, const VkDeviceSize offset, const VkDeviceSize range) {
+    if(contents->num_bindings == DESCRIPTOR_CACHE_MAX_BINDINGS) PANIC("Exceeded DESCRIPTOR_CACHE_MAX_BINDINGS");
+    DescriptorBindingContents* binding_contents = &contents->bindings[contents->num_bindings++];
+    binding_contents->binding = binding;
+    binding_contents->type = type;
+    binding_contents->buffer_info.buffer = buffer;
+    binding_contents->buffer_info.offset = offset;
+    binding_contents->buffer_info.range = range;
+}
+
+void DescriptorSetContents_addImage(DescriptorSetContents* contents, const uint32_t binding, const VkDescriptorType type, VkSampler sampler, VkImageView image_view, const VkImageLayout image_layout) {
+    if(contents->num_bindings == DESCRIPTOR_CACHE_MAX_BINDINGS) PANIC("Exceeded DESCRIPTOR_CACHE_MAX_BINDINGS");
+    DescriptorBindingContents* binding_contents = &contents->bindings[contents->num_bindings++];
+    binding_contents->binding = binding;
+    binding_contents->type = type;
+    binding_contents->image_info.sampler = sampler;
+    binding_contents->image_info.imageView = image_view;
+    binding_contents->image_info.imageLayout = image_layout;
+}
+
+bool DescriptorBindingContents_isImage(const DescriptorBindingContents* binding_contents) {
+    return binding_contents->type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+        || binding_contents->type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+        || binding_contents->type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+}
+
+void DescriptorSetContents_write(const DescriptorSetContents* contents, VkDescriptorSet set) {
+    VkWriteDescriptorSet descriptorWrites[DESCRIPTOR_CACHE_MAX_BINDINGS];
+    for(uint32_t i = 0; i < contents->num_bindings; i++) {
+        const DescriptorBindingContents* binding_contents = &contents->bindings[i];
+        const bool is_image = DescriptorBindingContents_isImage(binding_contents);
+        descriptorWrites[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding_contents->binding,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = binding_contents->type,
+            .pBufferInfo = is_image ? NULL : &binding_contents->buffer_info,
+            .pImageInfo = is_image ? &binding_contents->image_info : NULL};
+    }
+    vkUpdateDescriptorSets(g_device, contents->num_bindings, descriptorWrites, 0, NULL);
+}
+
+void DescriptorCache_init(DescriptorCache* cache) {
+    memset(cache, 0, sizeof(DescriptorCache));
+    DescriptorAllocator_init(&cache->allocator);
+}
+
+void DescriptorCache_insert(DescriptorCache* cache, const DescriptorCacheEntry* entry) {
+    uint32_t slot = (uint32_t)entry->hash & (cache->capacity - 1);
+    while(cache->entries[slot].hash != 0) slot = (slot + 1) & (cache->capacity - 1);
+    cache->entries[slot] = *entry;
+    cache->num_entries += 1;
+}
+
+// Rebuilds the table with room for required entries, keeping only the entries keep() accepts
+void DescriptorCache_rehash(DescriptorCache* cache, const uint32_t capacity, bool (*keep)(const DescriptorCacheEntry*, const void*), const void* user_data) {
+    DescriptorCacheEntry* old_entries = cache->entries;
+    const uint32_t old_capacity = cache->capacity;
+
+    cache->entries = calloc(capacity, sizeof(DescriptorCacheEntry));
+    if(cache->entries == NULL) PANIC("Out of memory");
+    cache->capacity = capacity;
+    cache->num_entries = 0;
+    for(uint32_t i = 0; i < old_capacity; i++) {
+        if(old_entries[i].hash != 0 && (keep == NULL || keep(&old_entries[i], user_data))) DescriptorCache_insert(cache, &old_entries[i]);
+    }
+    free(old_entries);
+}
+
+// Returns a set written with exactly these contents, allocating and writing it on the first request.
+// The set must never be written to afterwards, every user with the same contents shares it.
+VkDescriptorSet DescriptorCache_get(DescriptorCache* cache, const DescriptorSetContents* contents) {
+    const uint64_t hash = hashFNV1a(contents, sizeof(DescriptorSetContents)) | 1; // 0 is reserved for empty slots
+    if(cache->capacity > 0) {
+        for(uint32_t slot = (uint32_t)hash & (cache->capacity - 1); cache->entries[slot].hash != 0; slot = (slot + 1) & (cache->capacity - 1)) {
+            const DescriptorCacheEntry* entry = &cache->entries[slot];
+            if(entry->hash == hash && memcmp(&entry->contents, contents, sizeof(DescriptorSetContents)) == 0) {
+                cache->num_hits += 1;
+                return entry->set;
+            }
+        }
+    }
+    cache->num_misses += 1;
+
+    // Stays below 75% load, so probe sequences remain short
+    if((cache->num_entries + 1) * 4 > cache->capacity * 3) DescriptorCache_rehash(cache, MAX(cache->capacity * 2, 64u), NULL, NULL);
+
+    DescriptorCacheEntry entry = {.hash = hash, .contents = *contents};
+    entry.set = DescriptorAllocator_allocate(&cache->allocator, contents->layout);
+    DescriptorSetContents_write(contents, entry.set);
+    DescriptorCache_insert(cache, &entry);
+    return entry.set;
+}
+
+typedef struct {
+    const VkBuffer* buffers;
+    uint32_t num_buffers;
+} DescriptorCacheEviction;
+
+bool DescriptorCacheEntry_keep(const DescriptorCacheEntry* entry, const void* user_data) {
+    const DescriptorCacheEviction* eviction = user_data;
+    for(uint32_t i = 0; i < entry->contents.num_bindings; i++) {
+        for(uint32_t j = 0; j < eviction->num_buffers; j++) {
+            if(entry->contents.bindings[i].buffer_info.buffer == eviction->buffers[j]) return false;
+        }
+    }
+    return true;
+}
+
+// Forgets every set that references one of the buffers, has to happen before they are destroyed as a new buffer
+// may get the same handle. The sets themselves stay allocated until the cache is destroyed.
+void DescriptorCache_evictBuffers(DescriptorCache* cache, const VkBuffer* buffers, const uint32_t num_buffers) {
+    if(cache->capacity == 0) return;
+    const DescriptorCacheEviction eviction = {.buffers = buffers, .num_buffers = num_buffers};
+    DescriptorCache_rehash(cache, cache->capacity, DescriptorCacheEntry_keep, &eviction);
+}
 
-    fprintf(stdout, "Cleaning up shader modules.\n");
-    vkDestroyShaderModule(g_device, fragShaderModule, NULL);
-    vkDestroyShaderModule(g_device, vertShaderModule, NULL);
+void DescriptorCache_destroy(DescriptorCache* cache) {
+    DescriptorAllocator_destroy(&cache->allocator);
+    free(cache->entries);
+    memset(cache, 0, sizeof(DescriptorCache));
+}
+
+void createDescriptorAllocators() {
+    DescriptorAllocator_init(&g_descriptor_allocator);
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) DescriptorAllocator_init(&g_frame_descriptor_allocators[i]);
+    DescriptorCache_init(&g_descriptor_cache);
+}
+
+void destroyDescriptorAllocators() {
+    printf("[[DS-DESCRIPTORS]] Descriptor cache: %u sets, %u hits, %u misses, %u pools\n",
+           g_descriptor_cache.num_entries, g_descriptor_cache.num_hits, g_descriptor_cache.num_misses, g_descriptor_cache.allocator.num_pools);
+    DescriptorCache_destroy(&g_descriptor_cache);
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) DescriptorAllocator_destroy(&g_frame_descriptor_allocators[i]);
+    DescriptorAllocator_destroy(&g_descriptor_allocator);
 }
 
 void createCommandPool() {
@@ -1338,6 +4376,332 @@ uint32_t findMemoryType(const uint32_t typeFilter, VkMemoryPropertyFlags propert
     PANIC("Couldn't determine the memory type.");
 }
 
+GpuAllocator g_gpu_allocator;
+
+uint32_t bitScanReverse(const uint32_t value) {
+    return 31u - (uint32_t)__builtin_clz(value);
+}
+
+uint32_t bitScanForward(const uint32_t value) {
+    return (uint32_t)__builtin_ctz(value);
+}
+
+// Size class of a region with exactly `units` units
+void tlsfMapping(const uint32_t units, uint32_t* out_fl, uint32_t* out_sl) {
+    const uint32_t fl = bitScanReverse(units);
+    *out_fl = fl;
+    *out_sl = (fl < TLSF_SL_LOG2) ? units - (1u << fl) : (units >> (fl - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+}
+
+uint32_t GpuMemoryBlock_newRegion(GpuMemoryBlock* block) {
+    if(block->first_unused_region != TLSF_NONE) {
+        const uint32_t region = block->first_unused_region;
+        block->first_unused_region = block->regions[region].next_free;
+        return region;
+    }
+    growArray((void**)&block->regions, &block->regions_capacity, block->num_regions + 1, sizeof(TlsfRegion));
+    return block->num_regions++;
+}
+
+void GpuMemoryBlock_releaseRegion(GpuMemoryBlock* block, const uint32_t region) {
+    block->regions[region].next_free = block->first_unused_region;
+    block->first_unused_region = region;
+}
+
+void GpuMemoryBlock_insertFree(GpuMemoryBlock* block, const uint32_t region) {
+    TlsfRegion* r = &block->regions[region];
+    uint32_t fl, sl;
+    tlsfMapping(r->size, &fl, &sl);
+    r->is_free = true;
+    r->prev_free = TLSF_NONE;
+    r->next_free = block->free_lists[fl][sl];
+    if(r->next_free != TLSF_NONE) block->regions[r->next_free].prev_free = region;
+    block->free_lists[fl][sl] = region;
+    block->fl_bitmap |= 1u << fl;
+    block->sl_bitmaps[fl] |= 1u << sl;
+}
+
+void GpuMemoryBlock_removeFree(GpuMemoryBlock* block, const uint32_t region) {
+    TlsfRegion* r = &block->regions[region];
+    uint32_t fl, sl;
+    tlsfMapping(r->size, &fl, &sl);
+    if(r->prev_free != TLSF_NONE) block->regions[r->prev_free].next_free = r->next_free;
+    else block->free_lists[fl][sl] = r->next_free;
+    if(r->next_free != TLSF_NONE) block->regions[r->next_free].prev_free = r->prev_free;
+    if(block->free_lists[fl][sl] == TLSF_NONE) {
+        block->sl_bitmaps[fl] &= ~(1u << sl);
+        if(block->sl_bitmaps[fl] == 0) block->fl_bitmap &= ~(1u << fl);
+    }
+    r->is_free = false;
+}
+
+// Splits `units` off the front of a free (already unlinked) region, the rest goes back into the free lists
+void GpuMemoryBlock_splitFront(GpuMemoryBlock* block, const uint32_t region, const uint32_t units) {
+    if(block->regions[region].size == units) return;
+    const uint32_t rest = GpuMemoryBlock_newRegion(block); // May move block->regions
+    TlsfRegion* r = &block->regions[region];
+    block->regions[rest] = (TlsfRegion){
+        .offset = r->offset + units,
+        .size = r->size - units,
+        .prev_physical = region,
+        .next_physical = r->next_physical};
+    if(r->next_physical != TLSF_NONE) block->regions[r->next_physical].prev_physical = rest;
+    r->next_physical = rest;
+    r->size = units;
+    GpuMemoryBlock_insertFree(block, rest);
+}
+
+// Good fit search, every region in the returned class is at least `units` big
+bool GpuMemoryBlock_findFree(const GpuMemoryBlock* block, uint32_t units, uint32_t* out_region) {
+    uint32_t fl = bitScanReverse(units);
+    if(fl >= TLSF_SL_LOG2) {
+        const uint32_t round_up = (1u << (fl - TLSF_SL_LOG2)) - 1;
+        if(units > UINT32_MAX - round_up) return false;
+        units += round_up;
+    }
+    uint32_t sl;
+    tlsfMapping(units, &fl, &sl);
+
+    uint32_t sl_map = block->sl_bitmaps[fl] & (~0u << sl);
+    if(sl_map == 0) {
+        const uint32_t fl_map = (fl + 1 < TLSF_FL_COUNT) ? block->fl_bitmap & (~0u << (fl + 1)) : 0;
+        if(fl_map == 0) return false;
+        fl = bitScanForward(fl_map);
+        sl_map = block->sl_bitmaps[fl];
+    }
+    *out_region = block->free_lists[fl][bitScanForward(sl_map)];
+    return true;
+}
+
+bool GpuMemoryBlock_allocate(GpuMemoryBlock* block, const uint32_t units, const uint32_t alignment_units, uint32_t* out_region) {
+    uint32_t region;
+    if(!GpuMemoryBlock_findFree(block, units + alignment_units - 1, &region)) return false;
+    GpuMemoryBlock_removeFree(block, region);
+
+    // The front padding becomes a free region of its own, the physical predecessor is in use or we would have merged
+    const uint32_t offset = block->regions[region].offset;
+    const uint32_t padding = (alignment_units - offset % alignment_units) % alignment_units;
+    if(padding > 0) {
+        GpuMemoryBlock_splitFront(block, region, padding);
+        const uint32_t padding_region = region;
+        region = block->regions[padding_region].next_physical;
+        GpuMemoryBlock_removeFree(block, region);
+        GpuMemoryBlock_insertFree(block, padding_region);
+    }
+    GpuMemoryBlock_splitFront(block, region, units);
+
+    block->used += (VkDeviceSize)units * GPU_ALLOCATION_GRANULARITY;
+    block->num_allocations++;
+    *out_region = region;
+    return true;
+}
+
+void GpuMemoryBlock_free(GpuMemoryBlock* block, uint32_t region) {
+    block->used -= (VkDeviceSize)block->regions[region].size * GPU_ALLOCATION_GRANULARITY;
+    block->num_allocations--;
+
+    const uint32_t prev = block->regions[region].prev_physical;
+    if(prev != TLSF_NONE && block->regions[prev].is_free) {
+        GpuMemoryBlock_removeFree(block, prev);
+        block->regions[prev].size += block->regions[region].size;
+        block->regions[prev].next_physical = block->regions[region].next_physical;
+        if(block->regions[region].next_physical != TLSF_NONE) block->regions[block->regions[region].next_physical].prev_physical = prev;
+        GpuMemoryBlock_releaseRegion(block, region);
+        region = prev;
+    }
+    const uint32_t next = block->regions[region].next_physical;
+    if(next != TLSF_NONE && block->regions[next].is_free) {
+        GpuMemoryBlock_removeFree(block, next);
+        block->regions[region].size += block->regions[next].size;
+        block->regions[region].next_physical = block->regions[next].next_physical;
+        if(block->regions[next].next_physical != TLSF_NONE) block->regions[block->regions[next].next_physical].prev_physical = region;
+        GpuMemoryBlock_releaseRegion(block, next);
+    }
+    GpuMemoryBlock_insertFree(block, region);
+}
+
+bool GpuAllocator_allocateDeviceMemory(const VkDeviceSize size, const uint32_t memory_type, const void* pNext, VkDeviceMemory* out_memory, char** out_mapped) {
+    const VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = pNext,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type};
+    if(vkAllocateMemory(g_device, &allocInfo, NULL, out_memory) != VK_SUCCESS) return false;
+
+    *out_mapped = NULL;
+    if(g_gpu_allocator.memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void* mapped = NULL;
+        if(vkMapMemory(g_device, *out_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) PANIC("failed to map device memory!");
+        *out_mapped = mapped;
+    }
+    g_gpu_allocator.num_device_memory_objects++;
+    return true;
+}
+
+GpuMemoryBlock* GpuAllocator_createBlock(const uint32_t memory_type, const GpuResourceKind kind) {
+    const VkDeviceSize size = g_gpu_allocator.block_sizes[memory_type];
+    GpuMemoryBlock* block = calloc(1, sizeof(GpuMemoryBlock));
+    if(!GpuAllocator_allocateDeviceMemory(size, memory_type, NULL, &block->memory, &block->mapped)) {
+        free(block);
+        return NULL;
+    }
+    block->size = size;
+    block->memory_type = memory_type;
+    block->kind = kind;
+    block->first_unused_region = TLSF_NONE;
+    for(uint32_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        for(uint32_t sl = 0; sl < TLSF_SL_COUNT; sl++) block->free_lists[fl][sl] = TLSF_NONE;
+    }
+
+    const uint32_t region = GpuMemoryBlock_newRegion(block);
+    block->regions[region] = (TlsfRegion){
+        .offset = 0,
+        .size = (uint32_t)(size / GPU_ALLOCATION_GRANULARITY),
+        .prev_physical = TLSF_NONE,
+        .next_physical = TLSF_NONE};
+    GpuMemoryBlock_insertFree(block, region);
+
+    if(g_gpu_allocator.num_blocks == g_gpu_allocator.blocks_capacity) {
+        g_gpu_allocator.blocks_capacity = MAX(g_gpu_allocator.blocks_capacity * 2, 8u);
+        g_gpu_allocator.blocks = realloc(g_gpu_allocator.blocks, g_gpu_allocator.blocks_capacity * sizeof(GpuMemoryBlock*));
+    }
+    g_gpu_allocator.blocks[g_gpu_allocator.num_blocks++] = block;
+    return block;
+}
+
+void GpuAllocator_destroyBlock(const uint32_t block_index) {
+    GpuMemoryBlock* block = g_gpu_allocator.blocks[block_index];
+    vkFreeMemory(g_device, block->memory, NULL);
+    g_gpu_allocator.num_device_memory_objects--;
+    free(block->regions);
+    free(block);
+    g_gpu_allocator.blocks[block_index] = g_gpu_allocator.blocks[--g_gpu_allocator.num_blocks];
+}
+
+void GpuAllocator_init() {
+    memset(&g_gpu_allocator, 0, sizeof(GpuAllocator));
+    vkGetPhysicalDeviceMemoryProperties(g_physical_device, &g_gpu_allocator.memory_properties);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(g_physical_device, &properties);
+    g_gpu_allocator.max_device_memory_objects = properties.limits.maxMemoryAllocationCount;
+
+    // Small heaps (e.g. the 256 MB host visible device local heap without resizable BAR) get smaller blocks
+    for(uint32_t i = 0; i < g_gpu_allocator.memory_properties.memoryTypeCount; i++) {
+        const VkDeviceSize heap_size = g_gpu_allocator.memory_properties.memoryHeaps[g_gpu_allocator.memory_properties.memoryTypes[i].heapIndex].size;
+        VkDeviceSize block_size = GPU_BLOCK_SIZE;
+        while(block_size > heap_size / 8 && block_size > (1u << 20)) block_size /= 2;
+        g_gpu_allocator.block_sizes[i] = block_size;
+    }
+}
+
+// Sub-allocates memory for a resource with the given requirements, falls back to a dedicated allocation for large
+// resources or when the driver asks for it (dedicated_info is then chained into vkAllocateMemory).
+//@DS:NEEDS_FREE_AFTER_USE (GpuAllocator_free)
+void GpuAllocator_allocate(
+    const VkMemoryRequirements* requirements,
+    const VkMemoryPropertyFlags properties,
+    const GpuResourceKind kind,
+    const bool wants_dedicated,
+    const VkMemoryDedicatedAllocateInfo* dedicated_info,
+    GpuAllocation* out_allocation)
+{
+    const uint32_t memory_type = findMemoryType(requirements->memoryTypeBits, properties);
+    memset(out_allocation, 0, sizeof(GpuAllocation));
+    out_allocation->memory_type = memory_type;
+    out_allocation->size = requirements->size;
+
+    if(wants_dedicated || requirements->size > g_gpu_allocator.block_sizes[memory_type] / 2) {
+        char* mapped = NULL;
+        if(!GpuAllocator_allocateDeviceMemory(requirements->size, memory_type, dedicated_info, &out_allocation->memory, &mapped)) PANIC("failed to allocate %llu bytes of dedicated device memory!", (unsigned long long)requirements->size);
+        out_allocation->mapped = mapped;
+        g_gpu_allocator.num_dedicated_allocations++;
+        g_gpu_allocator.dedicated_bytes += requirements->size;
+        return;
+    }
+
+    const uint32_t units = (uint32_t)((requirements->size + GPU_ALLOCATION_GRANULARITY - 1) / GPU_ALLOCATION_GRANULARITY);
+    const uint32_t alignment_units = (uint32_t)MAX((requirements->alignment + GPU_ALLOCATION_GRANULARITY - 1) / GPU_ALLOCATION_GRANULARITY, 1u);
+    GpuMemoryBlock* block = NULL;
+    uint32_t region = TLSF_NONE;
+    for(uint32_t i = 0; i < g_gpu_allocator.num_blocks && !block; i++) {
+        GpuMemoryBlock* candidate = g_gpu_allocator.blocks[i];
+        if(candidate->memory_type != memory_type || candidate->kind != kind) continue;
+        if(GpuMemoryBlock_allocate(candidate, units, alignment_units, &region)) block = candidate;
+    }
+    if(!block) {
+        block = GpuAllocator_createBlock(memory_type, kind);
+        if(!block || !GpuMemoryBlock_allocate(block, units, alignment_units, &region)) PANIC("failed to allocate %llu bytes of device memory!", (unsigned long long)requirements->size);
+    }
+
+    out_allocation->memory = block->memory;
+    out_allocation->offset = (VkDeviceSize)block->regions[region].offset * GPU_ALLOCATION_GRANULARITY;
+    out_allocation->mapped = block->mapped ? block->mapped + out_allocation->offset : NULL;
+    out_allocation->block = block;
+    out_allocation->region = region;
+}
+
+void GpuAllocator_free(GpuAllocation* allocation) {
+    if(allocation->memory == VK_NULL_HANDLE) return;
+
+    if(!allocation->block) {
+        vkFreeMemory(g_device, allocation->memory, NULL);
+        g_gpu_allocator.num_device_memory_objects--;
+        g_gpu_allocator.num_dedicated_allocations--;
+        g_gpu_allocator.dedicated_bytes -= allocation->size;
+    } else {
+        GpuMemoryBlock* block = allocation->block;
+        GpuMemoryBlock_free(block, allocation->region);
+
+        // Keep at most one empty block per memory type and kind around, so short lived staging buffers don't
+        // allocate and free a whole block every time
+        if(block->num_allocations == 0) {
+            uint32_t block_index = UINT32_MAX;
+            bool has_other_empty_block = false;
+            for(uint32_t i = 0; i < g_gpu_allocator.num_blocks; i++) {
+                const GpuMemoryBlock* other = g_gpu_allocator.blocks[i];
+                if(other == block) block_index = i;
+                else if(other->memory_type == block->memory_type && other->kind == block->kind && other->num_allocations == 0) has_other_empty_block = true;
+            }
+            if(has_other_empty_block) GpuAllocator_destroyBlock(block_index);
+        }
+    }
+    memset(allocation, 0, sizeof(GpuAllocation));
+}
+
+void GpuAllocator_printStats() {
+    printf("[[DS-GPU_MEMORY]] %u device memory objects in use (limit %u), %u dedicated allocations with %.2f MB.\n",
+           g_gpu_allocator.num_device_memory_objects, g_gpu_allocator.max_device_memory_objects,
+           g_gpu_allocator.num_dedicated_allocations, (double)g_gpu_allocator.dedicated_bytes / (1024.0 * 1024.0));
+    for(uint32_t type = 0; type < g_gpu_allocator.memory_properties.memoryTypeCount; type++) {
+        uint32_t num_blocks = 0;
+        uint32_t num_allocations = 0;
+        VkDeviceSize reserved = 0;
+        VkDeviceSize used = 0;
+        for(uint32_t i = 0; i < g_gpu_allocator.num_blocks; i++) {
+            const GpuMemoryBlock* block = g_gpu_allocator.blocks[i];
+            if(block->memory_type != type) continue;
+            num_blocks++;
+            num_allocations += block->num_allocations;
+            reserved += block->size;
+            used += block->used;
+        }
+        if(num_blocks == 0) continue;
+        printf("[[DS-GPU_MEMORY]] Memory type %u: %u blocks, %u allocations, %.2f / %.2f MB used.\n",
+               type, num_blocks, num_allocations, (double)used / (1024.0 * 1024.0), (double)reserved / (1024.0 * 1024.0));
+    }
+}
+
+// Expects every allocation to be freed already
+void GpuAllocator_destroy() {
+    for(uint32_t i = 0; i < g_gpu_allocator.num_blocks; i++) {
+        if(g_gpu_allocator.blocks[i]->num_allocations > 0) fprintf(stderr, "Error: Leaked %u GPU allocations in memory type %u.\n", g_gpu_allocator.blocks[i]->num_allocations, g_gpu_allocator.blocks[i]->memory_type);
+    }
+    while(g_gpu_allocator.num_blocks > 0) GpuAllocator_destroyBlock(g_gpu_allocator.num_blocks - 1);
+    if(g_gpu_allocator.num_dedicated_allocations > 0) fprintf(stderr, "Error: Leaked %u dedicated GPU allocations.\n", g_gpu_allocator.num_dedicated_allocations);
+    free(g_gpu_allocator.blocks);
+    memset(&g_gpu_allocator, 0, sizeof(GpuAllocator));
+}
+
 void createImage(
     const uint32_t width,
     const uint32_t height,
@@ -1348,7 +4712,7 @@ void createImage(
     VkImageUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkImage *image,
-    VkDeviceMemory *imageMemory)
+    GpuAllocation *imageAllocation)
 {
     const VkImageCreateInfo imageInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -1367,18 +4731,21 @@ void createImage(
     if(vkCreateImage(g_device, &imageInfo, NULL, image) != VK_SUCCESS)
         PANIC("failed to create image!");
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(g_device, *image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if(vkAllocateMemory(g_device, &allocInfo, NULL, imageMemory) != VK_SUCCESS)
-        PANIC("failed to allocate image memory!");
-
-    vkBindImageMemory(g_device, *image, *imageMemory, 0);
+    VkMemoryDedicatedRequirements dedicatedRequirements = {.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS};
+    VkMemoryRequirements2 memRequirements = {.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2, .pNext = &dedicatedRequirements};
+    const VkImageMemoryRequirementsInfo2 requirementsInfo = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2, .image = *image};
+    vkGetImageMemoryRequirements2(g_device, &requirementsInfo, &memRequirements);
+
+    const VkMemoryDedicatedAllocateInfo dedicatedInfo = {.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO, .image = *image};
+    GpuAllocator_allocate(
+        &memRequirements.memoryRequirements,
+        properties,
+        tiling == VK_IMAGE_TILING_OPTIMAL ? GPU_RESOURCE_OPTIMAL : GPU_RESOURCE_LINEAR,
+        dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation,
+        &dedicatedInfo,
+        imageAllocation);
+
+    if(vkBindImageMemory(g_device, *image, imageAllocation->memory, imageAllocation->offset) != VK_SUCCESS) PANIC("failed to bind image memory!");
 }
 
 
@@ -1393,7 +4760,7 @@ void createColorResources() {
         VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         &g_color_image,
-        &g_color_image_memory);
+        &g_color_image_allocation);
     g_color_image_view = createImageView(g_color_image, g_swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
 
@@ -1409,7 +4776,7 @@ void createDepthResources() {
         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         &g_depth_image,
-        &g_depth_image_memory);
+        &g_depth_image_allocation);
     g_depth_image_view = createImageView(g_depth_image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 }
 
@@ -1417,7 +4784,7 @@ void createFramebuffers() {
     g_num_swap_chain_framebuffers = g_num_swap_chain_image_views;
     g_swap_chain_framebuffers = malloc(g_num_swap_chain_framebuffers * sizeof(VkImageView));
     for (size_t i = 0; i < g_num_swap_chain_framebuffers; i++) {
-        fprintf(stdout, "\t%zu. Framebuffers.\n", i + 1);
+        if(!g_is_recreating_swap_chain) fprintf(stdout, "\t%zu. Framebuffers.\n", i + 1);
         VkFramebufferCreateInfo framebufferInfo = {
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
             .renderPass = g_render_pass,
@@ -1451,79 +4818,635 @@ VkCommandBuffer beginSingleTimeCommands() {
     VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
     vkAllocateCommandBuffers(g_device, &allocInfo, &commandBuffer);
 
-    VkCommandBufferBeginInfo beginInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+}
+
+void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer};
+
+    vkQueueSubmit(g_graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(g_graphics_queue);
+
+    vkFreeCommandBuffers(g_device, g_command_pool, 1, &commandBuffer);
+}
+
+void createBuffer(
+    const VkDeviceSize size,
+    const VkBufferUsageFlags usage,
+    const VkMemoryPropertyFlags properties,
+    VkBuffer *buffer,
+    GpuAllocation *bufferAllocation)
+{
+    const VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE};
+
+    if(vkCreateBuffer(g_device, &bufferInfo, NULL, buffer) != VK_SUCCESS) PANIC("failed to create buffer!");
+
+    VkMemoryDedicatedRequirements dedicatedRequirements = {.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS};
+    VkMemoryRequirements2 memRequirements = {.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2, .pNext = &dedicatedRequirements};
+    const VkBufferMemoryRequirementsInfo2 requirementsInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2, .buffer = *buffer};
+    vkGetBufferMemoryRequirements2(g_device, &requirementsInfo, &memRequirements);
+
+    const VkMemoryDedicatedAllocateInfo dedicatedInfo = {.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO, .buffer = *buffer};
+    GpuAllocator_allocate(
+        &memRequirements.memoryRequirements,
+        properties,
+        GPU_RESOURCE_LINEAR,
+        dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation,
+        &dedicatedInfo,
+        bufferAllocation);
+
+    if(vkBindBufferMemory(g_device, *buffer, bufferAllocation->memory, bufferAllocation->offset) != VK_SUCCESS) PANIC("failed to bind buffer memory!");
+}
+
+/*
+ * Headless rendering
+ *
+ * With --headless WxH there is no SDL window, surface or swap chain. Every frame in flight renders into its own
+ * offscreen resolve target instead, which takes the place of a swap chain image, so the render pass, framebuffers,
+ * pipelines and cached command buffers are shared with the windowed path. Nothing waits on presentation, frames
+ * are only paced by the in flight fences. The render pass leaves the targets in TRANSFER_SRC_OPTIMAL for readback.
+ */
+void createOffscreenTargets() {
+    g_swap_chain_image_format = VK_FORMAT_B8G8R8A8_SRGB; // Same as the windowed path, see chooseSwapSurfaceFormat
+    g_swap_chain_extent = g_headless_extent;
+    g_num_swap_chain_images = g_frames_in_flight;
+    g_swap_chain_images = malloc(g_num_swap_chain_images * sizeof(VkImage));
+    g_offscreen_image_allocations = malloc(g_num_swap_chain_images * sizeof(GpuAllocation));
+    for (uint32_t i = 0; i < g_num_swap_chain_images; i++) {
+        createImage(
+            g_swap_chain_extent.width,
+            g_swap_chain_extent.height,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            g_swap_chain_image_format,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &g_swap_chain_images[i],
+            &g_offscreen_image_allocations[i]);
+    }
+
+    g_num_swap_chain_image_views = g_num_swap_chain_images;
+    g_swap_chain_image_views = malloc(g_num_swap_chain_image_views * sizeof(VkImageView));
+    for (size_t i = 0; i < g_num_swap_chain_image_views; i++) {
+        g_swap_chain_image_views[i] = createImageView(g_swap_chain_images[i], g_swap_chain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+}
+
+// Only the images and their memory, the views are destroyed together with the swap chain image views
+void destroyOffscreenTargets() {
+    for (uint32_t i = 0; i < g_num_swap_chain_images; i++) {
+        vkDestroyImage(g_device, g_swap_chain_images[i], NULL);
+        GpuAllocator_free(&g_offscreen_image_allocations[i]);
+    }
+    free(g_offscreen_image_allocations); g_offscreen_image_allocations = NULL;
+}
+
+// Copies an offscreen target into host memory and writes it in the raw capture format util/framebuffer_converter.py
+// reads: width and height as uint32 followed by the BGRA pixels. The target's last frame must have completed.
+bool writeOffscreenTarget(const uint32_t image_index, const char* path) {
+    const uint32_t width = g_swap_chain_extent.width;
+    const uint32_t height = g_swap_chain_extent.height;
+    const VkDeviceSize size = (VkDeviceSize)width * height * 4;
+    VkBuffer readbackBuffer = VK_NULL_HANDLE;
+    GpuAllocation readbackBufferAllocation;
+    createBuffer(
+        size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &readbackBuffer,
+        &readbackBufferAllocation);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    // The layout is already right, the barrier only orders the copy after the render pass' resolve
+    const VkImageMemoryBarrier imageBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = g_swap_chain_images[image_index],
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .baseMipLevel = 0, .levelCount = 1, .baseArrayLayer = 0, .layerCount = 1}};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+    const VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {width, height, 1}};
+    vkCmdCopyImageToBuffer(commandBuffer, g_swap_chain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+    const VkBufferMemoryBarrier bufferBarrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = readbackBuffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &bufferBarrier, 0, NULL);
+    endSingleTimeCommands(commandBuffer);
+
+    FILE* file = fopen(path, "wb");
+    bool success = file != NULL;
+    if(success) {
+        success = fwrite(&width, sizeof(uint32_t), 1, file) == 1;
+        success = success && fwrite(&height, sizeof(uint32_t), 1, file) == 1;
+        success = success && fwrite(readbackBufferAllocation.mapped, 1, size, file) == size;
+        success = (fclose(file) == 0) && success;
+    }
+    if(!success) fprintf(stderr, "Error: Failed to write offscreen target to '%s': %s\n", path, strerror(errno));
+
+    vkDestroyBuffer(g_device, readbackBuffer, NULL);
+    GpuAllocator_free(&readbackBufferAllocation);
+    return success;
+}
+
+void copyBufferToImage(VkBuffer buffer, VkImage image, const uint32_t width, const uint32_t height) {
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    const VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
+        .imageOffset = {.x = 0, .y = 0, .z = 0},
+        .imageExtent = {.width = width, .height = height, .depth = 1}};
+
+    vkCmdCopyBufferToImage(
+        commandBuffer,
+        buffer,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &region);
+
+    endSingleTimeCommands(commandBuffer);
+}
+
+
+// Uploads the mesh behind obj_path into device local vertex and index buffers. Both arrays are copied straight
+// from the mmap'ed mesh cache into a single staging buffer and transferred with one submission.
+void createModel(const char* obj_path, const Transform* transform, const uint32_t parent_node, Model* model) {
+    Mesh mesh;
+    loadMesh(obj_path, &mesh);
+
+    const VkDeviceSize vertex_buffer_size = (VkDeviceSize)mesh.num_vertices * sizeof(MeshVertex);
+    const VkDeviceSize index_buffer_size = (VkDeviceSize)mesh.num_indices * Mesh_indexSize(&mesh);
+    if(vertex_buffer_size == 0 || index_buffer_size == 0) PANIC("Mesh '%s' is empty", obj_path);
+
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    GpuAllocation stagingBufferAllocation;
+    createBuffer(
+        vertex_buffer_size + index_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &stagingBuffer,
+        &stagingBufferAllocation);
+
+    memcpy(stagingBufferAllocation.mapped, mesh.vertices, vertex_buffer_size);
+    memcpy((char*)stagingBufferAllocation.mapped + vertex_buffer_size, mesh.indices, index_buffer_size);
+
+    createBuffer(
+        vertex_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &model->vertex_buffer,
+        &model->vertex_buffer_allocation);
+    createBuffer(
+        index_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &model->index_buffer,
+        &model->index_buffer_allocation);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    const VkBufferCopy vertexRegion = {.srcOffset = 0, .dstOffset = 0, .size = vertex_buffer_size};
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, model->vertex_buffer, 1, &vertexRegion);
+    const VkBufferCopy indexRegion = {.srcOffset = vertex_buffer_size, .dstOffset = 0, .size = index_buffer_size};
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, model->index_buffer, 1, &indexRegion);
+    endSingleTimeCommands(commandBuffer);
+
+    vkDestroyBuffer(g_device, stagingBuffer, NULL);
+    GpuAllocator_free(&stagingBufferAllocation);
+
+    memcpy(model->lods, mesh.lods, sizeof(model->lods));
+    model->num_lods = mesh.num_lods;
+    model->index_type = mesh.index_type;
+    glm_vec4_copy(mesh.dequantization, model->dequantization);
+    glm_vec3_copy(mesh.bounds_min, model->bounds_min);
+    glm_vec3_copy(mesh.bounds_max, model->bounds_max);
+    model->scene_node = Scene_addNode(&g_scene, transform, parent_node);
+
+    unmapMesh(&mesh);
+}
+
+void destroyModel(Model* model) {
+    vkDestroyBuffer(g_device, model->index_buffer, NULL); model->index_buffer = VK_NULL_HANDLE;
+    GpuAllocator_free(&model->index_buffer_allocation);
+    vkDestroyBuffer(g_device, model->vertex_buffer, NULL); model->vertex_buffer = VK_NULL_HANDLE;
+    GpuAllocator_free(&model->vertex_buffer_allocation);
+    model->num_lods = 0;
+}
+
+void Model_enqueueIntoCommandBuffer(const Model* model, VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const uint32_t uniformOffset, const uint32_t lod) {
+    const VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &model->vertex_buffer, &offset);
+    vkCmdBindIndexBuffer(commandBuffer, model->index_buffer, 0, model->index_type);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipeline_layout, 0, 1, &descriptorSet, 1, &uniformOffset);
+    vkCmdDrawIndexed(commandBuffer, model->lods[lod].num_indices, 1, model->lods[lod].first_index, 0, 0);
+}
+
+// Model matrix for the vertex buffer, world placement followed by the mesh's dequantization
+void Model_getVertexMatrix(const Model* model, mat4 world, mat4 out_matrix) {
+    glm_translate_to(world, (float*)model->dequantization, out_matrix);
+    glm_scale_uni(out_matrix, model->dequantization[3]);
+}
+
+// Radius of the bounding sphere at scale 1, the one Model_getBoundingSphere scales
+float Model_getBoundingRadius(const Model* model) {
+    vec3 extent;
+    glm_vec3_sub((float*)model->bounds_max, (float*)model->bounds_min, extent);
+    return 0.5f * glm_vec3_norm(extent);
+}
+
+// Streamed texture handles map onto the bindless texture array one to one, right after the fallback slot
+uint32_t getBindlessTextureSlot(const uint32_t texture_handle) {
+    return BINDLESS_FALLBACK_TEXTURE_SLOT + 1 + texture_handle;
+}
+
+// The mesh's dequantization is folded into the placement, R(S(s p + o)) + t = R((S s) p) + (R(S o) + t)
+InstanceData InstanceData_fromTransform(const Transform* transform, const vec4 dequantization, const uint32_t texture_handle) {
+    InstanceData instance = {0};
+    vec3 offset;
+    glm_vec3_mul((float*)transform->scale, (float*)dequantization, offset);
+    glm_quat_rotatev((float*)transform->rotation, offset, offset);
+    glm_vec3_add(offset, (float*)transform->position, instance.position);
+    memcpy(instance.rotation, transform->rotation, sizeof(instance.rotation));
+    glm_vec3_scale((float*)transform->scale, dequantization[3], instance.scale);
+    instance.texture_slot = getBindlessTextureSlot(texture_handle);
+    return instance;
+}
+
+// World space bounding sphere (center, radius) of the mesh bounds placed by transform
+void Model_getBoundingSphere(const Model* model, const Transform* transform, vec4 out_sphere) {
+    vec3 local_center, extent;
+    glm_vec3_add((float*)model->bounds_min, (float*)model->bounds_max, local_center);
+    glm_vec3_scale(local_center, 0.5f, local_center);
+    glm_vec3_sub((float*)model->bounds_max, (float*)model->bounds_min, extent);
+
+    vec3 scaled_center, world_center;
+    glm_vec3_mul(local_center, (float*)transform->scale, scaled_center);
+    glm_quat_rotatev((float*)transform->rotation, scaled_center, world_center);
+    glm_vec3_add(world_center, (float*)transform->position, world_center);
+
+    const float max_scale = MAX(fabsf(transform->scale[0]), MAX(fabsf(transform->scale[1]), fabsf(transform->scale[2])));
+    glm_vec4(world_center, 0.5f * glm_vec3_norm(extent) * max_scale, out_sphere);
+}
+
+// Same as Model_getBoundingSphere for an arbitrary world matrix, the radius grows with the largest axis scale
+void Model_getWorldBoundingSphere(const Model* model, mat4 world, vec4 out_sphere) {
+    vec3 local_center, extent;
+    glm_vec3_add((float*)model->bounds_min, (float*)model->bounds_max, local_center);
+    glm_vec3_scale(local_center, 0.5f, local_center);
+    glm_vec3_sub((float*)model->bounds_max, (float*)model->bounds_min, extent);
+
+    vec3 world_center;
+    glm_mat4_mulv3(world, local_center, 1.0f, world_center);
+    const float max_scale = sqrtf(MAX(glm_vec3_norm2(world[0]), MAX(glm_vec3_norm2(world[1]), glm_vec3_norm2(world[2]))));
+    glm_vec4(world_center, 0.5f * glm_vec3_norm(extent) * max_scale, out_sphere);
+}
+
+VkDeviceSize alignUniformSize(const VkDeviceSize size) {
+    return (size + g_uniform_offset_alignment - 1) / g_uniform_offset_alignment * g_uniform_offset_alignment;
+}
+
+VkDeviceSize getCullingUniformOffset(const uint32_t culling_slot) {
+    return culling_slot * alignUniformSize(sizeof(CullingUniforms));
+}
+
+// Bounds are uploaded once, the indirect buffers and the compacted instances are rewritten by the culling pass every
+// frame. Needs the frame uniform rings, they hold the per frame CullingUniforms, and the batch's InstanceData.
+void InstancedModel_createCullingResources(InstancedModel* instanced_model, const Transform* transforms) {
+    const uint32_t num_instances = instanced_model->num_instances;
+    const VkDeviceSize bounds_buffer_size = (VkDeviceSize)num_instances * sizeof(vec4);
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    GpuAllocation stagingBufferAllocation;
+    createBuffer(
+        bounds_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &stagingBuffer,
+        &stagingBufferAllocation);
+
+    vec4* spheres = (vec4*)stagingBufferAllocation.mapped;
+    for(uint32_t i = 0; i < num_instances; i++) Model_getBoundingSphere(&instanced_model->model, &transforms[i], spheres[i]);
+
+    createBuffer(
+        bounds_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &instanced_model->bounds_buffer,
+        &instanced_model->bounds_buffer_allocation);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    const VkBufferCopy region = {.srcOffset = 0, .dstOffset = 0, .size = bounds_buffer_size};
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, instanced_model->bounds_buffer, 1, &region);
+    endSingleTimeCommands(commandBuffer);
+
+    vkDestroyBuffer(g_device, stagingBuffer, NULL);
+    GpuAllocator_free(&stagingBufferAllocation);
+
+    // Every LOD gets a bucket that fits all instances, a frame's buckets are only partially filled
+    const uint32_t num_visible_records = instanced_model->model.num_lods * num_instances;
+    if(g_bindless_enabled && num_visible_records > (BINDLESS_MAX_OBJECTS - g_num_object_records) / g_frames_in_flight) {
+        PANIC("Compacted instances don't fit, BINDLESS_MAX_OBJECTS (%u) is too small", BINDLESS_MAX_OBJECTS);
+    }
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) {
+        createBuffer(
+            MESH_MAX_LODS * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &instanced_model->indirect_buffers[i],
+            &instanced_model->indirect_buffer_allocations[i]);
+
+        instanced_model->visible_instance_buffers[i] = VK_NULL_HANDLE;
+        instanced_model->first_visible_records[i] = 0;
+        if(g_bindless_enabled) {
+            instanced_model->first_visible_records[i] = g_num_object_records;
+            g_num_object_records += num_visible_records;
+        } else {
+            createBuffer(
+                (VkDeviceSize)num_visible_records * sizeof(InstanceData),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                &instanced_model->visible_instance_buffers[i],
+                &instanced_model->visible_instance_buffer_allocations[i]);
+        }
+    }
+
+    if(g_num_culling_slots == CULLING_MAX_BATCHES) PANIC("Too many GPU culled batches, CULLING_MAX_BATCHES (%u) is too small", CULLING_MAX_BATCHES);
+    instanced_model->culling_slot = g_num_culling_slots++;
+
+    // Never rewritten, so they come out of the descriptor cache
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) {
+        DescriptorSetContents contents;
+        DescriptorSetContents_init(&contents, g_culling_descriptor_set_layout);
+        DescriptorSetContents_addBuffer(&contents, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, instanced_model->bounds_buffer, 0, VK_WHOLE_SIZE);
+        DescriptorSetContents_addBuffer(&contents, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, instanced_model->indirect_buffers[i], 0, VK_WHOLE_SIZE);
+        DescriptorSetContents_addBuffer(
+            &contents, 2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            g_frame_uniform_rings[i].buffer, getCullingUniformOffset(instanced_model->culling_slot), sizeof(CullingUniforms));
+        // The bindless records are addressed through the push constants, both bindings see the whole record buffer
+        DescriptorSetContents_addBuffer(
+            &contents, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            g_bindless_enabled ? g_object_record_buffer : instanced_model->instance_buffer, 0, VK_WHOLE_SIZE);
+        DescriptorSetContents_addBuffer(
+            &contents, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            g_bindless_enabled ? g_object_record_buffer : instanced_model->visible_instance_buffers[i], 0, VK_WHOLE_SIZE);
+        instanced_model->culling_descriptor_sets[i] = DescriptorCache_get(&g_descriptor_cache, &contents);
+    }
+}
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+// Moves the world space frustum and camera into the batch's space and stores them in this frame's culling slot
+void InstancedModel_updateCullingUniforms(const InstancedModel* instanced_model, const uint32_t frame_idx, vec4 frustum_planes[6], const float lod_scale) {
+    CullingUniforms uniforms;
+
+    // The bounds are relative to the batch's scene node, so the planes are moved into that space instead.
+    // Renormalizing keeps distances comparable to the radii as long as the node is scaled uniformly.
+    mat4 world_transposed;
+    glm_mat4_transpose_to(g_scene.world_matrices[instanced_model->model.scene_node], world_transposed);
+    for(uint32_t i = 0; i < 6; i++) {
+        glm_mat4_mulv(world_transposed, frustum_planes[i], uniforms.frustum_planes[i]);
+        glm_vec4_scale(uniforms.frustum_planes[i], 1.0f / glm_vec3_norm(uniforms.frustum_planes[i]), uniforms.frustum_planes[i]);
+    }
 
-    return commandBuffer;
+    // Errors and distances scale alike under a uniform scale, so the LOD scale carries over unchanged
+    mat4 world_inverse;
+    vec3 camera_position;
+    glm_mat4_inv(g_scene.world_matrices[instanced_model->model.scene_node], world_inverse);
+    glm_mat4_mulv3(world_inverse, g_camera_eye, 1.0f, camera_position);
+    glm_vec4(camera_position, lod_scale, uniforms.camera_position);
+    memcpy(g_frame_uniform_rings[frame_idx].mapped + getCullingUniformOffset(instanced_model->culling_slot), &uniforms, sizeof(uniforms));
 }
 
-void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-    vkEndCommandBuffer(commandBuffer);
+// Records the culling pass for this frame's indirect buffer, must be recorded outside of a render pass.
+// The planes are read from the frame's CullingUniforms, see InstancedModel_updateCullingUniforms.
+void InstancedModel_recordCulling(const InstancedModel* instanced_model, VkCommandBuffer commandBuffer, const uint32_t frame_idx) {
+    const Model* model = &instanced_model->model;
+    const uint32_t first_visible_instance = g_bindless_enabled ? instanced_model->first_visible_records[frame_idx] : 0;
+
+    // The commands only depend on the batch and the frame, the pass fills in instanceCount
+    VkDrawIndexedIndirectCommand commands[MESH_MAX_LODS];
+    for(uint32_t lod = 0; lod < model->num_lods; lod++) {
+        commands[lod] = (VkDrawIndexedIndirectCommand){
+            .indexCount = model->lods[lod].num_indices,
+            .instanceCount = 0,
+            .firstIndex = model->lods[lod].first_index,
+            .vertexOffset = 0,
+            .firstInstance = first_visible_instance + lod * instanced_model->num_instances};
+    }
+    VkBuffer indirect_buffer = instanced_model->indirect_buffers[frame_idx];
+    vkCmdUpdateBuffer(commandBuffer, indirect_buffer, 0, model->num_lods * sizeof(VkDrawIndexedIndirectCommand), commands);
 
-    VkSubmitInfo submitInfo = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffer};
+    const VkBufferMemoryBarrier clearBarrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = indirect_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 1, &clearBarrier, 0, NULL);
+
+    CullingPushConstants pushConstants = {
+        .num_objects = instanced_model->num_instances,
+        .first_source_instance = g_bindless_enabled ? instanced_model->first_object_record : 0,
+        .first_visible_instance = first_visible_instance,
+        .num_lods = model->num_lods,
+        .mesh_radius = Model_getBoundingRadius(model)};
+    memcpy(pushConstants.lods, model->lods, sizeof(pushConstants.lods));
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, g_culling_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, g_culling_pipeline_layout, 0, 1, &instanced_model->culling_descriptor_sets[frame_idx], 0, NULL);
+    vkCmdPushConstants(commandBuffer, g_culling_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullingPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (instanced_model->num_instances + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE, 1, 1);
+
+    // The bindless vertex shader reads its compacted records from the storage buffer, the instanced one as a vertex stream
+    const VkBufferMemoryBarrier drawBarriers[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = indirect_buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE},
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = g_bindless_enabled ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = g_bindless_enabled ? g_object_record_buffer : instanced_model->visible_instance_buffers[frame_idx],
+            .offset = (VkDeviceSize)first_visible_instance * sizeof(InstanceData),
+            .size = (VkDeviceSize)model->num_lods * instanced_model->num_instances * sizeof(InstanceData)}};
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | (g_bindless_enabled ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT : VK_PIPELINE_STAGE_VERTEX_INPUT_BIT),
+        0, 0, NULL, 2, drawBarriers, 0, NULL);
+}
 
-    vkQueueSubmit(g_graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(g_graphics_queue);
+// The model transform of the underlying Model is identity, every placement comes from the instance buffer.
+// textures holds one streamed texture handle per instance, only the bindless pipeline tells them apart.
+// In bindless mode the instances are appended to g_object_record_buffer instead, records are never reclaimed.
+void createInstancedModel(const char* obj_path, const Transform* transforms, const uint32_t* textures, const uint32_t num_instances, InstancedModel* instanced_model) {
+    if(num_instances == 0) PANIC("Instanced model '%s' needs at least one instance", obj_path);
 
-    vkFreeCommandBuffers(g_device, g_command_pool, 1, &commandBuffer);
-}
+    const Transform identity = {
+        {0.0f, 0.0f, 0.0f},
+        {0.0f, 0.0f, 0.0f, 1.0f},
+        {1.0f, 1.0f, 1.0f}};
+    createModel(obj_path, &identity, SCENE_NO_PARENT, &instanced_model->model);
 
-void createBuffer(
-    const VkDeviceSize size,
-    const VkBufferUsageFlags usage,
-    const VkMemoryPropertyFlags properties,
-    VkBuffer *buffer,
-    VkDeviceMemory *bufferMemory)
-{
-    const VkBufferCreateInfo bufferInfo = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE};
+    const VkDeviceSize instance_buffer_size = (VkDeviceSize)num_instances * sizeof(InstanceData);
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    GpuAllocation stagingBufferAllocation;
+    createBuffer(
+        instance_buffer_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &stagingBuffer,
+        &stagingBufferAllocation);
+
+    InstanceData* instances = (InstanceData*)stagingBufferAllocation.mapped;
+    for(uint32_t i = 0; i < num_instances; i++) instances[i] = InstanceData_fromTransform(&transforms[i], instanced_model->model.dequantization, textures[i]);
+
+    VkBuffer dstBuffer = VK_NULL_HANDLE;
+    VkDeviceSize dstOffset = 0;
+    instanced_model->instance_buffer = VK_NULL_HANDLE;
+    instanced_model->first_object_record = 0;
+    if(g_bindless_enabled) {
+        if(num_instances > BINDLESS_MAX_OBJECTS - g_num_object_records) PANIC("Instanced model '%s' doesn't fit, BINDLESS_MAX_OBJECTS (%u) is too small", obj_path, BINDLESS_MAX_OBJECTS);
+        instanced_model->first_object_record = g_num_object_records;
+        g_num_object_records += num_instances;
+        dstBuffer = g_object_record_buffer;
+        dstOffset = (VkDeviceSize)instanced_model->first_object_record * sizeof(InstanceData);
+    } else {
+        // Also read by the culling pass, which copies the visible instances into their LOD's bucket
+        createBuffer(
+            instance_buffer_size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &instanced_model->instance_buffer,
+            &instanced_model->instance_buffer_allocation);
+        dstBuffer = instanced_model->instance_buffer;
+    }
 
-    if(vkCreateBuffer(g_device, &bufferInfo, NULL, buffer) != VK_SUCCESS) PANIC("failed to create buffer!");
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    const VkBufferCopy region = {.srcOffset = 0, .dstOffset = dstOffset, .size = instance_buffer_size};
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, dstBuffer, 1, &region);
+    endSingleTimeCommands(commandBuffer);
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(g_device, *buffer, &memRequirements);
+    vkDestroyBuffer(g_device, stagingBuffer, NULL);
+    GpuAllocator_free(&stagingBufferAllocation);
 
-    const VkMemoryAllocateInfo allocInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties)};
+    instanced_model->num_instances = num_instances;
+    if(g_gpu_culling_enabled) InstancedModel_createCullingResources(instanced_model, transforms);
+}
 
-    if(vkAllocateMemory(g_device, &allocInfo, NULL, bufferMemory) != VK_SUCCESS) PANIC("failed to allocate buffer memory!");
-    vkBindBufferMemory(g_device, *buffer, *bufferMemory, 0);
+void destroyInstancedModel(InstancedModel* instanced_model) {
+    if(g_gpu_culling_enabled) {
+        // The culling sets of the bindless path only reference the shared record buffer besides these
+        VkBuffer referenced_buffers[2 * MAX_FRAMES_IN_FLIGHT + 2];
+        uint32_t num_referenced_buffers = 0;
+        for(uint32_t i = 0; i < g_frames_in_flight; i++) {
+            referenced_buffers[num_referenced_buffers++] = instanced_model->indirect_buffers[i];
+            if(!g_bindless_enabled) referenced_buffers[num_referenced_buffers++] = instanced_model->visible_instance_buffers[i];
+        }
+        referenced_buffers[num_referenced_buffers++] = instanced_model->bounds_buffer;
+        if(!g_bindless_enabled) referenced_buffers[num_referenced_buffers++] = instanced_model->instance_buffer;
+        DescriptorCache_evictBuffers(&g_descriptor_cache, referenced_buffers, num_referenced_buffers);
+        for(uint32_t i = 0; i < g_frames_in_flight; i++) {
+            vkDestroyBuffer(g_device, instanced_model->indirect_buffers[i], NULL); instanced_model->indirect_buffers[i] = VK_NULL_HANDLE;
+            GpuAllocator_free(&instanced_model->indirect_buffer_allocations[i]);
+            if(instanced_model->visible_instance_buffers[i] != VK_NULL_HANDLE) {
+                vkDestroyBuffer(g_device, instanced_model->visible_instance_buffers[i], NULL); instanced_model->visible_instance_buffers[i] = VK_NULL_HANDLE;
+                GpuAllocator_free(&instanced_model->visible_instance_buffer_allocations[i]);
+            }
+        }
+        vkDestroyBuffer(g_device, instanced_model->bounds_buffer, NULL); instanced_model->bounds_buffer = VK_NULL_HANDLE;
+        GpuAllocator_free(&instanced_model->bounds_buffer_allocation);
+    }
+    if(instanced_model->instance_buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(g_device, instanced_model->instance_buffer, NULL); instanced_model->instance_buffer = VK_NULL_HANDLE;
+        GpuAllocator_free(&instanced_model->instance_buffer_allocation);
+    }
+    destroyModel(&instanced_model->model);
+    instanced_model->num_instances = 0;
 }
 
-void copyBufferToImage(VkBuffer buffer, VkImage image, const uint32_t width, const uint32_t height) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+// Binds the pipeline, buffers and descriptor sets of either the instanced or the bindless path.
+// instance_buffer is the per instance stream of the instanced path, ignored by the bindless one.
+void InstancedModel_bind(const InstancedModel* instanced_model, VkCommandBuffer commandBuffer, VkBuffer instance_buffer, VkDescriptorSet descriptorSet, const uint32_t uniformOffset, const uint32_t frame_idx) {
+    const VkDeviceSize offsets[2] = {0, 0};
+    vkCmdBindIndexBuffer(commandBuffer, instanced_model->model.index_buffer, 0, instanced_model->model.index_type);
+    if(g_bindless_enabled) {
+        const VkDescriptorSet descriptorSets[2] = {descriptorSet, g_bindless_descriptor_sets[frame_idx]};
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_bindless_pipeline);
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &instanced_model->model.vertex_buffer, offsets);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_bindless_pipeline_layout, 0, 2, descriptorSets, 1, &uniformOffset);
+        return;
+    }
+    const VkBuffer buffers[2] = {instanced_model->model.vertex_buffer, instance_buffer};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_instanced_pipeline);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_pipeline_layout, 0, 1, &descriptorSet, 1, &uniformOffset);
+}
 
-    const VkBufferImageCopy region = {
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
-        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
-        .imageOffset = {.x = 0, .y = 0, .z = 0},
-        .imageExtent = {.width = width, .height = height, .depth = 1}};
+// In bindless mode gl_InstanceIndex addresses g_object_record_buffer, so the batch starts at its first record
+void InstancedModel_enqueueIntoCommandBuffer(const InstancedModel* instanced_model, VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const uint32_t uniformOffset, const uint32_t frame_idx) {
+    InstancedModel_bind(instanced_model, commandBuffer, instanced_model->instance_buffer, descriptorSet, uniformOffset, frame_idx);
+    const uint32_t firstInstance = g_bindless_enabled ? instanced_model->first_object_record : 0;
+    const MeshLod* lod = &instanced_model->model.lods[0]; // Without the culling pass there's nothing to pick LODs per instance
+    vkCmdDrawIndexed(commandBuffer, lod->num_indices, instanced_model->num_instances, lod->first_index, 0, firstInstance);
+}
 
-    vkCmdCopyBufferToImage(
+// Draws the LOD buckets InstancedModel_recordCulling filled, one instanced draw per LOD. Empty buckets draw nothing
+void InstancedModel_enqueueIndirectIntoCommandBuffer(const InstancedModel* instanced_model, VkCommandBuffer commandBuffer, VkDescriptorSet descriptorSet, const uint32_t uniformOffset, const uint32_t frame_idx) {
+    InstancedModel_bind(instanced_model, commandBuffer, instanced_model->visible_instance_buffers[frame_idx], descriptorSet, uniformOffset, frame_idx);
+    vkCmdDrawIndexedIndirect(
         commandBuffer,
-        buffer,
-        image,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &region);
-
-    endSingleTimeCommands(commandBuffer);
+        instanced_model->indirect_buffers[frame_idx],
+        0,
+        instanced_model->model.num_lods,
+        sizeof(VkDrawIndexedIndirectCommand));
 }
 
-
 void transitionImageLayout(
     VkImage image,
     VkFormat format,
@@ -1599,395 +5522,1883 @@ void transitionImageLayout(
 }
 
 
-void generateMipmaps(
-    VkImage image,
-    VkFormat imageFormat,
-    const int32_t texWidth,
-    const int32_t texHeight,
-    const uint32_t mipLevels)
-{
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(g_physical_device, imageFormat, &formatProperties);
+/*
+ * Baked texture cache
+ *
+ * Decoding PNGs and blitting the mip chain on every startup is wasted work, so every texture is baked once into a
+ * .dstex file next to its source: the full mip chain, box filtered in linear space, stored as BC1 blocks for opaque
+ * textures (8:1 compared to RGBA8) and as plain RGBA8 for everything with an alpha channel.
+ * The header stores the VkFormat of the payload, devices that can't sample it get it transcoded on the CPU instead.
+ * Like the mesh cache, the bake is redone whenever the source is newer than the cache or the header doesn't validate.
+ */
+#define TEXTURE_CACHE_MAGIC 0x58455444u // "DTEX" when read byte by byte
+#define TEXTURE_CACHE_VERSION 1u
+#define TEXTURE_CACHE_EXTENSION ".dstex"
+#define TEXTURE_CACHE_PAYLOAD_ALIGNMENT 16
+#define TEXTURE_CACHE_MAX_MIP_LEVELS 16 // Up to 32768 x 32768
+#define BC1_BLOCK_SIZE 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format; // VkFormat of the payload
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    uint64_t level_offsets[TEXTURE_CACHE_MAX_MIP_LEVELS]; // Byte offsets relative to the start of the file
+    uint64_t level_sizes[TEXTURE_CACHE_MAX_MIP_LEVELS];
+} TextureCacheHeader;
+
+// CPU side view of a baked texture, the level pointers point into the mmap'ed cache file and stay valid until unmapTexture
+typedef struct {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    const void* levels[TEXTURE_CACHE_MAX_MIP_LEVELS];
+    VkDeviceSize level_sizes[TEXTURE_CACHE_MAX_MIP_LEVELS];
+    FileView file; // Backing storage of the levels
+} BakedTexture;
+
+uint32_t mipExtent(const uint32_t extent, const uint32_t level) {
+    return MAX(extent >> level, 1u);
+}
 
-    if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        PANIC("texture image format does not support linear blitting!");
+VkDeviceSize textureLevelSize(const VkFormat format, const uint32_t width, const uint32_t height) {
+    if(format == VK_FORMAT_BC1_RGB_SRGB_BLOCK) return (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4) * BC1_BLOCK_SIZE;
+    return (VkDeviceSize)width * height * 4;
+}
+
+float g_srgb_to_linear[256];
+
+void initSrgbToLinearTable() {
+    for(uint32_t i = 0; i < 256; i++) {
+        const float c = (float)i / 255.0f;
+        g_srgb_to_linear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
     }
+}
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-    VkImageMemoryBarrier barrier = {
+uint8_t linearToSrgb(const float linear) {
+    const float c = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+    const float scaled = c * 255.0f + 0.5f;
+    return (uint8_t)(scaled <= 0.0f ? 0.0f : (scaled >= 255.0f ? 255.0f : scaled));
+}
+
+// 2x2 box filter, color channels are averaged in linear space, odd rows and columns are clamped at the border
+void downsampleRGBA8(const uint8_t* src, const uint32_t src_width, const uint32_t src_height, uint8_t* dst) {
+    const uint32_t dst_width = MAX(src_width / 2, 1u);
+    const uint32_t dst_height = MAX(src_height / 2, 1u);
+    for(uint32_t y = 0; y < dst_height; y++) {
+        const uint32_t y0 = MIN(y * 2, src_height - 1);
+        const uint32_t y1 = MIN(y * 2 + 1, src_height - 1);
+        for(uint32_t x = 0; x < dst_width; x++) {
+            const uint32_t x0 = MIN(x * 2, src_width - 1);
+            const uint32_t x1 = MIN(x * 2 + 1, src_width - 1);
+            const uint8_t* taps[4] = {
+                &src[(y0 * src_width + x0) * 4], &src[(y0 * src_width + x1) * 4],
+                &src[(y1 * src_width + x0) * 4], &src[(y1 * src_width + x1) * 4]};
+            uint8_t* out = &dst[(y * dst_width + x) * 4];
+            for(uint32_t c = 0; c < 3; c++) {
+                const float sum = g_srgb_to_linear[taps[0][c]] + g_srgb_to_linear[taps[1][c]] + g_srgb_to_linear[taps[2][c]] + g_srgb_to_linear[taps[3][c]];
+                out[c] = linearToSrgb(sum * 0.25f);
+            }
+            out[3] = (uint8_t)((taps[0][3] + taps[1][3] + taps[2][3] + taps[3][3] + 2) / 4);
+        }
+    }
+}
+
+uint16_t packRGB565(const float* rgb) {
+    const uint32_t r = (uint32_t)(MIN(MAX(rgb[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    const uint32_t g = (uint32_t)(MIN(MAX(rgb[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    const uint32_t b = (uint32_t)(MIN(MAX(rgb[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpackRGB565(const uint16_t color, uint8_t* out_rgb) {
+    const uint32_t r = (color >> 11) & 31;
+    const uint32_t g = (color >> 5) & 63;
+    const uint32_t b = color & 31;
+    out_rgb[0] = (uint8_t)((r << 3) | (r >> 2));
+    out_rgb[1] = (uint8_t)((g << 2) | (g >> 4));
+    out_rgb[2] = (uint8_t)((b << 3) | (b >> 2));
+}
+
+// Four color palette of a block, only the color0 > color1 mode is ever emitted by the encoder
+void getBC1Palette(const uint16_t color0, const uint16_t color1, uint8_t palette[4][4]) {
+    unpackRGB565(color0, palette[0]);
+    unpackRGB565(color1, palette[1]);
+    for(uint32_t c = 0; c < 3; c++) {
+        if(color0 > color1) {
+            palette[2][c] = (uint8_t)((2 * palette[0][c] + palette[1][c] + 1) / 3);
+            palette[3][c] = (uint8_t)((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+        } else {
+            palette[2][c] = (uint8_t)((palette[0][c] + palette[1][c] + 1) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = (color0 > color1) ? 255 : 0;
+}
+
+// Fits both endpoints along the principal axis of the 16 colors and picks the closest palette entry per texel
+void encodeBC1Block(const uint8_t texels[16][4], uint8_t* out_block) {
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for(uint32_t i = 0; i < 16; i++) {
+        for(uint32_t c = 0; c < 3; c++) mean[c] += texels[i][c];
+    }
+    for(uint32_t c = 0; c < 3; c++) mean[c] /= 16.0f;
+
+    float covariance[6] = {0}; // rr, rg, rb, gg, gb, bb
+    for(uint32_t i = 0; i < 16; i++) {
+        const float r = texels[i][0] - mean[0];
+        const float g = texels[i][1] - mean[1];
+        const float b = texels[i][2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+
+    // A few power iterations are plenty to find the dominant eigenvector of a 3x3 matrix
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for(uint32_t iteration = 0; iteration < 8; iteration++) {
+        const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const float length = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+        if(length < FLT_EPSILON) break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    float min_projection = FLT_MAX;
+    float max_projection = -FLT_MAX;
+    for(uint32_t i = 0; i < 16; i++) {
+        const float projection = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+        min_projection = fminf(min_projection, projection);
+        max_projection = fmaxf(max_projection, projection);
+    }
+    const float axis_length_squared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float endpoint0[3];
+    float endpoint1[3];
+    for(uint32_t c = 0; c < 3; c++) {
+        endpoint0[c] = mean[c] + axis[c] * max_projection / axis_length_squared;
+        endpoint1[c] = mean[c] + axis[c] * min_projection / axis_length_squared;
+    }
+
+    uint16_t color0 = packRGB565(endpoint0);
+    uint16_t color1 = packRGB565(endpoint1);
+    if(color0 < color1) {
+        const uint16_t tmp = color0;
+        color0 = color1;
+        color1 = tmp;
+    }
+
+    uint32_t indices = 0;
+    if(color0 != color1) {
+        uint8_t palette[4][4];
+        getBC1Palette(color0, color1, palette);
+        for(uint32_t i = 0; i < 16; i++) {
+            uint32_t best_index = 0;
+            int32_t best_error = INT32_MAX;
+            for(uint32_t p = 0; p < 4; p++) {
+                const int32_t dr = (int32_t)texels[i][0] - palette[p][0];
+                const int32_t dg = (int32_t)texels[i][1] - palette[p][1];
+                const int32_t db = (int32_t)texels[i][2] - palette[p][2];
+                const int32_t error = dr * dr + dg * dg + db * db;
+                if(error < best_error) {
+                    best_error = error;
+                    best_index = p;
+                }
+            }
+            indices |= best_index << (i * 2);
+        }
+    }
+    // Solid blocks end up with color0 == color1 and all indices 0, which decodes as color0 in either mode
+
+    out_block[0] = (uint8_t)(color0 & 0xFF);
+    out_block[1] = (uint8_t)(color0 >> 8);
+    out_block[2] = (uint8_t)(color1 & 0xFF);
+    out_block[3] = (uint8_t)(color1 >> 8);
+    for(uint32_t i = 0; i < 4; i++) out_block[4 + i] = (uint8_t)(indices >> (i * 8));
+}
+
+void encodeBC1(const uint8_t* rgba, const uint32_t width, const uint32_t height, uint8_t* out_blocks) {
+    const uint32_t num_blocks_x = (width + 3) / 4;
+    const uint32_t num_blocks_y = (height + 3) / 4;
+    for(uint32_t block_y = 0; block_y < num_blocks_y; block_y++) {
+        for(uint32_t block_x = 0; block_x < num_blocks_x; block_x++) {
+            // Blocks overhanging the border repeat the last row / column
+            uint8_t texels[16][4];
+            for(uint32_t i = 0; i < 16; i++) {
+                const uint32_t x = MIN(block_x * 4 + i % 4, width - 1);
+                const uint32_t y = MIN(block_y * 4 + i / 4, height - 1);
+                memcpy(texels[i], &rgba[(y * width + x) * 4], 4);
+            }
+            encodeBC1Block(texels, &out_blocks[(block_y * num_blocks_x + block_x) * BC1_BLOCK_SIZE]);
+        }
+    }
+}
+
+// CPU transcode for devices without BC support
+void decodeBC1(const uint8_t* blocks, const uint32_t width, const uint32_t height, uint8_t* out_rgba) {
+    const uint32_t num_blocks_x = (width + 3) / 4;
+    const uint32_t num_blocks_y = (height + 3) / 4;
+    for(uint32_t block_y = 0; block_y < num_blocks_y; block_y++) {
+        for(uint32_t block_x = 0; block_x < num_blocks_x; block_x++) {
+            const uint8_t* block = &blocks[(block_y * num_blocks_x + block_x) * BC1_BLOCK_SIZE];
+            const uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8));
+            const uint16_t color1 = (uint16_t)(block[2] | (block[3] << 8));
+            const uint32_t indices = (uint32_t)block[4] | ((uint32_t)block[5] << 8) | ((uint32_t)block[6] << 16) | ((uint32_t)block[7] << 24);
+            uint8_t palette[4][4];
+            getBC1Palette(color0, color1, palette);
+            for(uint32_t i = 0; i < 16; i++) {
+                const uint32_t x = block_x * 4 + i % 4;
+                const uint32_t y = block_y * 4 + i / 4;
+                if(x >= width || y >= height) continue;
+                memcpy(&out_rgba[(y * width + x) * 4], palette[(indices >> (i * 2)) & 3], 4);
+            }
+        }
+    }
+}
+
+void getTextureCachePath(const char* image_path, char* out_path, const size_t out_path_size) {
+    const char* extension = strrchr(image_path, '.');
+    const char* separator = strrchr(image_path, '/');
+    const size_t stem_length = (extension && (!separator || extension > separator)) ? (size_t)(extension - image_path) : strlen(image_path);
+    const int written = snprintf(out_path, out_path_size, "%.*s%s", (int)stem_length, image_path, TEXTURE_CACHE_EXTENSION);
+    if(written < 0 || (size_t)written >= out_path_size) PANIC("Texture cache path for '%s' is too long", image_path);
+}
+
+// Decodes the source image, builds the mip chain and writes it (BC1 compressed if opaque) to cache_path
+bool bakeTexture(const char* image_path, const char* cache_path) {
+    TRACE_ZONE("Texture bake");
+
+    int texWidth = 0;
+    int texHeight = 0;
+    int texChannels = 0;
+    stbi_uc* pixels = NULL;
+    {
+        FileView file;
+        if(!FileView_open(image_path, &file)) return false;
+        pixels = stbi_load_from_memory((const stbi_uc*)file.data, (int)file.size, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        FileView_close(&file);
+    }
+    if(!pixels) {
+        fprintf(stderr, "Error: Failed to decode texture '%s': %s\n", image_path, stbi_failure_reason());
+        return false;
+    }
+
+    const uint32_t width = (uint32_t)texWidth;
+    const uint32_t height = (uint32_t)texHeight;
+    const uint32_t mip_levels = calculate_mip_levels(width, height);
+    if(mip_levels > TEXTURE_CACHE_MAX_MIP_LEVELS) {
+        fprintf(stderr, "Error: Texture '%s' (%ux%u) exceeds the maximum texture size.\n", image_path, width, height);
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    bool is_opaque = true;
+    for(size_t i = 0; i < (size_t)width * height && is_opaque; i++) is_opaque = pixels[i * 4 + 3] == 255;
+    const VkFormat format = is_opaque ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_R8G8B8A8_SRGB;
+
+    TextureCacheHeader header = {
+        .magic = TEXTURE_CACHE_MAGIC,
+        .version = TEXTURE_CACHE_VERSION,
+        .format = format,
+        .width = width,
+        .height = height,
+        .mip_levels = mip_levels};
+    uint64_t offset = sizeof(TextureCacheHeader);
+    for(uint32_t level = 0; level < mip_levels; level++) {
+        offset = (offset + TEXTURE_CACHE_PAYLOAD_ALIGNMENT - 1) & ~(uint64_t)(TEXTURE_CACHE_PAYLOAD_ALIGNMENT - 1);
+        header.level_offsets[level] = offset;
+        header.level_sizes[level] = textureLevelSize(format, mipExtent(width, level), mipExtent(height, level));
+        offset += header.level_sizes[level];
+    }
+
+    // Write to a temporary file and rename it over the old cache, so a crash never leaves a truncated cache behind
+    char tmp_path[PATH_MAX];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path) >= (int)sizeof(tmp_path)) {
+        stbi_image_free(pixels);
+        return false;
+    }
+    FILE* file = fopen(tmp_path, "wb");
+    if(!file) {
+        fprintf(stderr, "Error: Unable to open '%s' for writing: %s\n", tmp_path, strerror(errno));
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    static const uint8_t padding[TEXTURE_CACHE_PAYLOAD_ALIGNMENT] = {0};
+    uint8_t* level_pixels = pixels;
+    uint8_t* next_level_pixels = malloc((size_t)MAX(width / 2, 1u) * MAX(height / 2, 1u) * 4);
+    uint8_t* blocks = is_opaque ? malloc(header.level_sizes[0]) : NULL;
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(TextureCacheHeader);
+    for(uint32_t level = 0; level < mip_levels && success; level++) {
+        const uint32_t level_width = mipExtent(width, level);
+        const uint32_t level_height = mipExtent(height, level);
+        const size_t padding_size = header.level_offsets[level] - written;
+        success = fwrite(padding, 1, padding_size, file) == padding_size;
+
+        if(is_opaque) {
+            encodeBC1(level_pixels, level_width, level_height, blocks);
+            success = success && fwrite(blocks, 1, header.level_sizes[level], file) == header.level_sizes[level];
+        } else {
+            success = success && fwrite(level_pixels, 1, header.level_sizes[level], file) == header.level_sizes[level];
+        }
+        written = header.level_offsets[level] + header.level_sizes[level];
+
+        if(level + 1 < mip_levels) {
+            downsampleRGBA8(level_pixels, level_width, level_height, next_level_pixels);
+            // Ping-pong between the two buffers, the first level still lives in stbi's allocation
+            uint8_t* previous = level_pixels;
+            level_pixels = next_level_pixels;
+            next_level_pixels = (previous == pixels) ? malloc((size_t)MAX(width / 4, 1u) * MAX(height / 4, 1u) * 4) : previous;
+        }
+    }
+    success = (fclose(file) == 0) && success;
+    if(level_pixels != pixels) free(level_pixels);
+    free(next_level_pixels);
+    free(blocks);
+    stbi_image_free(pixels);
+
+    if(!success || rename(tmp_path, cache_path) != 0) {
+        fprintf(stderr, "Error: Failed to write texture cache '%s': %s\n", cache_path, strerror(errno));
+        remove(tmp_path);
+        return false;
+    }
+    printf("Baked '%s' into '%s' (%ux%u, %u mips, %s).\n", image_path, cache_path, width, height, mip_levels, is_opaque ? "BC1" : "RGBA8");
+    return true;
+}
+
+// Maps the cache file and validates its header, returns false if the file is missing, truncated or outdated
+bool mapTextureCache(const char* cache_path, BakedTexture* out_texture) {
+    FileView cache_file;
+    if(!FileView_open(cache_path, &cache_file)) return false;
+    const size_t file_size = cache_file.size;
+    if(file_size < sizeof(TextureCacheHeader)) {
+        FileView_close(&cache_file);
+        return false;
+    }
+
+    const TextureCacheHeader* header = (const TextureCacheHeader*)cache_file.data;
+    bool header_is_valid =
+        header->magic == TEXTURE_CACHE_MAGIC &&
+        header->version == TEXTURE_CACHE_VERSION &&
+        (header->format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || header->format == VK_FORMAT_R8G8B8A8_SRGB) &&
+        header->width > 0 && header->height > 0 &&
+        header->mip_levels > 0 && header->mip_levels <= TEXTURE_CACHE_MAX_MIP_LEVELS &&
+        header->mip_levels <= calculate_mip_levels(header->width, header->height);
+    for(uint32_t level = 0; header_is_valid && level < header->mip_levels; level++) {
+        const uint32_t level_width = mipExtent(header->width, level);
+        const uint32_t level_height = mipExtent(header->height, level);
+        header_is_valid =
+            header->level_sizes[level] == textureLevelSize(header->format, level_width, level_height) &&
+            header->level_offsets[level] % TEXTURE_CACHE_PAYLOAD_ALIGNMENT == 0 &&
+            header->level_offsets[level] + header->level_sizes[level] <= file_size;
+    }
+    if(!header_is_valid) {
+        fprintf(stderr, "Texture cache '%s' has an invalid or outdated header.\n", cache_path);
+        FileView_close(&cache_file);
+        return false;
+    }
+
+    out_texture->format = (VkFormat)header->format;
+    out_texture->width = header->width;
+    out_texture->height = header->height;
+    out_texture->mip_levels = header->mip_levels;
+    for(uint32_t level = 0; level < header->mip_levels; level++) {
+        out_texture->levels[level] = cache_file.data + header->level_offsets[level];
+        out_texture->level_sizes[level] = header->level_sizes[level];
+    }
+    out_texture->file = cache_file;
+    return true;
+}
+
+void unmapTexture(BakedTexture* texture) {
+    FileView_close(&texture->file);
+    memset(texture->levels, 0, sizeof(texture->levels));
+}
+
+// Loads the texture behind image_path through its baked cache, (re)baking the cache first if it is missing or stale.
+// Unlike loadMesh this runs on the streaming workers, so failures are reported instead of PANICing.
+//@DS:NEEDS_FREE_AFTER_USE (unmapTexture)
+bool loadBakedTexture(const char* image_path, BakedTexture* out_texture) {
+    char cache_path[PATH_MAX];
+    getTextureCachePath(image_path, cache_path, sizeof(cache_path));
+
+    struct stat image_stat;
+    struct stat cache_stat;
+    const bool has_image = stat(image_path, &image_stat) == 0;
+    const bool has_cache = stat(cache_path, &cache_stat) == 0;
+    if(!has_image && !has_cache) {
+        fprintf(stderr, "Error: Neither '%s' nor its texture cache '%s' exist.\n", image_path, cache_path);
+        return false;
+    }
+
+    // Equal timestamps are treated as stale as well, st_mtime only has second granularity
+    bool did_rebake = false;
+    if(has_image && (!has_cache || cache_stat.st_mtime <= image_stat.st_mtime)) {
+        printf("Texture cache '%s' is missing or older than '%s', rebaking it.\n", cache_path, image_path);
+        if(!bakeTexture(image_path, cache_path)) return false;
+        did_rebake = true;
+    }
+
+    if(mapTextureCache(cache_path, out_texture)) return true;
+    if(!has_image || did_rebake) return false;
+
+    printf("Rebaking unusable texture cache '%s'.\n", cache_path);
+    return bakeTexture(image_path, cache_path) && mapTextureCache(cache_path, out_texture);
+}
+
+/*
+ * Texture streaming
+ *
+ * Textures are requested by path and show up once they are ready, until then the 1x1 fallback texture is bound.
+ *   1. A worker of g_texture_streaming_pool loads the baked texture (baking it first if needed) and copies all of
+ *      its mips into the persistently mapped staging ring, transcoding BC1 to RGBA8 if the device can't sample BC1.
+ *   2. updateTextureStreaming (main thread, once per frame) records the copy of every mip on the transfer queue,
+ *      releases the image to the graphics family and signals g_transfer_timeline.
+ *   3. Once the transfer timeline has passed that value the graphics queue acquires the image and signals
+ *      g_streaming_graphics_timeline. If both queues share a family there is nothing to acquire and the texture is
+ *      ready right away.
+ * At no point does the CPU wait on the GPU, the timeline values are only ever polled.
+ */
+#define TEXTURE_STREAMING_NUM_WORKERS 2
+#define TEXTURE_STREAMING_STAGING_SIZE (64u << 20)
+#define TEXTURE_STREAMING_STAGING_ALIGNMENT 16
+#define TEXTURE_STREAMING_MAX_TEXTURES 256
+
+typedef enum {
+    STREAMED_TEXTURE_QUEUED,
+    STREAMED_TEXTURE_DECODED,   // Pixels are in the staging ring, the upload still has to be submitted
+    STREAMED_TEXTURE_UPLOADING, // Copy is submitted to the transfer queue
+    STREAMED_TEXTURE_READY,     // Acquired by the graphics queue, can be bound by any later submission
+    STREAMED_TEXTURE_FAILED,
+} StreamedTextureState;
+
+typedef struct {
+    char path[PATH_MAX];
+    StreamedTextureState state; // Only accessed atomically, the worker publishes its results with the DECODED store
+
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    VkDeviceSize level_offsets[TEXTURE_CACHE_MAX_MIP_LEVELS]; // Into the staging ring
+    uint32_t staging_allocation;
+
+    VkImage image;
+    GpuAllocation image_allocation;
+    VkImageView image_view;
+    VkCommandBuffer transfer_command_buffer;
+    VkCommandBuffer graphics_command_buffer;
+    uint64_t transfer_timeline_value;
+    uint64_t graphics_timeline_value;
+} StreamedTexture;
+
+typedef struct {
+    VkDeviceSize start;  // Where the region owned by this allocation starts, including alignment and wrap padding
+    VkDeviceSize end;
+    bool is_retired;
+} StagingRingAllocation;
+
+// Persistently mapped upload buffer, allocations are handed out by the workers and retired in any order by the
+// main thread, the space is only reclaimed in allocation order though.
+typedef struct {
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    char* mapped;
+    VkDeviceSize size;
+    VkDeviceSize head;
+
+    StagingRingAllocation allocations[TEXTURE_STREAMING_MAX_TEXTURES]; // Circular FIFO in allocation order
+    uint32_t first_allocation;
+    uint32_t num_allocations;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t space_available;
+    bool is_shutting_down;
+} StagingRing;
+
+// Blocks until `size` bytes are free, returns false if the request can never be satisfied or we are shutting down
+bool StagingRing_allocate(StagingRing* ring, const VkDeviceSize size, VkDeviceSize* out_offset, uint32_t* out_allocation) {
+    if(size > ring->size) return false;
+
+    pthread_mutex_lock(&ring->mutex);
+    while(!ring->is_shutting_down) {
+        const VkDeviceSize aligned_head = (ring->head + TEXTURE_STREAMING_STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(TEXTURE_STREAMING_STAGING_ALIGNMENT - 1);
+        VkDeviceSize offset = VK_WHOLE_SIZE;
+        if(ring->num_allocations == TEXTURE_STREAMING_MAX_TEXTURES) {
+            offset = VK_WHOLE_SIZE;
+        } else if(ring->num_allocations == 0) {
+            ring->head = 0;
+            offset = 0;
+        } else {
+            const VkDeviceSize tail = ring->allocations[ring->first_allocation].start;
+            if(ring->head > tail) {
+                if(aligned_head + size <= ring->size) offset = aligned_head;
+                else if(size <= tail) offset = 0; // Wrap around, the rest of the buffer is skipped
+            } else if(ring->head < tail && aligned_head + size <= tail) {
+                offset = aligned_head;
+            }
+        }
+
+        if(offset != VK_WHOLE_SIZE) {
+            const uint32_t allocation = (ring->first_allocation + ring->num_allocations) % TEXTURE_STREAMING_MAX_TEXTURES;
+            ring->allocations[allocation] = (StagingRingAllocation){.start = ring->head, .end = offset + size, .is_retired = false};
+            ring->num_allocations++;
+            ring->head = offset + size;
+            pthread_mutex_unlock(&ring->mutex);
+            *out_offset = offset;
+            *out_allocation = allocation;
+            return true;
+        }
+        pthread_cond_wait(&ring->space_available, &ring->mutex);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return false;
+}
+
+void StagingRing_retire(StagingRing* ring, const uint32_t allocation) {
+    pthread_mutex_lock(&ring->mutex);
+    ring->allocations[allocation].is_retired = true;
+    while(ring->num_allocations > 0 && ring->allocations[ring->first_allocation].is_retired) {
+        ring->first_allocation = (ring->first_allocation + 1) % TEXTURE_STREAMING_MAX_TEXTURES;
+        ring->num_allocations--;
+    }
+    pthread_cond_broadcast(&ring->space_available);
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+ThreadPool g_texture_streaming_pool;
+StagingRing g_staging_ring;
+StreamedTexture g_streamed_textures[TEXTURE_STREAMING_MAX_TEXTURES];
+uint32_t g_num_streamed_textures = 0;
+
+VkCommandPool g_transfer_command_pool = VK_NULL_HANDLE;
+VkSemaphore g_transfer_timeline = VK_NULL_HANDLE;
+uint64_t g_transfer_timeline_value = 0;
+VkSemaphore g_streaming_graphics_timeline = VK_NULL_HANDLE;
+uint64_t g_streaming_graphics_timeline_value = 0;
+
+// Whether baked BC1 textures can be uploaded as they are, decided once the device exists
+bool g_supports_bc1_textures = false;
+
+// Bumped whenever a texture becomes ready, every frame in flight refreshes its descriptors when it falls behind
+uint64_t g_texture_generation = 0;
+uint64_t g_frame_texture_generation[MAX_FRAMES_IN_FLIGHT];
+
+VkSemaphore createTimelineSemaphore() {
+    const VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0};
+    const VkSemaphoreCreateInfo semaphoreInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo};
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if(vkCreateSemaphore(g_device, &semaphoreInfo, NULL, &semaphore) != VK_SUCCESS) PANIC("failed to create timeline semaphore!");
+    return semaphore;
+}
+
+void createTextureStreaming() {
+    createBuffer(
+        TEXTURE_STREAMING_STAGING_SIZE,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &g_staging_ring.buffer,
+        &g_staging_ring.allocation);
+    g_staging_ring.mapped = g_staging_ring.allocation.mapped;
+    g_staging_ring.size = TEXTURE_STREAMING_STAGING_SIZE;
+    pthread_mutex_init(&g_staging_ring.mutex, NULL);
+    pthread_cond_init(&g_staging_ring.space_available, NULL);
+
+    const VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = g_transfer_queue_family};
+    if(vkCreateCommandPool(g_device, &poolInfo, NULL, &g_transfer_command_pool) != VK_SUCCESS) PANIC("Failed to create transfer command pool!");
+
+    g_transfer_timeline = createTimelineSemaphore();
+    g_streaming_graphics_timeline = createTimelineSemaphore();
+
+    VkFormatProperties bc1_properties;
+    vkGetPhysicalDeviceFormatProperties(g_physical_device, VK_FORMAT_BC1_RGB_SRGB_BLOCK, &bc1_properties);
+    const VkFormatFeatureFlags required_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    g_supports_bc1_textures = g_texture_compression_bc_enabled && (bc1_properties.optimalTilingFeatures & required_features) == required_features;
+    printf("BC1 textures are %s.\n", g_supports_bc1_textures ? "uploaded as they are" : "transcoded to RGBA8 on the CPU");
+
+    initSrgbToLinearTable();
+
+    ThreadPool_create(&g_texture_streaming_pool, "Texture streaming", TEXTURE_STREAMING_NUM_WORKERS);
+}
+
+void decodeStreamedTextureJob(void* user_data) {
+    TRACE_FUNCTION();
+    StreamedTexture* texture = user_data;
+
+    BakedTexture baked;
+    if(!loadBakedTexture(texture->path, &baked)) {
+        fprintf(stderr, "Error: Failed to load texture '%s'.\n", texture->path);
+        __atomic_store_n(&texture->state, STREAMED_TEXTURE_FAILED, __ATOMIC_RELEASE);
+        return;
+    }
+    const bool needs_transcode = baked.format == VK_FORMAT_BC1_RGB_SRGB_BLOCK && !g_supports_bc1_textures;
+    const VkFormat upload_format = needs_transcode ? VK_FORMAT_R8G8B8A8_SRGB : baked.format;
+
+    // All mips go into one allocation, every level starts aligned for vkCmdCopyBufferToImage
+    VkDeviceSize total_size = 0;
+    for(uint32_t level = 0; level < baked.mip_levels; level++) {
+        total_size = (total_size + TEXTURE_STREAMING_STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(TEXTURE_STREAMING_STAGING_ALIGNMENT - 1);
+        texture->level_offsets[level] = total_size;
+        total_size += textureLevelSize(upload_format, mipExtent(baked.width, level), mipExtent(baked.height, level));
+    }
+
+    VkDeviceSize staging_offset = 0;
+    if(!StagingRing_allocate(&g_staging_ring, total_size, &staging_offset, &texture->staging_allocation)) {
+        fprintf(stderr, "Error: Texture '%s' (%llu bytes) doesn't fit into the staging ring.\n", texture->path, (unsigned long long)total_size);
+        unmapTexture(&baked);
+        __atomic_store_n(&texture->state, STREAMED_TEXTURE_FAILED, __ATOMIC_RELEASE);
+        return;
+    }
+    for(uint32_t level = 0; level < baked.mip_levels; level++) {
+        texture->level_offsets[level] += staging_offset;
+        char* destination = g_staging_ring.mapped + texture->level_offsets[level];
+        if(needs_transcode) decodeBC1(baked.levels[level], mipExtent(baked.width, level), mipExtent(baked.height, level), (uint8_t*)destination);
+        else memcpy(destination, baked.levels[level], baked.level_sizes[level]);
+    }
+
+    texture->format = upload_format;
+    texture->width = baked.width;
+    texture->height = baked.height;
+    texture->mip_levels = baked.mip_levels;
+    unmapTexture(&baked);
+    __atomic_store_n(&texture->state, STREAMED_TEXTURE_DECODED, __ATOMIC_RELEASE);
+}
+
+// Queues the texture for decoding and returns its handle right away
+uint32_t requestTexture(const char* path) {
+    if(g_num_streamed_textures == TEXTURE_STREAMING_MAX_TEXTURES) PANIC("Exceeded TEXTURE_STREAMING_MAX_TEXTURES");
+    const uint32_t handle = g_num_streamed_textures++;
+    StreamedTexture* texture = &g_streamed_textures[handle];
+    memset(texture, 0, sizeof(StreamedTexture));
+    if(snprintf(texture->path, sizeof(texture->path), "%s", path) >= (int)sizeof(texture->path)) PANIC("Texture path '%s' is too long", path);
+    texture->state = STREAMED_TEXTURE_QUEUED;
+
+    ThreadPool_submit(&g_texture_streaming_pool, decodeStreamedTextureJob, texture);
+    return handle;
+}
+
+// Returns the view of a streamed texture, or the fallback texture as long as it isn't ready
+VkImageView getTextureImageView(const uint32_t handle) {
+    if(handle >= g_num_streamed_textures) return g_texture_image_view;
+    const StreamedTexture* texture = &g_streamed_textures[handle];
+    if(__atomic_load_n(&texture->state, __ATOMIC_ACQUIRE) != STREAMED_TEXTURE_READY) return g_texture_image_view;
+    return texture->image_view;
+}
+
+VkImageMemoryBarrier createOwnershipTransferBarrier(const StreamedTexture* texture) {
+    const VkImageMemoryBarrier barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = image,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = g_transfer_queue_family,
+        .dstQueueFamilyIndex = g_graphics_queue_family,
+        .image = texture->image,
         .subresourceRange = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .levelCount = 1,
+            .baseMipLevel = 0,
+            .levelCount = texture->mip_levels,
             .baseArrayLayer = 0,
-            .layerCount = 1},
-    };
+            .layerCount = 1}};
+    return barrier;
+}
+
+// Records and submits the staging ring -> image copy of all mips on the transfer queue
+void submitTextureUpload(StreamedTexture* texture) {
+    createImage(
+        texture->width,
+        texture->height,
+        texture->mip_levels,
+        VK_SAMPLE_COUNT_1_BIT,
+        texture->format,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &texture->image,
+        &texture->image_allocation);
+
+    const VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = g_transfer_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1};
+    if(vkAllocateCommandBuffers(g_device, &allocInfo, &texture->transfer_command_buffer) != VK_SUCCESS) PANIC("failed to allocate transfer command buffer!");
+    VkCommandBuffer commandBuffer = texture->transfer_command_buffer;
+
+    const VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    VkImageMemoryBarrier barrier = createOwnershipTransferBarrier(texture);
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+    VkBufferImageCopy regions[TEXTURE_CACHE_MAX_MIP_LEVELS];
+    for(uint32_t level = 0; level < texture->mip_levels; level++) {
+        regions[level] = (VkBufferImageCopy){
+            .bufferOffset = texture->level_offsets[level],
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = level, .baseArrayLayer = 0, .layerCount = 1},
+            .imageOffset = {.x = 0, .y = 0, .z = 0},
+            .imageExtent = {.width = mipExtent(texture->width, level), .height = mipExtent(texture->height, level), .depth = 1}};
+    }
+    vkCmdCopyBufferToImage(commandBuffer, g_staging_ring.buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, texture->mip_levels, regions);
 
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++) {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0,
-            NULL,
-            0,
-            NULL,
-            1,
-            &barrier);
-
-        VkImageBlit blit = {
-            .srcSubresource = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .mipLevel = i - 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1
-            },
-            .srcOffsets = {
-                { .x = 0, .y = 0, .z = 0 },
-                { .x = mipWidth, .y = mipHeight, .z = 1 }
-            },
-            .dstSubresource = {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .mipLevel = i,
-                .baseArrayLayer = 0,
-                .layerCount = 1
-            },
-            .dstOffsets = {
-                { .x = 0, .y = 0, .z = 0 },
-                { .x = (mipWidth > 1 ? mipWidth / 2 : 1), .y = (mipHeight > 1 ? mipHeight / 2 : 1), .z = 1 }
-            }
-        };
-
-        vkCmdBlitImage(
-            commandBuffer,
-            image,
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &blit,
-            VK_FILTER_LINEAR);
+    // Release half of the queue family ownership transfer, the graphics queue performs the matching acquire.
+    // Without a family change this is a plain transition, the graphics queue only samples after the timeline wait.
+    barrier = createOwnershipTransferBarrier(texture);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    if(g_transfer_queue_family == g_graphics_queue_family) {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record texture upload!");
+
+    texture->transfer_timeline_value = ++g_transfer_timeline_value;
+    const VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &texture->transfer_timeline_value};
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &g_transfer_timeline};
+    if(vkQueueSubmit(g_transfer_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) PANIC("failed to submit texture upload!");
 
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    __atomic_store_n(&texture->state, STREAMED_TEXTURE_UPLOADING, __ATOMIC_RELEASE);
+}
+
+// Acquires the uploaded image on the graphics queue. Without a family change there is nothing to record, the
+// submission then only makes every later graphics submission wait for the copy.
+void submitTextureAcquire(StreamedTexture* texture) {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    if(g_transfer_queue_family != g_graphics_queue_family) {
+        const VkCommandBufferAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = g_command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1};
+        if(vkAllocateCommandBuffers(g_device, &allocInfo, &texture->graphics_command_buffer) != VK_SUCCESS) PANIC("failed to allocate command buffer!");
+        commandBuffer = texture->graphics_command_buffer;
+
+        const VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        VkImageMemoryBarrier barrier = createOwnershipTransferBarrier(texture);
+        barrier.srcAccessMask = 0;
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+        if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record texture acquire!");
+    }
 
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            0,
-            0,
-            NULL,
-            0,
-            NULL,
-            1,
-            &barrier);
+    // The transfer timeline already passed this value, the wait only orders the two queues
+    texture->graphics_timeline_value = ++g_streaming_graphics_timeline_value;
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    const VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &texture->transfer_timeline_value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &texture->graphics_timeline_value};
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &g_transfer_timeline,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = commandBuffer != VK_NULL_HANDLE ? 1 : 0,
+        .pCommandBuffers = &commandBuffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &g_streaming_graphics_timeline};
+    if(vkQueueSubmit(g_graphics_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) PANIC("failed to submit texture acquire!");
 
-        if(mipWidth > 1) mipWidth /= 2;
-        if(mipHeight > 1) mipHeight /= 2;
+    texture->image_view = createImageView(texture->image, texture->format, VK_IMAGE_ASPECT_COLOR_BIT, texture->mip_levels);
+    __atomic_store_n(&texture->state, STREAMED_TEXTURE_READY, __ATOMIC_RELEASE);
+    g_texture_generation++;
+    printf("Streamed in texture '%s' (%ux%u, %u mips).\n", texture->path, texture->width, texture->height, texture->mip_levels);
+}
+
+// Advances every in-flight texture by as many steps as the GPU allows without waiting, called once per frame
+void updateTextureStreaming() {
+    TRACE_FUNCTION();
+    uint64_t completed_transfer_value = 0;
+    uint64_t completed_graphics_value = 0;
+    vkGetSemaphoreCounterValue(g_device, g_transfer_timeline, &completed_transfer_value);
+    vkGetSemaphoreCounterValue(g_device, g_streaming_graphics_timeline, &completed_graphics_value);
+
+    for(uint32_t i = 0; i < g_num_streamed_textures; i++) {
+        StreamedTexture* texture = &g_streamed_textures[i];
+        const StreamedTextureState state = __atomic_load_n(&texture->state, __ATOMIC_ACQUIRE);
+        if(state == STREAMED_TEXTURE_DECODED) {
+            submitTextureUpload(texture);
+        } else if(state == STREAMED_TEXTURE_UPLOADING && texture->transfer_timeline_value <= completed_transfer_value) {
+            StagingRing_retire(&g_staging_ring, texture->staging_allocation);
+            vkFreeCommandBuffers(g_device, g_transfer_command_pool, 1, &texture->transfer_command_buffer);
+            texture->transfer_command_buffer = VK_NULL_HANDLE;
+            submitTextureAcquire(texture);
+        } else if(state == STREAMED_TEXTURE_READY && texture->graphics_command_buffer != VK_NULL_HANDLE && texture->graphics_timeline_value <= completed_graphics_value) {
+            vkFreeCommandBuffers(g_device, g_command_pool, 1, &texture->graphics_command_buffer);
+            texture->graphics_command_buffer = VK_NULL_HANDLE;
+        }
     }
+}
 
-    // Need to specifically handle the last mipMap, as the don't blit from it that is not handled in the loop
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+// Expects the device to be idle
+void destroyTextureStreaming() {
+    pthread_mutex_lock(&g_staging_ring.mutex);
+    g_staging_ring.is_shutting_down = true;
+    pthread_cond_broadcast(&g_staging_ring.space_available);
+    pthread_mutex_unlock(&g_staging_ring.mutex);
+    ThreadPool_destroy(&g_texture_streaming_pool);
+
+    for(uint32_t i = 0; i < g_num_streamed_textures; i++) {
+        StreamedTexture* texture = &g_streamed_textures[i];
+        if(texture->image_view != VK_NULL_HANDLE) vkDestroyImageView(g_device, texture->image_view, NULL);
+        if(texture->image != VK_NULL_HANDLE) vkDestroyImage(g_device, texture->image, NULL);
+        GpuAllocator_free(&texture->image_allocation);
+        memset(texture, 0, sizeof(StreamedTexture));
+    }
+    g_num_streamed_textures = 0;
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        0,
-        0,
-        NULL,
-        0,
-        NULL,
-        1,
-        &barrier);
+    vkDestroySemaphore(g_device, g_streaming_graphics_timeline, NULL); g_streaming_graphics_timeline = VK_NULL_HANDLE;
+    vkDestroySemaphore(g_device, g_transfer_timeline, NULL); g_transfer_timeline = VK_NULL_HANDLE;
+    vkDestroyCommandPool(g_device, g_transfer_command_pool, NULL); g_transfer_command_pool = VK_NULL_HANDLE;
 
-    endSingleTimeCommands(commandBuffer);
+    vkDestroyBuffer(g_device, g_staging_ring.buffer, NULL);
+    GpuAllocator_free(&g_staging_ring.allocation);
+    pthread_cond_destroy(&g_staging_ring.space_available);
+    pthread_mutex_destroy(&g_staging_ring.mutex);
+    memset(&g_staging_ring, 0, sizeof(StagingRing));
 }
 
+// 1x1 texture that is bound until the real textures have been streamed in, uploaded synchronously during init
 void createTextureImage() {
-    const char* texture_fp = "./assets/textures/painted_plaster_diffuse.png";
-    if(!file_exists(texture_fp)) PANIC("Texture file not found at '%s'", texture_fp);
-
-    int texWidth = 0;
-    int texHeight = 0;
-    int texChannels = 0;
-    stbi_uc *pixels = stbi_load(texture_fp, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    if(!pixels) PANIC("Failed to load texture image!");
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-    // m_MipLevels = How often we can divide max(width, height) by 2, could also take the ceil here instead of floor + 1
-    g_mip_levels = calculate_mip_levels(texWidth, texHeight);
+    const uint8_t fallback_pixel[4] = {128, 128, 128, 255};
+    const VkDeviceSize imageSize = sizeof(fallback_pixel);
+    g_mip_levels = 1;
 
     VkBuffer stagingBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+    GpuAllocation stagingBufferAllocation;
     createBuffer(
         imageSize,
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         &stagingBuffer,
-        &stagingBufferMemory);
-
-    void *data = NULL;
-    vkMapMemory(g_device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, imageSize);
-
-    vkUnmapMemory(g_device, stagingBufferMemory);
-    stbi_image_free(pixels);
+        &stagingBufferAllocation);
+    memcpy(stagingBufferAllocation.mapped, fallback_pixel, imageSize);
 
     createImage(
-        texWidth,
-        texHeight,
+        1,
+        1,
         g_mip_levels,
         VK_SAMPLE_COUNT_1_BIT,
         VK_FORMAT_R8G8B8A8_SRGB,
         VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         &g_texture_image,
-        &g_texture_image_memory);
+        &g_texture_image_allocation);
     transitionImageLayout(
         g_texture_image,
         VK_FORMAT_R8G8B8A8_SRGB,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         g_mip_levels);
-    copyBufferToImage(
-        stagingBuffer,
+    copyBufferToImage(stagingBuffer, g_texture_image, 1, 1);
+    transitionImageLayout(
         g_texture_image,
-        texWidth,
-        texHeight);
+        VK_FORMAT_R8G8B8A8_SRGB,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        g_mip_levels);
 
     vkDestroyBuffer(g_device, stagingBuffer, NULL);
-    vkFreeMemory(g_device, stagingBufferMemory, NULL);
-
-    generateMipmaps(g_texture_image, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, g_mip_levels);
+    GpuAllocator_free(&stagingBufferAllocation);
 }
 
+#define FRAME_UNIFORM_RING_SIZE (1u << 20) // Room for ~4000 draws per frame
+
 void createUniformBuffers() {
-    const size_t num_models = NUM_MODELS;
-    const size_t total_buffers = MAX_FRAMES_IN_FLIGHT * num_models;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(g_physical_device, &properties);
+    g_uniform_offset_alignment = MAX(properties.limits.minUniformBufferOffsetAlignment, (VkDeviceSize)1);
+
+    for (size_t i = 0; i < g_frames_in_flight; i++) {
+        FrameUniformRing* ring = &g_frame_uniform_rings[i];
+        createBuffer(
+            FRAME_UNIFORM_RING_SIZE,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &ring->buffer,
+            &ring->allocation);
+        ring->mapped = ring->allocation.mapped;
+        ring->size = FRAME_UNIFORM_RING_SIZE;
+    }
+}
+
+void cleanupUniformBuffers() {
+    for (size_t i = 0; i < g_frames_in_flight; i++) {
+        vkDestroyBuffer(g_device, g_frame_uniform_rings[i].buffer, NULL);
+        GpuAllocator_free(&g_frame_uniform_rings[i].allocation);
+        memset(&g_frame_uniform_rings[i], 0, sizeof(FrameUniformRing));
+    }
+}
 
-    g_uniform_buffers = malloc(total_buffers * sizeof(VkBuffer));
-    g_uniform_buffers_memory = malloc(total_buffers * sizeof(VkDeviceMemory));
-    g_uniform_buffers_mapped = malloc(total_buffers * sizeof(void*));
+// Dynamic offset of the UniformBufferObject of draw list item `item`, they follow the culling slots
+uint32_t getDrawUniformOffset(const uint32_t item) {
+    return (uint32_t)(getCullingUniformOffset(CULLING_MAX_BATCHES) + item * alignUniformSize(sizeof(UniformBufferObject)));
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        for (size_t j = 0; j < num_models; j++) {
-            const VkDeviceSize buffer_size = sizeof(UniformBufferObject);
-            const size_t bufferIndex = i * num_models + j;
-            createBuffer(
-                buffer_size,
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                &g_uniform_buffers[bufferIndex],
-                &g_uniform_buffers_memory[bufferIndex]
-            );
-            const VkResult result = vkMapMemory(
-                g_device,
-                g_uniform_buffers_memory[bufferIndex],
-                0,
-                buffer_size,
-                0,
-                &g_uniform_buffers_mapped[bufferIndex]
-            );
-            if(result != VK_SUCCESS) PANIC("failed to map uniform buffer memory!");
-        }
+// Only call once the frame's fence has been waited on, the GPU may still read last round's data until then.
+// Distinct items may be written from several recording threads at once.
+uint32_t FrameUniformRing_writeDrawUniforms(FrameUniformRing* ring, const uint32_t item, const UniformBufferObject* ubo) {
+    const uint32_t offset = getDrawUniformOffset(item);
+    if(offset + sizeof(UniformBufferObject) > ring->size) PANIC("Frame uniform ring overflow, FRAME_UNIFORM_RING_SIZE (%u bytes) is too small", FRAME_UNIFORM_RING_SIZE);
+    memcpy(ring->mapped + offset, ubo, sizeof(UniformBufferObject));
+    return offset;
+}
+
+// One set per frame in flight, shared by all draws of that frame, the per object data is selected by the dynamic offset
+void createDescriptorSets() {
+    const size_t total_sets = g_frames_in_flight;
+
+    // Their texture binding is rewritten as textures stream in, so they can't be shared through the descriptor cache
+    g_num_descriptor_sets = total_sets;
+    g_descriptor_sets = malloc(g_num_descriptor_sets * sizeof(VkDescriptorSet));
+    for(size_t i = 0; i < total_sets; i++) g_descriptor_sets[i] = DescriptorAllocator_allocate(&g_descriptor_allocator, g_descriptor_set_layout);
+
+    for (size_t i = 0; i < g_frames_in_flight; i++) {
+        VkDescriptorBufferInfo bufferInfo = {
+            .buffer = g_frame_uniform_rings[i].buffer,
+            .offset = 0,
+            .range = sizeof(UniformBufferObject)};
+
+        VkDescriptorImageInfo imageInfo = {
+            .sampler = g_texture_sampler,
+            .imageView = getTextureImageView(g_diffuse_texture),
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+        VkWriteDescriptorSet descriptorWrites[2];
+        descriptorWrites[0] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_descriptor_sets[i],
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .pBufferInfo = &bufferInfo};
+        descriptorWrites[1] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_descriptor_sets[i],
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &imageInfo};
+
+        vkUpdateDescriptorSets(g_device, 2, descriptorWrites, 0, NULL);
     }
 }
 
-void cleanupUniformBuffers() {
-    const size_t num_models = NUM_MODELS;
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        for (size_t j = 0; j < num_models; j++) {
-            const size_t buffer_index = i * num_models + j;
-            vkDestroyBuffer(g_device, g_uniform_buffers[buffer_index], NULL);
-            vkFreeMemory(g_device, g_uniform_buffers_memory[buffer_index], NULL);
-        }
+// Points the texture binding of this frame's descriptor set at whatever is streamed in by now.
+// Must only be called once the frame's fence has been waited on, the set may not be in use.
+void updateFrameTextureDescriptors(const uint32_t frame_idx) {
+    if(g_frame_texture_generation[frame_idx] == g_texture_generation) return;
+    g_frame_texture_generation[frame_idx] = g_texture_generation;
+    g_command_cache_generation++; // Updating a bound descriptor set invalidates the command buffers using it
+
+    const VkDescriptorImageInfo imageInfo = {
+        .sampler = g_texture_sampler,
+        .imageView = getTextureImageView(g_diffuse_texture),
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+    const VkWriteDescriptorSet descriptorWrite = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = g_descriptor_sets[frame_idx],
+        .dstBinding = 1,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &imageInfo};
+    vkUpdateDescriptorSets(g_device, 1, &descriptorWrite, 0, NULL);
+}
+
+/*
+ * Bindless descriptors
+ *
+ * Instanced models drawn by the bindless pipeline don't bind a texture per draw. Set 1 holds one large sampler2D[]
+ * with the fallback texture in slot 0 and every streamed texture in the slot after it, plus the storage buffer of
+ * per object records (InstanceData) that gl_InstanceIndex points into. A record names its texture slot, so instances
+ * with different textures still end up in the same draw. The set is created with UPDATE_AFTER_BIND, writing a slot
+ * doesn't invalidate command buffers that bound it, and only slots whose image view actually changed are written.
+ */
+#if TEXTURE_STREAMING_MAX_TEXTURES >= BINDLESS_MAX_TEXTURES
+#error "Every streamed texture needs a bindless slot, raise BINDLESS_MAX_TEXTURES"
+#endif
+
+VkImageView g_bindless_texture_views[MAX_FRAMES_IN_FLIGHT][BINDLESS_MAX_TEXTURES]; // What each slot was last written with
+uint64_t g_bindless_texture_generation[MAX_FRAMES_IN_FLIGHT];
+
+void writeBindlessTexture(const uint32_t frame_idx, const uint32_t slot, VkImageView image_view) {
+    const VkDescriptorImageInfo imageInfo = {
+        .sampler = g_texture_sampler,
+        .imageView = image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    const VkWriteDescriptorSet descriptorWrite = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = g_bindless_descriptor_sets[frame_idx],
+        .dstBinding = 0,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &imageInfo};
+    vkUpdateDescriptorSets(g_device, 1, &descriptorWrite, 0, NULL);
+    g_bindless_texture_views[frame_idx][slot] = image_view;
+}
+
+// Points the slots of this frame's bindless set at whatever is streamed in by now, one write per changed texture.
+// Must only be called once the frame's fence has been waited on, the slots may be in use otherwise.
+void updateBindlessTextures(const uint32_t frame_idx) {
+    if(!g_bindless_enabled || g_bindless_texture_generation[frame_idx] == g_texture_generation) return;
+    g_bindless_texture_generation[frame_idx] = g_texture_generation;
+
+    for(uint32_t handle = 0; handle < g_num_streamed_textures; handle++) {
+        const uint32_t slot = getBindlessTextureSlot(handle);
+        VkImageView image_view = getTextureImageView(handle);
+        if(g_bindless_texture_views[frame_idx][slot] != image_view) writeBindlessTexture(frame_idx, slot, image_view);
     }
 }
 
-void createDescriptorPool() {
-    const size_t num_models = NUM_MODELS;
-    const size_t total_sets = MAX_FRAMES_IN_FLIGHT * num_models;
+// Needs the fallback texture and the sampler. Slots of textures that aren't streamed in yet hold the fallback texture
+void createBindlessResources() {
+    if(!g_bindless_enabled) return;
 
-    VkDescriptorPoolSize poolSizes[] = {
-        { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER        , .descriptorCount = (uint32_t)total_sets },
-        { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = (uint32_t)total_sets }
-    };
+    createBuffer(
+        (VkDeviceSize)BINDLESS_MAX_OBJECTS * sizeof(InstanceData),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &g_object_record_buffer,
+        &g_object_record_buffer_allocation);
+    g_num_object_records = 0;
 
+    const VkDescriptorPoolSize poolSizes[2] = {
+        {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = BINDLESS_MAX_TEXTURES * g_frames_in_flight},
+        {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = g_frames_in_flight}};
     const VkDescriptorPoolCreateInfo poolInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
         .poolSizeCount = 2,
         .pPoolSizes = poolSizes,
-        .maxSets = (uint32_t)total_sets};
-
-    if (vkCreateDescriptorPool(g_device, &poolInfo, NULL, &g_descriptor_pool) != VK_SUCCESS) PANIC("failed to create descriptor pool!");
-}
-
-void createDescriptorSets() {
-    const size_t numModels = NUM_MODELS;
-    const size_t total_sets = MAX_FRAMES_IN_FLIGHT * numModels;
-
-    VkDescriptorSetLayout* layouts = malloc(total_sets * sizeof(VkDescriptorSetLayout));
-    for(size_t i = 0; i < total_sets; i++) layouts[i] = g_descriptor_set_layout;
+        .maxSets = g_frames_in_flight};
+    if(vkCreateDescriptorPool(g_device, &poolInfo, NULL, &g_bindless_descriptor_pool) != VK_SUCCESS) PANIC("failed to create bindless descriptor pool!");
 
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) layouts[i] = g_bindless_descriptor_set_layout;
     const VkDescriptorSetAllocateInfo allocInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = g_descriptor_pool,
-        .descriptorSetCount = (uint32_t)total_sets,
+        .descriptorPool = g_bindless_descriptor_pool,
+        .descriptorSetCount = g_frames_in_flight,
         .pSetLayouts = layouts};
-
-    g_num_descriptor_sets = total_sets;
-    g_descriptor_sets = malloc(g_num_descriptor_sets * sizeof(VkDescriptorSet));
-    if (vkAllocateDescriptorSets(g_device, &allocInfo, g_descriptor_sets) != VK_SUCCESS) PANIC("failed to allocate descriptor sets!");
-    free(layouts);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        for (size_t j = 0; j < numModels; j++) {
-            const size_t bufferIndex = i * numModels + j;
-            VkDescriptorBufferInfo bufferInfo = {
-                .buffer = g_uniform_buffers[bufferIndex],
-                .offset = 0,
-                .range = sizeof(UniformBufferObject)};
-
-            VkDescriptorImageInfo imageInfo = {
-                .sampler = g_texture_sampler,
-                .imageView = g_texture_image_view,
-                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-
-            VkWriteDescriptorSet descriptorWrites[2];
-            descriptorWrites[0] = (VkWriteDescriptorSet){
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = g_descriptor_sets[bufferIndex],
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pBufferInfo = &bufferInfo};
-            descriptorWrites[1] = (VkWriteDescriptorSet){
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = g_descriptor_sets[bufferIndex],
-                .dstBinding = 1,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                .pImageInfo = &imageInfo};
-
-            vkUpdateDescriptorSets(g_device, 2, descriptorWrites, 0, NULL);
-        }
+    if(vkAllocateDescriptorSets(g_device, &allocInfo, g_bindless_descriptor_sets) != VK_SUCCESS) PANIC("failed to allocate bindless descriptor sets!");
+
+    for(uint32_t i = 0; i < g_frames_in_flight; i++) {
+        const VkDescriptorBufferInfo recordInfo = {.buffer = g_object_record_buffer, .offset = 0, .range = VK_WHOLE_SIZE};
+        const VkWriteDescriptorSet descriptorWrite = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_bindless_descriptor_sets[i],
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &recordInfo};
+        vkUpdateDescriptorSets(g_device, 1, &descriptorWrite, 0, NULL);
+
+        memset(g_bindless_texture_views[i], 0, sizeof(g_bindless_texture_views[i]));
+        writeBindlessTexture(i, BINDLESS_FALLBACK_TEXTURE_SLOT, g_texture_image_view);
+        g_bindless_texture_generation[i] = UINT64_MAX; // Forces the first updateBindlessTextures to write every slot
+        updateBindlessTextures(i);
     }
 }
 
+void destroyBindlessResources() {
+    if(!g_bindless_enabled) return;
+    vkDestroyDescriptorPool(g_device, g_bindless_descriptor_pool, NULL); g_bindless_descriptor_pool = VK_NULL_HANDLE;
+    vkDestroyBuffer(g_device, g_object_record_buffer, NULL); g_object_record_buffer = VK_NULL_HANDLE;
+    GpuAllocator_free(&g_object_record_buffer_allocation);
+    g_num_object_records = 0;
+}
+
 void createCommandBuffers() {
-    g_num_command_buffers = MAX_FRAMES_IN_FLIGHT;
+    g_num_command_buffers = g_frames_in_flight;
     g_command_buffers = malloc(g_num_command_buffers * sizeof(VkCommandBuffer));
 
     const VkCommandBufferAllocateInfo allocInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = g_command_pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 2};
+        .commandBufferCount = g_num_command_buffers};
 
     if (vkAllocateCommandBuffers(g_device, &allocInfo, g_command_buffers) != VK_SUCCESS) PANIC("failed to allocate command buffers!");
 }
 
-void createSyncObjects() {
-    g_num_image_available_semaphores = MAX_FRAMES_IN_FLIGHT;
-    g_num_render_finished_semaphores = MAX_FRAMES_IN_FLIGHT;
-    g_num_in_flight_fences = MAX_FRAMES_IN_FLIGHT;
-
-    g_image_available_semaphores = malloc(g_num_image_available_semaphores * sizeof(VkSemaphore));
-    g_render_finished_semaphores = malloc(g_num_render_finished_semaphores * sizeof(VkSemaphore));
-    g_in_flight_fences = malloc(g_num_in_flight_fences * sizeof(VkFence));
+void createSyncObjects() {
+    g_num_image_available_semaphores = g_frames_in_flight;
+    g_num_render_finished_semaphores = g_frames_in_flight;
+    g_num_in_flight_fences = g_frames_in_flight;
+
+    g_image_available_semaphores = malloc(g_num_image_available_semaphores * sizeof(VkSemaphore));
+    g_render_finished_semaphores = malloc(g_num_render_finished_semaphores * sizeof(VkSemaphore));
+    g_in_flight_fences = malloc(g_num_in_flight_fences * sizeof(VkFence));
+
+    const VkSemaphoreCreateInfo semaphoreInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    const VkFenceCreateInfo fenceInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
+
+    for (size_t i = 0; i < g_frames_in_flight; i++) {
+        fprintf(stdout, "\t%zu. frame\n", i + 1);
+        const VkResult result_1 = vkCreateSemaphore(g_device, &semaphoreInfo, NULL, &g_image_available_semaphores[i]);
+        if (result_1 != VK_SUCCESS) PANIC("failed to create ImageAvailable semaphore!");
+        const VkResult result_2 = vkCreateSemaphore(g_device, &semaphoreInfo, NULL, &g_render_finished_semaphores[i]);
+        if (result_2 != VK_SUCCESS) PANIC("failed to create RenderFinished semaphore!");
+        const VkResult result_3 = vkCreateFence(g_device, &fenceInfo, NULL, &g_in_flight_fences[i]);
+        if (result_3 != VK_SUCCESS) PANIC("failed to create InFlight fence!");
+    }
+}
+
+void updatePushConstants() {
+    memcpy(g_push_constants.cameraCenter, g_camera_center, sizeof(vec3));
+    memcpy(g_push_constants.cameraEye, g_camera_eye, sizeof(vec3));
+    memcpy(g_push_constants.cameraUp, g_camera_up, sizeof(vec3));
+    g_push_constants.stage = g_rendering_stage;
+
+    // Get current time using clock() from <time.h>
+    const clock_t current_time = clock();
+
+    // Compute delta time in seconds (clock() returns time in clock ticks)
+    const float delta_time = (float)(current_time - g_start_time) / CLOCKS_PER_SEC;
+
+    // Store deltaTime in push constants
+    g_push_constants.time = delta_time;
+}
+
+// Camera matrices shared by the UBO and the frustum culling
+void getViewProjection(mat4 view, mat4 proj) {
+    glm_lookat(g_camera_eye, g_camera_center, g_camera_up, view);
+
+    glm_perspective(PI_QUARTER, (float)(g_swap_chain_extent.width) / (float)(g_swap_chain_extent.height),
+                    CLIPPING_PLANE_NEAR, CLIPPING_PLANE_FAR, proj);
+    proj[1][1] *= -1; // Vulkan and OpenGL have opposite y orientation, and (c)glm is mainly written for openGL
+}
+
+// World space planes of the camera frustum, normalized with their normals pointing inwards
+void getFrustumPlanes(vec4 out_planes[6]) {
+    mat4 view, proj, view_proj;
+    getViewProjection(view, proj);
+    glm_mat4_mul(proj, view, view_proj);
+    glm_frustum_planes(view_proj, out_planes);
+}
+
+#define LOD_MAX_SCREEN_ERROR 1.0f // Pixels a simplified mesh may deviate on screen before a finer LOD is picked
+
+// Pixels one unit covers at distance one, divided by LOD_MAX_SCREEN_ERROR.
+// A LOD is good enough at distance d as long as error * lod_scale <= d.
+float getLodScale() {
+    mat4 view, proj;
+    getViewProjection(view, proj);
+    return fabsf(proj[1][1]) * 0.5f * (float)g_swap_chain_extent.height / LOD_MAX_SCREEN_ERROR;
+}
+
+// Coarsest LOD that passes the test of getLodScale, error_scale already includes it.
+// Errors only grow along the chain, and LOD 0 has none, so a camera inside the bounds always gets LOD 0.
+uint32_t selectLod(const MeshLod* lods, const uint32_t num_lods, const float error_scale, const float distance) {
+    uint32_t lod = 0;
+    for(uint32_t i = 1; i < num_lods; i++) {
+        if(lods[i].error * error_scale <= distance) lod = i;
+    }
+    return lod;
+}
+
+/*
+ * CPU frustum culling
+ *
+ * Bounding spheres are stored as structure of arrays, so one register holds the same component of 4 (SSE, NEON)
+ * or 8 (AVX2) spheres and all six planes are tested without any shuffling. The kernel is picked at compile time.
+ * The arrays are padded to SPHERE_SET_PADDING with spheres that can never be visible, so no kernel needs a scalar tail.
+ * Visible indices are compacted into `visible` in ascending order without branching on the test results.
+ */
+#define SPHERE_SET_PADDING 8 // Multiple of every kernel width
+
+typedef struct {
+    float* center_x;
+    float* center_y;
+    float* center_z;
+    float* radius;
+    uint32_t* visible;
+    uint32_t num_spheres;
+    uint32_t num_visible;
+    uint32_t capacity; // Always a multiple of SPHERE_SET_PADDING
+} SphereSet;
+
+void SphereSet_reserve(SphereSet* set, uint32_t capacity) {
+    capacity = (capacity + SPHERE_SET_PADDING - 1) / SPHERE_SET_PADDING * SPHERE_SET_PADDING;
+    if(capacity <= set->capacity) return;
+    const size_t old_size = set->capacity * sizeof(float);
+    const size_t new_size = capacity * sizeof(float);
+    set->center_x = reallocAligned(set->center_x, old_size, new_size);
+    set->center_y = reallocAligned(set->center_y, old_size, new_size);
+    set->center_z = reallocAligned(set->center_z, old_size, new_size);
+    set->radius = reallocAligned(set->radius, old_size, new_size);
+    set->visible = reallocAligned(set->visible, set->capacity * sizeof(uint32_t), capacity * sizeof(uint32_t));
+
+    // A negative infinite radius fails the test against the first plane
+    for(uint32_t i = set->capacity; i < capacity; i++) {
+        set->center_x[i] = 0.0f; set->center_y[i] = 0.0f; set->center_z[i] = 0.0f;
+        set->radius[i] = -FLT_MAX;
+    }
+    set->capacity = capacity;
+}
+
+void SphereSet_set(SphereSet* set, const uint32_t index, const vec4 sphere) {
+    set->center_x[index] = sphere[0];
+    set->center_y[index] = sphere[1];
+    set->center_z[index] = sphere[2];
+    set->radius[index] = sphere[3];
+}
+
+// Returns the index of the new sphere
+uint32_t SphereSet_add(SphereSet* set, const vec4 sphere) {
+    if(set->num_spheres == set->capacity) SphereSet_reserve(set, MAX(set->capacity * 2, SPHERE_SET_PADDING));
+    SphereSet_set(set, set->num_spheres, sphere);
+    return set->num_spheres++;
+}
+
+void SphereSet_free(SphereSet* set) {
+    free(set->center_x); free(set->center_y); free(set->center_z); free(set->radius); free(set->visible);
+    memset(set, 0, sizeof(SphereSet));
+}
+
+// Appends base + i for every set bit i of mask, the store is unconditional and only the count depends on the bit
+uint32_t appendVisibleIndices(uint32_t* visible, uint32_t num_visible, const uint32_t base, const uint32_t mask, const uint32_t width) {
+    for(uint32_t i = 0; i < width; i++) {
+        visible[num_visible] = base + i;
+        num_visible += (mask >> i) & 1;
+    }
+    return num_visible;
+}
+
+// A sphere is visible unless it lies completely behind one of the planes
+uint32_t cullSpheresScalar(SphereSet* set, vec4 planes[6]) {
+    uint32_t num_visible = 0;
+    for(uint32_t i = 0; i < set->num_spheres; i++) {
+        uint32_t inside = 1;
+        for(uint32_t p = 0; p < 6; p++) {
+            const float distance = planes[p][0] * set->center_x[i] + planes[p][1] * set->center_y[i] + planes[p][2] * set->center_z[i] + planes[p][3];
+            inside &= distance >= -set->radius[i];
+        }
+        set->visible[num_visible] = i;
+        num_visible += inside;
+    }
+    return num_visible;
+}
+
+#if defined(__AVX2__)
+uint32_t cullSpheresAVX2(SphereSet* set, vec4 planes[6]) {
+    __m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for(uint32_t p = 0; p < 6; p++) {
+        plane_x[p] = _mm256_set1_ps(planes[p][0]);
+        plane_y[p] = _mm256_set1_ps(planes[p][1]);
+        plane_z[p] = _mm256_set1_ps(planes[p][2]);
+        plane_w[p] = _mm256_set1_ps(planes[p][3]);
+    }
+
+    uint32_t num_visible = 0;
+    for(uint32_t i = 0; i < set->num_spheres; i += 8) {
+        const __m256 x = _mm256_load_ps(&set->center_x[i]);
+        const __m256 y = _mm256_load_ps(&set->center_y[i]);
+        const __m256 z = _mm256_load_ps(&set->center_z[i]);
+        const __m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_load_ps(&set->radius[i]));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(uint32_t p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(plane_x[p], x), plane_w[p]);
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(plane_y[p], y));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(plane_z[p], z));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, neg_radius, _CMP_GE_OQ));
+        }
+        num_visible = appendVisibleIndices(set->visible, num_visible, i, (uint32_t)_mm256_movemask_ps(inside), 8);
+    }
+    return num_visible;
+}
+#endif
+
+#if defined(__SSE2__)
+uint32_t cullSpheresSSE(SphereSet* set, vec4 planes[6]) {
+    __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for(uint32_t p = 0; p < 6; p++) {
+        plane_x[p] = _mm_set1_ps(planes[p][0]);
+        plane_y[p] = _mm_set1_ps(planes[p][1]);
+        plane_z[p] = _mm_set1_ps(planes[p][2]);
+        plane_w[p] = _mm_set1_ps(planes[p][3]);
+    }
+
+    uint32_t num_visible = 0;
+    for(uint32_t i = 0; i < set->num_spheres; i += 4) {
+        const __m128 x = _mm_load_ps(&set->center_x[i]);
+        const __m128 y = _mm_load_ps(&set->center_y[i]);
+        const __m128 z = _mm_load_ps(&set->center_z[i]);
+        const __m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(&set->radius[i]));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(uint32_t p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(plane_x[p], x), plane_w[p]);
+            distance = _mm_add_ps(distance, _mm_mul_ps(plane_y[p], y));
+            distance = _mm_add_ps(distance, _mm_mul_ps(plane_z[p], z));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+        }
+        num_visible = appendVisibleIndices(set->visible, num_visible, i, (uint32_t)_mm_movemask_ps(inside), 4);
+    }
+    return num_visible;
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+uint32_t cullSpheresNEON(SphereSet* set, vec4 planes[6]) {
+    float32x4_t plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+    for(uint32_t p = 0; p < 6; p++) {
+        plane_x[p] = vdupq_n_f32(planes[p][0]);
+        plane_y[p] = vdupq_n_f32(planes[p][1]);
+        plane_z[p] = vdupq_n_f32(planes[p][2]);
+        plane_w[p] = vdupq_n_f32(planes[p][3]);
+    }
+    const uint32_t lane_bits_data[4] = {1, 2, 4, 8};
+    const uint32x4_t lane_bits = vld1q_u32(lane_bits_data);
+
+    uint32_t num_visible = 0;
+    for(uint32_t i = 0; i < set->num_spheres; i += 4) {
+        const float32x4_t x = vld1q_f32(&set->center_x[i]);
+        const float32x4_t y = vld1q_f32(&set->center_y[i]);
+        const float32x4_t z = vld1q_f32(&set->center_z[i]);
+        const float32x4_t neg_radius = vnegq_f32(vld1q_f32(&set->radius[i]));
+        uint32x4_t inside = vdupq_n_u32(UINT32_MAX);
+        for(uint32_t p = 0; p < 6; p++) {
+            float32x4_t distance = vfmaq_f32(plane_w[p], plane_x[p], x);
+            distance = vfmaq_f32(distance, plane_y[p], y);
+            distance = vfmaq_f32(distance, plane_z[p], z);
+            inside = vandq_u32(inside, vcgeq_f32(distance, neg_radius));
+        }
+        const uint32_t mask = vaddvq_u32(vandq_u32(inside, lane_bits));
+        num_visible = appendVisibleIndices(set->visible, num_visible, i, mask, 4);
+    }
+    return num_visible;
+}
+#endif
+
+// Fills set->visible with the indices of all spheres intersecting the frustum and returns their count
+uint32_t cullSpheres(SphereSet* set, vec4 planes[6]) {
+#if defined(__AVX2__)
+    set->num_visible = cullSpheresAVX2(set, planes);
+#elif defined(__SSE2__)
+    set->num_visible = cullSpheresSSE(set, planes);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    set->num_visible = cullSpheresNEON(set, planes);
+#else
+    set->num_visible = cullSpheresScalar(set, planes);
+#endif
+    return set->num_visible;
+}
+
+SphereSet g_model_bounds; // Index i is the bounding sphere of g_models[i]
+
+// Picks g_model_lods for every visible model, errors grow with the model's scale like its bounding radius does
+void selectModelLods(const float lod_scale) {
+    for(uint32_t i = 0; i < g_model_bounds.num_visible; i++) {
+        const uint32_t model_index = g_model_bounds.visible[i];
+        const Model* model = &g_models[model_index];
+        const vec3 center = {g_model_bounds.center_x[model_index], g_model_bounds.center_y[model_index], g_model_bounds.center_z[model_index]};
+        const float radius = g_model_bounds.radius[model_index];
+        const float distance = glm_vec3_distance((float*)center, g_camera_eye) - radius;
+        const float mesh_radius = Model_getBoundingRadius(model);
+        const float error_scale = mesh_radius > 0.0f ? radius / mesh_radius * lod_scale : lod_scale;
+        g_model_lods[model_index] = selectLod(model->lods, model->num_lods, error_scale, distance);
+    }
+}
+
+// Spins the torus, the sphere is its child and orbits along. Bounds are only refreshed for nodes that moved.
+void updateScene() {
+    TRACE_FUNCTION();
+    if (g_start_time == 0) g_start_time = clock();
+    const float time = (float)(clock() - g_start_time) / CLOCKS_PER_SEC;
+    versor rotation;
+    glm_quatv(rotation, time * SCENE_ROTATION_SPEED, (vec3){0.0f, 1.0f, 0.0f});
+    Scene_setRotation(&g_scene, g_models[0].scene_node, rotation);
+
+    Scene_update(&g_scene);
+
+    for(uint32_t i = 0; i < NUM_MODELS; i++) {
+        const uint32_t node = g_models[i].scene_node;
+        if(!Scene_isWorldChanged(&g_scene, node)) continue;
+        vec4 bounds;
+        Model_getWorldBoundingSphere(&g_models[i], g_scene.world_matrices[node], bounds);
+        SphereSet_set(&g_model_bounds, i, bounds);
+    }
+}
+
+// Function to create the UBO
+UniformBufferObject get_UBO(mat4 model_matrix) {
+    if (g_start_time == 0) g_start_time = clock();
+    clock_t current_time = clock();
+    float delta_time = (float)(current_time - g_start_time) / CLOCKS_PER_SEC;
+
+    mat4 view, proj;
+    getViewProjection(view, proj);
+
+    UniformBufferObject ubo = UniformBufferObject_create(model_matrix, view, proj);
+    glm_vec4(g_camera_eye, 1.0f, ubo.cameraEye);
+    ubo.time = delta_time;
+    ubo.stage = g_rendering_stage;
+    return ubo;
+}
+
+/*
+ * GPU profiler
+ *
+ * Named regions of the frame's command buffers are bracketed with vkCmdWriteTimestamp. Every frame in flight owns a
+ * query pool holding a begin and an end query per region, reset at the start of its command buffer. The results are
+ * read right after drawFrame waited on the frame's fence, so vkGetQueryPoolResults never has to wait, and regions the
+ * frame didn't record just stay unavailable. Region indices are interned by name and never change, so they stay
+ * valid inside cached and secondary command buffers. Enabled with --gpu-trace PATH, which streams every region as a
+ * Chrome trace event (chrome://tracing or ui.perfetto.dev) next to the CPU side of its frame, and prints a per region
+ * breakdown every GPU_PROFILER_STATS_INTERVAL frames.
+ */
+#define GPU_PROFILER_MAX_REGIONS 32
+#define GPU_PROFILER_STATS_INTERVAL 600 // Frames between two breakdowns
+#define GPU_PROFILER_NO_REGION UINT32_UNINITIALIZED_VALUE
+#define GPU_PROFILER_NOT_INDEXED UINT32_UNINITIALIZED_VALUE
+
+typedef struct {
+    const char* name; // Has to outlive the profiler, string literals in practice
+    uint32_t index;   // Tells apart regions sharing a name, GPU_PROFILER_NOT_INDEXED if there is only one
+
+    // Accumulated since the last breakdown
+    double milliseconds;
+    uint32_t num_samples;
+} GpuRegion;
+
+typedef struct {
+    VkQueryPool query_pool;
+    bool is_submitted; // The queries only hold results once a command buffer resetting them got submitted
+    uint32_t frame_number;
+    double cpu_begin_milliseconds;
+    double cpu_end_milliseconds;
+} GpuProfilerFrame;
+
+bool g_gpu_profiler_enabled = false;
+const char* g_gpu_trace_path = NULL; // Set with --gpu-trace
+FILE* g_gpu_trace_file = NULL;
+GpuRegion g_gpu_regions[GPU_PROFILER_MAX_REGIONS];
+uint32_t g_num_gpu_regions = 0;
+GpuProfilerFrame g_gpu_profiler_frames[MAX_FRAMES_IN_FLIGHT];
+double g_gpu_milliseconds_per_tick = 0.0;
+uint64_t g_gpu_timestamp_mask = 0;
+double g_gpu_clock_offset_milliseconds = -DBL_MAX; // Added to GPU times to place them on the CPU timeline
+uint32_t g_gpu_profiler_num_frames = 0; // Collected since the last breakdown
+
+void GpuRegion_getName(const GpuRegion* region, char* out, const size_t size) {
+    if (region->index == GPU_PROFILER_NOT_INDEXED) snprintf(out, size, "%s", region->name);
+    else snprintf(out, size, "%s %u", region->name, region->index);
+}
+
+void createGpuProfiler() {
+    if (g_gpu_trace_path == NULL) return;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(g_physical_device, &properties);
+    const QueueFamilyIndices indices = findQueueFamilies(g_physical_device);
+    uint32_t num_queue_families = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(g_physical_device, &num_queue_families, NULL);
+    VkQueueFamilyProperties* queueFamilies = malloc(num_queue_families * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(g_physical_device, &num_queue_families, queueFamilies);
+    const uint32_t valid_bits = queueFamilies[indices.graphicsFamily].timestampValidBits;
+    free(queueFamilies);
+    if (valid_bits == 0 || properties.limits.timestampPeriod == 0.0f) {
+        fprintf(stderr, "Warning: The graphics queue doesn't support timestamps, GPU profiling is disabled.\n");
+        return;
+    }
+
+    g_gpu_trace_file = fopen(g_gpu_trace_path, "w");
+    if (g_gpu_trace_file == NULL) {
+        fprintf(stderr, "Error: Unable to open '%s' for writing: %s\n", g_gpu_trace_path, strerror(errno));
+        return;
+    }
+    // Events are appended as they come in, the array gets closed in destroyGpuProfiler
+    fprintf(g_gpu_trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n"
+                              "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}");
+
+    g_gpu_timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+    g_gpu_milliseconds_per_tick = (double)properties.limits.timestampPeriod * 1e-6;
+    const VkQueryPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * GPU_PROFILER_MAX_REGIONS};
+    for (uint32_t i = 0; i < g_frames_in_flight; i++) {
+        if (vkCreateQueryPool(g_device, &poolInfo, NULL, &g_gpu_profiler_frames[i].query_pool) != VK_SUCCESS) PANIC("failed to create timestamp query pool!");
+    }
+    g_gpu_profiler_enabled = true;
+}
+
+// Returns the region's stable index, GPU_PROFILER_NO_REGION if profiling is off or all regions are taken.
+// Only the thread recording the primary command buffer may call this.
+uint32_t GpuProfiler_getRegion(const char* name, const uint32_t index) {
+    if (!g_gpu_profiler_enabled) return GPU_PROFILER_NO_REGION;
+    for (uint32_t i = 0; i < g_num_gpu_regions; i++) {
+        if (g_gpu_regions[i].index == index && strcmp(g_gpu_regions[i].name, name) == 0) return i;
+    }
+    if (g_num_gpu_regions == GPU_PROFILER_MAX_REGIONS) return GPU_PROFILER_NO_REGION;
+    g_gpu_regions[g_num_gpu_regions] = (GpuRegion){.name = name, .index = index};
+    return g_num_gpu_regions++;
+}
+
+// Has to be recorded outside a render pass, before any region of the current frame
+void GpuProfiler_resetQueries(VkCommandBuffer commandBuffer) {
+    if (!g_gpu_profiler_enabled) return;
+    vkCmdResetQueryPool(commandBuffer, g_gpu_profiler_frames[g_current_frame_idx].query_pool, 0, 2 * GPU_PROFILER_MAX_REGIONS);
+}
+
+// Every region can be recorded at most once per frame
+void GpuProfiler_beginRegion(VkCommandBuffer commandBuffer, const uint32_t region) {
+    if (region == GPU_PROFILER_NO_REGION) return;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_gpu_profiler_frames[g_current_frame_idx].query_pool, 2 * region);
+}
+
+void GpuProfiler_endRegion(VkCommandBuffer commandBuffer, const uint32_t region) {
+    if (region == GPU_PROFILER_NO_REGION) return;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_gpu_profiler_frames[g_current_frame_idx].query_pool, 2 * region + 1);
+}
+
+void GpuProfiler_markSubmitted(const uint32_t frame_idx, const double cpu_begin_milliseconds, const double cpu_end_milliseconds) {
+    if (!g_gpu_profiler_enabled) return;
+    GpuProfilerFrame* frame = &g_gpu_profiler_frames[frame_idx];
+    frame->is_submitted = true;
+    frame->frame_number = g_frame_counter;
+    frame->cpu_begin_milliseconds = cpu_begin_milliseconds;
+    frame->cpu_end_milliseconds = cpu_end_milliseconds;
+}
+
+void printGpuProfilerStats() {
+    printf("[[DS-GPU]] Last %u frames, GPU milliseconds per frame\n", g_gpu_profiler_num_frames);
+    for (uint32_t i = 0; i < g_num_gpu_regions; i++) {
+        GpuRegion* region = &g_gpu_regions[i];
+        if (region->num_samples == 0) continue;
+        char name[64];
+        GpuRegion_getName(region, name, sizeof(name));
+        printf("[[DS-GPU]]     %-20s %.3f milliseconds in %u frames\n", name, region->milliseconds / region->num_samples, region->num_samples);
+        region->milliseconds = 0.0;
+        region->num_samples = 0;
+    }
+    g_gpu_profiler_num_frames = 0;
+}
+
+// Reads the timestamps of the frame, which must have passed its fence, and writes its trace events
+void GpuProfiler_collectFrame(const uint32_t frame_idx) {
+    GpuProfilerFrame* frame = &g_gpu_profiler_frames[frame_idx];
+    if (!g_gpu_profiler_enabled || !frame->is_submitted || g_num_gpu_regions == 0) return;
+    frame->is_submitted = false;
+
+    // Value and availability of every query, regions this frame didn't record come back unavailable
+    uint64_t results[2 * GPU_PROFILER_MAX_REGIONS][2];
+    const VkResult result = vkGetQueryPoolResults(
+        g_device,
+        frame->query_pool,
+        0,
+        2 * g_num_gpu_regions,
+        sizeof(results),
+        results,
+        sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) PANIC("failed to read GPU timestamps!");
+
+    // Without calibrated timestamps the two clocks are only related by the GPU never starting a frame before its
+    // submission. The smallest offset keeping that true for every frame so far is the best guess.
+    double first_begin_milliseconds = DBL_MAX;
+    for (uint32_t i = 0; i < g_num_gpu_regions; i++) {
+        if (results[2 * i][1] == 0 || results[2 * i + 1][1] == 0) continue;
+        first_begin_milliseconds = MIN(first_begin_milliseconds, (double)(results[2 * i][0] & g_gpu_timestamp_mask) * g_gpu_milliseconds_per_tick);
+    }
+    if (first_begin_milliseconds == DBL_MAX) return;
+    g_gpu_clock_offset_milliseconds = MAX(g_gpu_clock_offset_milliseconds, frame->cpu_end_milliseconds - first_begin_milliseconds);
+
+    fprintf(g_gpu_trace_file, ",\n{\"name\":\"Frame\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+            frame->cpu_begin_milliseconds * 1e3, (frame->cpu_end_milliseconds - frame->cpu_begin_milliseconds) * 1e3, frame->frame_number);
+    for (uint32_t i = 0; i < g_num_gpu_regions; i++) {
+        if (results[2 * i][1] == 0 || results[2 * i + 1][1] == 0) continue;
+        const uint64_t begin = results[2 * i][0] & g_gpu_timestamp_mask;
+        const uint64_t end = results[2 * i + 1][0] & g_gpu_timestamp_mask;
+        const double milliseconds = (double)((end - begin) & g_gpu_timestamp_mask) * g_gpu_milliseconds_per_tick;
+        g_gpu_regions[i].milliseconds += milliseconds;
+        g_gpu_regions[i].num_samples += 1;
+
+        char name[64];
+        GpuRegion_getName(&g_gpu_regions[i], name, sizeof(name));
+        const double begin_milliseconds = (double)begin * g_gpu_milliseconds_per_tick + g_gpu_clock_offset_milliseconds;
+        fprintf(g_gpu_trace_file, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+                name, begin_milliseconds * 1e3, milliseconds * 1e3, frame->frame_number);
+    }
+
+    g_gpu_profiler_num_frames += 1;
+    if (g_gpu_profiler_num_frames == GPU_PROFILER_STATS_INTERVAL) printGpuProfilerStats();
+}
+
+// The device must be idle, the frames still in flight are collected first
+void destroyGpuProfiler() {
+    if (!g_gpu_profiler_enabled) return;
+    for (uint32_t i = 0; i < g_frames_in_flight; i++) GpuProfiler_collectFrame(i);
+    if (g_gpu_profiler_num_frames > 0) printGpuProfilerStats();
+
+    fprintf(g_gpu_trace_file, "\n]\n");
+    if (fclose(g_gpu_trace_file) != 0) fprintf(stderr, "Error: Failed to write GPU trace '%s': %s\n", g_gpu_trace_path, strerror(errno));
+    else printf("Wrote GPU trace to '%s'.\n", g_gpu_trace_path);
+    g_gpu_trace_file = NULL;
+
+    for (uint32_t i = 0; i < g_frames_in_flight; i++) vkDestroyQueryPool(g_device, g_gpu_profiler_frames[i].query_pool, NULL);
+    memset(g_gpu_profiler_frames, 0, sizeof(g_gpu_profiler_frames));
+    g_gpu_profiler_enabled = false;
+}
+
+/*
+ * Parallel command recording
+ *
+ * The frame's draw list (visible g_models followed by the instanced batch) is split into contiguous ranges, each
+ * recorded into a secondary command buffer by a job on g_recording_pool. Every recorder owns one command pool per
+ * frame in flight, so a recorder resets and records its own pool without synchronizing with anybody else.
+ * The primary only runs the culling pass, begins the render pass and executes the secondaries in draw list order.
+ */
+#define MAX_RECORDERS 64
+#define RECORDING_MIN_DRAWS_PER_JOB 64 // Smaller draw lists don't pay for the extra jobs
+#define RECORDING_STATS_INTERVAL 600 // Frames between two timing breakdowns
+
+typedef struct {
+    VkCommandPool command_pools[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
+
+    // Job parameters, written by the main thread before the job gets submitted
+    uint32_t first_item;
+    uint32_t end_item;
+    VkFramebuffer framebuffer;
+    bool cull_on_gpu;
+    uint32_t gpu_region;
+
+    // Accumulated since the last timing breakdown
+    double recording_milliseconds;
+    uint32_t num_jobs;
+    uint32_t num_draws;
+} CommandRecorder;
+
+ThreadPool g_recording_pool;
+CommandRecorder g_recorders[MAX_RECORDERS];
+uint32_t g_num_recorders;
+double g_recording_wait_milliseconds; // Main thread time spent waiting on the recorders, since the last breakdown
+
+double getMilliseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e3 + (double)now.tv_nsec * 1e-6;
+}
+
+void createCommandRecorders() {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cores < 1) num_cores = 1;
+    g_num_recorders = MIN((uint32_t)num_cores, MAX_RECORDERS);
+    ThreadPool_create(&g_recording_pool, "Command recording", g_num_recorders);
+
+    for(uint32_t i = 0; i < g_num_recorders; i++) {
+        CommandRecorder* recorder = &g_recorders[i];
+        memset(recorder, 0, sizeof(CommandRecorder));
+        for(uint32_t frame = 0; frame < g_frames_in_flight; frame++) {
+            const VkCommandPoolCreateInfo poolInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = g_graphics_queue_family};
+            if(vkCreateCommandPool(g_device, &poolInfo, NULL, &recorder->command_pools[frame]) != VK_SUCCESS) PANIC("Failed to create recorder command pool!");
+
+            const VkCommandBufferAllocateInfo allocInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = recorder->command_pools[frame],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1};
+            if(vkAllocateCommandBuffers(g_device, &allocInfo, &recorder->command_buffers[frame]) != VK_SUCCESS) PANIC("Failed to allocate secondary command buffer!");
+        }
+    }
+    printf("Recording command buffers on up to %u threads.\n", g_num_recorders);
+}
+
+void destroyCommandRecorders() {
+    ThreadPool_destroy(&g_recording_pool);
+    for(uint32_t i = 0; i < g_num_recorders; i++) {
+        for(uint32_t frame = 0; frame < g_frames_in_flight; frame++) {
+            vkDestroyCommandPool(g_device, g_recorders[i].command_pools[frame], NULL);
+        }
+    }
+    memset(g_recorders, 0, sizeof(g_recorders));
+    g_num_recorders = 0;
+}
+
+uint32_t getDrawListSize() {
+    return g_model_bounds.num_visible + (g_instanced_spheres.num_instances > 0 ? 1 : 0);
+}
 
-    const VkSemaphoreCreateInfo semaphoreInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    const VkFenceCreateInfo fenceInfo = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
+bool isInstancedBatchCulledOnGpu() {
+    return g_gpu_culling_enabled && g_instanced_spheres.num_instances > 0;
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        fprintf(stdout, "\t%zu. frame\n", i + 1);
-        const VkResult result_1 = vkCreateSemaphore(g_device, &semaphoreInfo, NULL, &g_image_available_semaphores[i]);
-        if (result_1 != VK_SUCCESS) PANIC("failed to create ImageAvailable semaphore!");
-        const VkResult result_2 = vkCreateSemaphore(g_device, &semaphoreInfo, NULL, &g_render_finished_semaphores[i]);
-        if (result_2 != VK_SUCCESS) PANIC("failed to create RenderFinished semaphore!");
-        const VkResult result_3 = vkCreateFence(g_device, &fenceInfo, NULL, &g_in_flight_fences[i]);
-        if (result_3 != VK_SUCCESS) PANIC("failed to create InFlight fence!");
+// Fills the UniformBufferObject slot of a draw list item and returns its dynamic offset
+uint32_t writeDrawItemUniforms(const uint32_t item) {
+    FrameUniformRing* uniformRing = &g_frame_uniform_rings[g_current_frame_idx];
+    // The instanced batch is always the last item of the draw list, its instances already carry the dequantization
+    mat4 model_matrix;
+    if(item < g_model_bounds.num_visible) {
+        const Model* model = &g_models[g_model_bounds.visible[item]];
+        Model_getVertexMatrix(model, g_scene.world_matrices[model->scene_node], model_matrix);
+    } else {
+        glm_mat4_copy(g_scene.world_matrices[g_instanced_spheres.model.scene_node], model_matrix);
     }
+    const UniformBufferObject ubo = get_UBO(model_matrix);
+    return FrameUniformRing_writeDrawUniforms(uniformRing, item, &ubo);
 }
 
-void recreateSwapChain() {
-    PANIC("NOT_IMPLEMENTED");
-    /*
-    int width = 0, height = 0;
-    glfwGetFramebufferSize(m_Window, &width, &height);
-    while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(m_Window, &width, &height);
-        glfwWaitEvents();
-    }
+// Records the draw list items [first_item, end_item) of the current frame into a command buffer inside the render pass
+void recordDrawRange(VkCommandBuffer commandBuffer, const uint32_t first_item, const uint32_t end_item, const bool cull_on_gpu) {
+    // Secondaries inherit nothing but the render pass, all dynamic state has to be set again
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_graphics_pipeline);
 
-    vkDeviceWaitIdle(m_Device);
+    const VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float)g_swap_chain_extent.width,
+        .height = (float)g_swap_chain_extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f};
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-    cleanupSwapChain();
+    const VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = g_swap_chain_extent};
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
+    vkCmdPushConstants(
+        commandBuffer,
+        g_pipeline_layout,
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        0,
+        sizeof(PushConstants),
+        &g_push_constants);
 
-    // Recreate uniform buffers and descriptor sets
-    createUniformBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
+    VkDescriptorSet descriptorSet = g_descriptor_sets[g_current_frame_idx];
+    for (uint32_t item = first_item; item < end_item; item++) {
+        const uint32_t uniformOffset = writeDrawItemUniforms(item);
+        if (item < g_model_bounds.num_visible) {
+            const uint32_t model_index = g_model_bounds.visible[item];
+            Model_enqueueIntoCommandBuffer(&g_models[model_index], commandBuffer, descriptorSet, uniformOffset, g_model_lods[model_index]);
+            continue;
+        }
 
-    // No need to recreate command buffers if you reset them each frame
-    */
+        if (cull_on_gpu) InstancedModel_enqueueIndirectIntoCommandBuffer(&g_instanced_spheres, commandBuffer, descriptorSet, uniformOffset, g_current_frame_idx);
+        else InstancedModel_enqueueIntoCommandBuffer(&g_instanced_spheres, commandBuffer, descriptorSet, uniformOffset, g_current_frame_idx);
+    }
 }
 
-void updatePushConstants() {
-    memcpy(g_push_constants.cameraCenter, g_camera_center, sizeof(vec3));
-    memcpy(g_push_constants.cameraEye, g_camera_eye, sizeof(vec3));
-    memcpy(g_push_constants.cameraUp, g_camera_up, sizeof(vec3));
-    g_push_constants.stage = g_rendering_stage;
+// Records the recorder's range into its secondary command buffer, runs on g_recording_pool
+void recordDrawRangeJob(void* user_data) {
+    TRACE_FUNCTION();
+    CommandRecorder* recorder = user_data;
+    const double start = getMilliseconds();
 
-    // Get current time using clock() from <time.h>
-    const clock_t current_time = clock();
+    VkCommandPool commandPool = recorder->command_pools[g_current_frame_idx];
+    VkCommandBuffer commandBuffer = recorder->command_buffers[g_current_frame_idx];
+    vkResetCommandPool(g_device, commandPool, 0);
 
-    // Compute delta time in seconds (clock() returns time in clock ticks)
-    const float delta_time = (float)(current_time - g_start_time) / CLOCKS_PER_SEC;
+    const VkCommandBufferInheritanceInfo inheritanceInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = g_render_pass,
+        .subpass = 0,
+        .framebuffer = recorder->framebuffer};
+    const VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = &inheritanceInfo};
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) PANIC("failed to begin recording secondary command buffer!");
+    GpuProfiler_beginRegion(commandBuffer, recorder->gpu_region);
+    recordDrawRange(commandBuffer, recorder->first_item, recorder->end_item, recorder->cull_on_gpu);
+    GpuProfiler_endRegion(commandBuffer, recorder->gpu_region);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record secondary command buffer!");
+
+    recorder->recording_milliseconds += getMilliseconds() - start;
+    recorder->num_jobs += 1;
+    recorder->num_draws += recorder->end_item - recorder->first_item;
+}
 
-    // Store deltaTime in push constants
-    g_push_constants.time = delta_time;
+void printRecordingStats() {
+    printf("[[DS-RECORDING]] Last %u frames, main thread waited %.3f milliseconds per frame\n",
+           RECORDING_STATS_INTERVAL, g_recording_wait_milliseconds / RECORDING_STATS_INTERVAL);
+    for (uint32_t i = 0; i < g_num_recorders; i++) {
+        CommandRecorder* recorder = &g_recorders[i];
+        if (recorder->num_jobs == 0) continue;
+        printf("[[DS-RECORDING]]     Recorder %2u: %u jobs, %.3f milliseconds and %.1f draws per job\n",
+               i, recorder->num_jobs, recorder->recording_milliseconds / recorder->num_jobs, (double)recorder->num_draws / recorder->num_jobs);
+        recorder->recording_milliseconds = 0.0;
+        recorder->num_jobs = 0;
+        recorder->num_draws = 0;
+    }
+    g_recording_wait_milliseconds = 0.0;
+}
+
+// Per frame CPU work both recording modes depend on, runs once the frame's fence has been waited on
+void prepareFrame() {
+    TRACE_FUNCTION();
+    vec4 frustum_planes[6];
+    getFrustumPlanes(frustum_planes);
+    cullSpheres(&g_model_bounds, frustum_planes);
+    const float lod_scale = getLodScale();
+    selectModelLods(lod_scale);
+    updatePushConstants();
+    if (isInstancedBatchCulledOnGpu()) InstancedModel_updateCullingUniforms(&g_instanced_spheres, g_current_frame_idx, frustum_planes, lod_scale);
 }
 
-void record_command_buffers(VkCommandBuffer commandBuffer, const uint32_t imageIndex) {
+// Records the whole frame. With use_secondaries the draw list is recorded in parallel on g_recording_pool,
+// otherwise inline, which is what cached command buffers need as the recorders reuse their pools every frame.
+void record_command_buffers(VkCommandBuffer commandBuffer, const uint32_t imageIndex, const bool use_secondaries) {
     const VkCommandBufferBeginInfo beginInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
 
     if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) PANIC("failed to begin recording command buffer!");
+    GpuProfiler_resetQueries(commandBuffer);
+    const uint32_t frame_region = GpuProfiler_getRegion("Frame", GPU_PROFILER_NOT_INDEXED);
+    const uint32_t render_pass_region = GpuProfiler_getRegion("Render pass", GPU_PROFILER_NOT_INDEXED);
+    GpuProfiler_beginRegion(commandBuffer, frame_region);
 
     #define num_clear_values 2
     VkClearValue clearValues[num_clear_values];
@@ -1998,7 +7409,7 @@ void record_command_buffers(VkCommandBuffer commandBuffer, const uint32_t imageI
     clearValues[1].depthStencil.depth = 1.0f;
     clearValues[1].depthStencil.stencil = 0;
 
-    const VkRenderPassBeginInfo renderPassInfo{
+    const VkRenderPassBeginInfo renderPassInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .renderPass = g_render_pass,
         .framebuffer = g_swap_chain_framebuffers[imageIndex],
@@ -2007,112 +7418,731 @@ void record_command_buffers(VkCommandBuffer commandBuffer, const uint32_t imageI
         .pClearValues = clearValues};
     #undef num_clear_values
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // GPU culling runs in compute and has to be recorded before the render pass starts
+    const bool cull_on_gpu = isInstancedBatchCulledOnGpu();
+    if (cull_on_gpu) {
+        const uint32_t culling_region = GpuProfiler_getRegion("Culling", GPU_PROFILER_NOT_INDEXED);
+        GpuProfiler_beginRegion(commandBuffer, culling_region);
+        InstancedModel_recordCulling(&g_instanced_spheres, commandBuffer, g_current_frame_idx);
+        GpuProfiler_endRegion(commandBuffer, culling_region);
+    }
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
+    if (g_descriptor_sets[g_current_frame_idx] == VK_NULL_HANDLE) PANIC("Invalid descriptor set handle!");
+    const uint32_t num_items = getDrawListSize();
+
+    GpuProfiler_beginRegion(commandBuffer, render_pass_region);
+    if (!use_secondaries) {
+        const uint32_t draws_region = GpuProfiler_getRegion("Draws", GPU_PROFILER_NOT_INDEXED);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        GpuProfiler_beginRegion(commandBuffer, draws_region);
+        recordDrawRange(commandBuffer, 0, num_items, cull_on_gpu);
+        GpuProfiler_endRegion(commandBuffer, draws_region);
+        vkCmdEndRenderPass(commandBuffer);
+        GpuProfiler_endRegion(commandBuffer, render_pass_region);
+        GpuProfiler_endRegion(commandBuffer, frame_region);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record command buffer!");
+        return;
+    }
 
-    VkViewport viewport{
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float)g_swap_chain_extent.width,
-        .height = (float)>g_swap_chain_extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f};
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    const uint32_t num_jobs = MIN(MAX((num_items + RECORDING_MIN_DRAWS_PER_JOB - 1) / RECORDING_MIN_DRAWS_PER_JOB, 1u), g_num_recorders);
+    VkCommandBuffer secondaries[MAX_RECORDERS];
+    for (uint32_t i = 0; i < num_jobs; i++) {
+        CommandRecorder* recorder = &g_recorders[i];
+        recorder->first_item = (uint32_t)((uint64_t)num_items * i / num_jobs);
+        recorder->end_item = (uint32_t)((uint64_t)num_items * (i + 1) / num_jobs);
+        recorder->framebuffer = g_swap_chain_framebuffers[imageIndex];
+        recorder->cull_on_gpu = cull_on_gpu;
+        recorder->gpu_region = GpuProfiler_getRegion("Draw range", i);
+        secondaries[i] = recorder->command_buffers[g_current_frame_idx];
+        ThreadPool_submit(&g_recording_pool, recordDrawRangeJob, recorder);
+    }
 
-    VkRect2D scissor{
-        .offset = {0, 0},
-        .extent = g_swap_chain_extent};
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    const double wait_start = getMilliseconds();
+    ThreadPool_waitIdle(&g_recording_pool);
+    g_recording_wait_milliseconds += getMilliseconds() - wait_start;
 
-    updatePushConstants();
-    vkCmdPushConstants(
-        commandBuffer,
-        g_pipeline_layout,
-        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-        0,
-        sizeof(PushConstants),
-        &g_push_constants);
+    vkCmdExecuteCommands(commandBuffer, num_jobs, secondaries);
+    vkCmdEndRenderPass(commandBuffer);
+    GpuProfiler_endRegion(commandBuffer, render_pass_region);
+    GpuProfiler_endRegion(commandBuffer, frame_region);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record command buffer!");
 
-    for (size_t j = 0; j < 2; j++) {
-        const size_t descriptorSetIndex = g_current_frame_idx * NUM_MODELS + j;
-        VkDescriptorSet descriptorSet = g_descriptor_sets[descriptorSetIndex];
+    if (g_frame_counter % RECORDING_STATS_INTERVAL == RECORDING_STATS_INTERVAL - 1) printRecordingStats();
+}
 
-        if (descriptorSet == VK_NULL_HANDLE) PANIC("Invalid descriptor set handle!");
+/*
+ * Cached command buffers
+ *
+ * Mostly static scenes don't need a fresh command buffer every frame. In cached mode every (frame in flight,
+ * swap chain image) pair keeps its own primary command buffer, recorded inline. It is reused as long as it still
+ * describes the frame. Uniform slots are fixed per draw list item, so every frame only rewrites the UBO data,
+ * camera and time included. Re-recording only happens when one of these changes:
+ * - the visible draw list or the LODs picked for it
+ * - the push constants, apart from time
+ * - anything that bumps g_command_cache_generation: descriptor updates, pipelines or the swap chain
+ */
+typedef struct {
+    VkCommandBuffer command_buffer;
+    bool is_valid;
+    uint64_t generation;
+    PushConstants push_constants; // Values baked into the recording
+    uint32_t* draw_list; // g_model_bounds.visible at recording time
+    uint32_t* draw_lods; // g_model_lods of every draw_list entry
+    uint32_t num_draws;
+    uint32_t capacity_draws;
+} CachedCommandBuffer;
+
+CachedCommandBuffer* g_cached_command_buffers = NULL; // g_frames_in_flight * g_num_swap_chain_images, frame major
+uint32_t g_num_cached_command_buffers = 0;
+
+void createCachedCommandBuffers() {
+    g_num_cached_command_buffers = g_frames_in_flight * g_num_swap_chain_images;
+    g_cached_command_buffers = calloc(g_num_cached_command_buffers, sizeof(CachedCommandBuffer));
+    for (uint32_t i = 0; i < g_num_cached_command_buffers; i++) {
+        const VkCommandBufferAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = g_command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1};
+        if (vkAllocateCommandBuffers(g_device, &allocInfo, &g_cached_command_buffers[i].command_buffer) != VK_SUCCESS) PANIC("failed to allocate cached command buffers!");
+    }
+}
 
-        m_Models[j]->enqueueIntoCommandBuffer(commandBuffer, descriptorSet);
+void destroyCachedCommandBuffers() {
+    for (uint32_t i = 0; i < g_num_cached_command_buffers; i++) {
+        vkFreeCommandBuffers(g_device, g_command_pool, 1, &g_cached_command_buffers[i].command_buffer);
+        free(g_cached_command_buffers[i].draw_list);
+        free(g_cached_command_buffers[i].draw_lods);
     }
-    vkCmdEndRenderPass(commandBuffer);
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record command buffer!");
+    free(g_cached_command_buffers); g_cached_command_buffers = NULL;
+    g_num_cached_command_buffers = 0;
 }
 
-// Function to create the UBO
-UniformBufferObject get_UBO() {
-    if (g_start_time == 0) g_start_time = clock();
-    clock_t current_time = clock();
-    float delta_time = (float)(current_time - g_start_time) / CLOCKS_PER_SEC;
+bool CachedCommandBuffer_isCurrent(const CachedCommandBuffer* cached) {
+    if (!cached->is_valid || cached->generation != g_command_cache_generation) return false;
+    if (cached->num_draws != g_model_bounds.num_visible) return false;
+    if (memcmp(cached->draw_list, g_model_bounds.visible, cached->num_draws * sizeof(uint32_t)) != 0) return false;
+    for (uint32_t i = 0; i < cached->num_draws; i++) {
+        if (cached->draw_lods[i] != g_model_lods[cached->draw_list[i]]) return false;
+    }
 
-    mat4 view;
-    glm_lookat(g_camera_eye, g_camera_center, g_camera_up, view);
+    // Time keeps changing and is read from the UBO, everything else in the push constants is baked in
+    const PushConstants* recorded = &cached->push_constants;
+    return memcmp(recorded->cameraEye, g_push_constants.cameraEye, sizeof(vec3)) == 0
+        && memcmp(recorded->cameraCenter, g_push_constants.cameraCenter, sizeof(vec3)) == 0
+        && memcmp(recorded->cameraUp, g_push_constants.cameraUp, sizeof(vec3)) == 0
+        && recorded->stage == g_push_constants.stage;
+}
 
-    mat4 proj;
-    glm_perspective(PI_QUARTER, (float)(g_swap_chain_extent.width) / (float)(g_swap_chain_extent.height),
-                    CLIPPING_PLANE_NEAR, CLIPPING_PLANE_FAR, proj);
-    proj[1][1] *= -1; // Vulkan and OpenGL have opposite y orientation, and (c)glm is mainly written for openGL
+// Returns the cached command buffer of this frame and image, re-recorded if it went stale
+VkCommandBuffer getCachedCommandBuffer(const uint32_t imageIndex) {
+    CachedCommandBuffer* cached = &g_cached_command_buffers[g_current_frame_idx * g_num_swap_chain_images + imageIndex];
+    if (CachedCommandBuffer_isCurrent(cached)) {
+        // The recorded dynamic offsets stay valid, only the data behind them moves
+        const uint32_t num_items = getDrawListSize();
+        for (uint32_t item = 0; item < num_items; item++) writeDrawItemUniforms(item);
+        return cached->command_buffer;
+    }
 
-    mat4 model_matrix;
-    glm_mat4_identity(model_matrix);
+    vkResetCommandBuffer(cached->command_buffer, 0);
+    record_command_buffers(cached->command_buffer, imageIndex, false);
+
+    uint32_t capacity_draws = cached->capacity_draws;
+    growArray((void**)&cached->draw_list, &cached->capacity_draws, g_model_bounds.num_visible, sizeof(uint32_t));
+    growArray((void**)&cached->draw_lods, &capacity_draws, g_model_bounds.num_visible, sizeof(uint32_t));
+    memcpy(cached->draw_list, g_model_bounds.visible, g_model_bounds.num_visible * sizeof(uint32_t));
+    for (uint32_t i = 0; i < g_model_bounds.num_visible; i++) cached->draw_lods[i] = g_model_lods[g_model_bounds.visible[i]];
+    cached->num_draws = g_model_bounds.num_visible;
+    cached->push_constants = g_push_constants;
+    cached->generation = g_command_cache_generation;
+    cached->is_valid = true;
+    return cached->command_buffer;
+}
 
-    return UniformBufferObject_create(model_matrix, view, proj);
+/*
+ * Frame capture
+ *
+ * While capturing, every frame copies its resolved image into a slot of a ring of host visible readback buffers.
+ * The copy is recorded into a small command buffer of its own and submitted right behind the frame's commands, so
+ * cached and parallel recording stay untouched. Once drawFrame has waited on the frame's fence anyway, the slot is
+ * handed to g_capture_pool, which swizzles BGRA to RGBA and encodes PNG (stb_image_write) or QOI. The render thread
+ * never waits on the copies or the encoders. A frame that finds no free slot is dropped and counted instead.
+ */
+#define CAPTURE_RING_SIZE 8
+#define CAPTURE_NUM_WORKERS 3
+#define CAPTURE_PNG_COMPRESSION_LEVEL 1 // stb's default of 8 can't keep up with continuous recording
+#define CAPTURE_NO_SLOT UINT32_UNINITIALIZED_VALUE
+
+// BGRA to RGBA, swaps bytes 0 and 2 of every pixel. src and dst must not overlap.
+void swizzleBgraToRgba(const uint8_t* src, uint8_t* dst, const size_t num_pixels) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    for(; i + 8 <= num_pixels; i += 8) {
+        const __m256i pixels = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+        _mm256_storeu_si256((__m256i*)(dst + 4 * i), _mm256_shuffle_epi8(pixels, shuffle));
+    }
+#elif defined(__SSE2__)
+    // No byte shuffle without SSSE3, the two bytes are moved with shifts inside every 32 bit pixel instead
+    const __m128i green_alpha = _mm_set1_epi32((int)0xFF00FF00);
+    const __m128i low_byte = _mm_set1_epi32(0x000000FF);
+    for(; i + 4 <= num_pixels; i += 4) {
+        const __m128i pixels = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+        const __m128i red = _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte);
+        const __m128i blue = _mm_slli_epi32(_mm_and_si128(pixels, low_byte), 16);
+        _mm_storeu_si128((__m128i*)(dst + 4 * i), _mm_or_si128(_mm_and_si128(pixels, green_alpha), _mm_or_si128(red, blue)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for(; i + 16 <= num_pixels; i += 16) {
+        uint8x16x4_t pixels = vld4q_u8(src + 4 * i);
+        const uint8x16_t blue = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = blue;
+        vst4q_u8(dst + 4 * i, pixels);
+    }
+#endif
+    for(; i < num_pixels; i++) {
+        dst[4 * i + 0] = src[4 * i + 2];
+        dst[4 * i + 1] = src[4 * i + 1];
+        dst[4 * i + 2] = src[4 * i + 0];
+        dst[4 * i + 3] = src[4 * i + 3];
+    }
 }
 
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+void writeBigEndian32(uint8_t* out, const uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
 
-void drawFrame() {
+// Encodes RGBA pixels as QOI (https://qoiformat.org/qoi-specification.pdf), sRGB color with linear alpha
+//@DS:NEEDS_FREE_AFTER_USE
+uint8_t* encodeQoi(const uint8_t* rgba, const uint32_t width, const uint32_t height, size_t* out_size) {
+    static const uint8_t end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    const size_t num_pixels = (size_t)width * height;
+    uint8_t* out = malloc(QOI_HEADER_SIZE + num_pixels * 5 + sizeof(end_marker)); // Worst case is QOI_OP_RGBA for every pixel
+    memcpy(out, "qoif", 4);
+    writeBigEndian32(out + 4, width);
+    writeBigEndian32(out + 8, height);
+    out[12] = 4;
+    out[13] = 0;
+    size_t size = QOI_HEADER_SIZE;
+
+    uint8_t index[64][4];
+    memset(index, 0, sizeof(index));
+    uint8_t previous[4] = {0, 0, 0, 255};
+    uint32_t run = 0;
+    for(size_t i = 0; i < num_pixels; i++) {
+        const uint8_t* pixel = &rgba[4 * i];
+        if(memcmp(pixel, previous, 4) == 0) {
+            run += 1;
+            if(run == QOI_MAX_RUN || i == num_pixels - 1) {
+                out[size++] = (uint8_t)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0) {
+            out[size++] = (uint8_t)(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        const uint32_t hash = (pixel[0] * 3u + pixel[1] * 5u + pixel[2] * 7u + pixel[3] * 11u) % 64u;
+        if(memcmp(index[hash], pixel, 4) == 0) {
+            out[size++] = (uint8_t)(QOI_OP_INDEX | hash);
+        } else if(pixel[3] != previous[3]) {
+            memcpy(index[hash], pixel, 4);
+            out[size++] = QOI_OP_RGBA;
+            memcpy(&out[size], pixel, 4);
+            size += 4;
+        } else {
+            memcpy(index[hash], pixel, 4);
+            // Differences wrap around, the decoder adds them modulo 256 as well
+            const int8_t dr = (int8_t)(pixel[0] - previous[0]);
+            const int8_t dg = (int8_t)(pixel[1] - previous[1]);
+            const int8_t db = (int8_t)(pixel[2] - previous[2]);
+            const int8_t dr_dg = (int8_t)(dr - dg);
+            const int8_t db_dg = (int8_t)(db - dg);
+            if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[size++] = (uint8_t)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                out[size++] = (uint8_t)(QOI_OP_LUMA | (dg + 32));
+                out[size++] = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+            } else {
+                out[size++] = QOI_OP_RGB;
+                memcpy(&out[size], pixel, 3);
+                size += 3;
+            }
+        }
+        memcpy(previous, pixel, 4);
+    }
+    memcpy(&out[size], end_marker, sizeof(end_marker));
+    *out_size = size + sizeof(end_marker);
+    return out;
+}
+
+typedef enum {
+    CAPTURE_SLOT_FREE,
+    CAPTURE_SLOT_IN_FLIGHT, // Copy submitted, the frame's fence hasn't been waited on yet
+    CAPTURE_SLOT_ENCODING,  // Owned by a worker until it stores FREE
+} CaptureSlotState;
+
+typedef struct {
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    VkDeviceSize size; // Buffers are created on first use and grow with the extent
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_number;
+    CaptureSlotState state; // Accessed atomically
+} CaptureSlot;
+
+ThreadPool g_capture_pool;
+CaptureSlot g_capture_slots[CAPTURE_RING_SIZE];
+VkCommandBuffer g_capture_command_buffers[MAX_FRAMES_IN_FLIGHT];
+uint32_t g_frame_capture_slots[MAX_FRAMES_IN_FLIGHT]; // Slot each frame in flight copies into, CAPTURE_NO_SLOT if none
+bool g_capture_directory_created = false;
+uint32_t g_num_captured_frames = 0; // Written by the workers
+uint32_t g_num_dropped_frames = 0;
+
+void encodeCaptureJob(void* user_data) {
+    TRACE_FUNCTION();
+    CaptureSlot* slot = user_data;
+    const uint32_t width = slot->width;
+    const uint32_t height = slot->height;
+    const uint32_t frame_number = slot->frame_number;
+    uint8_t* rgba = malloc((size_t)width * height * 4);
+    swizzleBgraToRgba(slot->allocation.mapped, rgba, (size_t)width * height);
+    // The readback buffer can take the next frame while this one is still being encoded
+    __atomic_store_n(&slot->state, CAPTURE_SLOT_FREE, __ATOMIC_RELEASE);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/frame_%06u.%s", g_capture_directory, frame_number, g_capture_format == CAPTURE_FORMAT_PNG ? "png" : "qoi");
+    bool success;
+    if (g_capture_format == CAPTURE_FORMAT_PNG) {
+        success = stbi_write_png(path, (int)width, (int)height, 4, rgba, (int)width * 4) != 0;
+    } else {
+        size_t size = 0;
+        uint8_t* encoded = encodeQoi(rgba, width, height, &size);
+        FILE* file = fopen(path, "wb");
+        success = file != NULL;
+        if (success) {
+            success = fwrite(encoded, 1, size, file) == size;
+            success = (fclose(file) == 0) && success;
+        }
+        free(encoded);
+    }
+    free(rgba);
+
+    if (success) __atomic_add_fetch(&g_num_captured_frames, 1, __ATOMIC_RELAXED);
+    else fprintf(stderr, "Error: Failed to write captured frame to '%s': %s\n", path, strerror(errno));
+}
+
+void createFrameCapture() {
+    stbi_write_png_compression_level = CAPTURE_PNG_COMPRESSION_LEVEL;
+    const VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = g_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = g_frames_in_flight};
+    if (vkAllocateCommandBuffers(g_device, &allocInfo, g_capture_command_buffers) != VK_SUCCESS) PANIC("failed to allocate capture command buffers!");
+    for (uint32_t i = 0; i < g_frames_in_flight; i++) g_frame_capture_slots[i] = CAPTURE_NO_SLOT;
+    ThreadPool_create(&g_capture_pool, "Frame capture", CAPTURE_NUM_WORKERS);
+}
+
+// Hands the slot the frame copied into to the encoders, its fence must have been waited on
+void collectFrameCapture(const uint32_t frame_idx) {
+    const uint32_t slot_index = g_frame_capture_slots[frame_idx];
+    if (slot_index == CAPTURE_NO_SLOT) return;
+    g_frame_capture_slots[frame_idx] = CAPTURE_NO_SLOT;
+    __atomic_store_n(&g_capture_slots[slot_index].state, CAPTURE_SLOT_ENCODING, __ATOMIC_RELEASE);
+    ThreadPool_submit(&g_capture_pool, encodeCaptureJob, &g_capture_slots[slot_index]);
+}
+
+// Records the copy of this frame's image into a free slot, VK_NULL_HANDLE if nothing is captured
+VkCommandBuffer recordFrameCapture(const uint32_t imageIndex) {
+    if (!g_capture_enabled) return VK_NULL_HANDLE;
+    if (!g_capture_directory_created) {
+        if (mkdir(g_capture_directory, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Error: Failed to create capture directory '%s': %s\n", g_capture_directory, strerror(errno));
+            g_capture_enabled = false;
+            return VK_NULL_HANDLE;
+        }
+        g_capture_directory_created = true;
+    }
+
+    uint32_t slot_index = CAPTURE_NO_SLOT;
+    for (uint32_t i = 0; i < CAPTURE_RING_SIZE && slot_index == CAPTURE_NO_SLOT; i++) {
+        if (__atomic_load_n(&g_capture_slots[i].state, __ATOMIC_ACQUIRE) == CAPTURE_SLOT_FREE) slot_index = i;
+    }
+    if (slot_index == CAPTURE_NO_SLOT) {
+        g_num_dropped_frames += 1;
+        return VK_NULL_HANDLE;
+    }
+
+    CaptureSlot* slot = &g_capture_slots[slot_index];
+    const VkDeviceSize size = (VkDeviceSize)g_swap_chain_extent.width * g_swap_chain_extent.height * 4;
+    if (slot->size < size) {
+        if (slot->buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(g_device, slot->buffer, NULL);
+            GpuAllocator_free(&slot->allocation);
+        }
+        createBuffer(
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &slot->buffer,
+            &slot->allocation);
+        slot->size = size;
+    }
+    slot->width = g_swap_chain_extent.width;
+    slot->height = g_swap_chain_extent.height;
+    slot->frame_number = g_frame_counter;
+    slot->state = CAPTURE_SLOT_IN_FLIGHT;
+    g_frame_capture_slots[g_current_frame_idx] = slot_index;
+
+    VkCommandBuffer commandBuffer = g_capture_command_buffers[g_current_frame_idx];
+    vkResetCommandBuffer(commandBuffer, 0);
+    const VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) PANIC("failed to begin recording capture command buffer!");
+    const uint32_t capture_region = GpuProfiler_getRegion("Frame capture", GPU_PROFILER_NOT_INDEXED);
+    GpuProfiler_beginRegion(commandBuffer, capture_region);
+
+    // Headless targets already are in TRANSFER_SRC_OPTIMAL, swap chain images go back to PRESENT_SRC afterwards
+    const VkImageLayout finalLayout = g_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkImageMemoryBarrier imageBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = finalLayout,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = g_swap_chain_images[imageIndex],
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .baseMipLevel = 0, .levelCount = 1, .baseArrayLayer = 0, .layerCount = 1}};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+    const VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1},
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {slot->width, slot->height, 1}};
+    vkCmdCopyImageToBuffer(commandBuffer, g_swap_chain_images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+    if (!g_headless) {
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageBarrier.dstAccessMask = 0;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+    }
+
+    const VkBufferMemoryBarrier bufferBarrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slot->buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &bufferBarrier, 0, NULL);
+
+    GpuProfiler_endRegion(commandBuffer, capture_region);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) PANIC("failed to record capture command buffer!");
+    return commandBuffer;
+}
+
+// The device must be idle, every pending copy is encoded before the pool shuts down
+void destroyFrameCapture() {
+    for (uint32_t i = 0; i < g_frames_in_flight; i++) collectFrameCapture(i);
+    ThreadPool_destroy(&g_capture_pool);
+    if (g_num_captured_frames > 0 || g_num_dropped_frames > 0) {
+        printf("[[DS-CAPTURE]] Wrote %u frames to '%s', dropped %u\n", g_num_captured_frames, g_capture_directory, g_num_dropped_frames);
+    }
+
+    for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i++) {
+        if (g_capture_slots[i].buffer == VK_NULL_HANDLE) continue;
+        vkDestroyBuffer(g_device, g_capture_slots[i].buffer, NULL);
+        GpuAllocator_free(&g_capture_slots[i].allocation);
+    }
+    memset(g_capture_slots, 0, sizeof(g_capture_slots));
+    vkFreeCommandBuffers(g_device, g_command_pool, g_frames_in_flight, g_capture_command_buffers);
+}
+
+/*
+ * Swap chain recreation
+ *
+ * Resizing the window or moving it to another display leaves the swap chain out of date. The new one is created with
+ * the old one as oldSwapchain, so the presentation engine can hand over without tearing down in between. Only what
+ * is sized after the swap chain is rebuilt: its image views, the multisampled color and depth targets and the
+ * framebuffers. The render pass and the pipelines are kept, viewport and scissor are dynamic state.
+ * Frames in flight still reference the old objects. Instead of a vkDeviceWaitIdle they are retired together with the
+ * frame counter and destroyed once the fences of all frames submitted before the recreation have been waited on.
+ */
+#define MAX_RETIRED_SWAP_CHAINS 8 // Every frame in flight may retire one, plus repeated recreations without a frame
+
+typedef struct {
+    uint32_t retire_frame; // The first frame that no longer uses any of the objects below
+    VkSwapchainKHR swap_chain;
+    VkImage* images;
+    VkImageView* image_views;
+    uint32_t num_images;
+    VkFramebuffer* framebuffers;
+    uint32_t num_framebuffers;
+    VkImage color_image;
+    GpuAllocation color_image_allocation;
+    VkImageView color_image_view;
+    VkImage depth_image;
+    GpuAllocation depth_image_allocation;
+    VkImageView depth_image_view;
+} RetiredSwapChain;
+
+RetiredSwapChain g_retired_swap_chains[MAX_RETIRED_SWAP_CHAINS]; // Oldest first
+uint32_t g_num_retired_swap_chains = 0;
+
+// Reported once every retired swap chain is destroyed, a drag resize recreates the swap chain every frame
+uint32_t g_num_unreported_recreations = 0;
+double g_unreported_recreation_milliseconds = 0.0;
+
+void RetiredSwapChain_destroy(RetiredSwapChain* retired) {
+    for (uint32_t i = 0; i < retired->num_framebuffers; i++) vkDestroyFramebuffer(g_device, retired->framebuffers[i], NULL);
+    free(retired->framebuffers);
+    vkDestroyImageView(g_device, retired->color_image_view, NULL);
+    vkDestroyImage(g_device, retired->color_image, NULL);
+    GpuAllocator_free(&retired->color_image_allocation);
+    vkDestroyImageView(g_device, retired->depth_image_view, NULL);
+    vkDestroyImage(g_device, retired->depth_image, NULL);
+    GpuAllocator_free(&retired->depth_image_allocation);
+    for (uint32_t i = 0; i < retired->num_images; i++) vkDestroyImageView(g_device, retired->image_views[i], NULL);
+    free(retired->image_views);
+    free(retired->images); // Owned by the swap chain
+    vkDestroySwapchainKHR(g_device, retired->swap_chain, NULL);
+}
+
+// Destroys the retired swap chains no frame in flight uses anymore, all of them once the GPU is idle.
+// The current frame's fence must have been waited on, so every frame up to g_frame_counter - g_frames_in_flight is done.
+void releaseRetiredSwapChains(const bool release_all) {
+    uint32_t num_released = 0;
+    while (num_released < g_num_retired_swap_chains
+        && (release_all || g_retired_swap_chains[num_released].retire_frame + g_frames_in_flight <= g_frame_counter + 1)) {
+        RetiredSwapChain_destroy(&g_retired_swap_chains[num_released]);
+        num_released++;
+    }
+    g_num_retired_swap_chains -= num_released;
+    memmove(g_retired_swap_chains, g_retired_swap_chains + num_released, g_num_retired_swap_chains * sizeof(RetiredSwapChain));
+
+    if(g_num_retired_swap_chains == 0 && g_num_unreported_recreations > 0) {
+        printf("[[DS-SWAPCHAIN]] Recreated the swap chain %u times in %.3f milliseconds on average, now at %ux%u\n",
+               g_num_unreported_recreations, g_unreported_recreation_milliseconds / g_num_unreported_recreations,
+               g_swap_chain_extent.width, g_swap_chain_extent.height);
+        g_num_unreported_recreations = 0;
+        g_unreported_recreation_milliseconds = 0.0;
+    }
+}
+
+// Returns false while the window is minimized, nothing can be presented until it is restored
+bool recreateSwapChain() {
+    TRACE_FUNCTION();
+    int width = 0, height = 0;
+    SDL_Vulkan_GetDrawableSize(g_window, &width, &height);
+    if (width == 0 || height == 0) return false;
+
+    const double start_milliseconds = getMilliseconds();
+    if (g_num_retired_swap_chains == MAX_RETIRED_SWAP_CHAINS) {
+        // Only reached when the swap chain keeps going out of date while no frame gets submitted
+        vkWaitForFences(g_device, g_frames_in_flight, g_in_flight_fences, VK_TRUE, NO_TIMEOUT);
+        releaseRetiredSwapChains(true);
+    }
+
+    RetiredSwapChain* retired = &g_retired_swap_chains[g_num_retired_swap_chains++];
+    *retired = (RetiredSwapChain){
+        .retire_frame = g_frame_counter,
+        .swap_chain = g_swap_chain,
+        .images = g_swap_chain_images,
+        .image_views = g_swap_chain_image_views,
+        .num_images = g_num_swap_chain_image_views,
+        .framebuffers = g_swap_chain_framebuffers,
+        .num_framebuffers = g_num_swap_chain_framebuffers,
+        .color_image = g_color_image,
+        .color_image_allocation = g_color_image_allocation,
+        .color_image_view = g_color_image_view,
+        .depth_image = g_depth_image,
+        .depth_image_allocation = g_depth_image_allocation,
+        .depth_image_view = g_depth_image_view};
+    const VkFormat old_format = g_swap_chain_image_format;
+
+    g_is_recreating_swap_chain = true;
+    createSwapChain(retired->swap_chain);
+    if (g_swap_chain_image_format != old_format) PANIC("swap chain format changed, the render pass and the pipelines no longer match!");
+    createColorResources();
+    createDepthResources();
+    createFramebuffers();
+    g_is_recreating_swap_chain = false;
+
+    g_command_cache_generation++; // Cached command buffers were recorded against the old framebuffers
+    if (g_num_swap_chain_images != retired->num_images) {
+        // They are also indexed by swap chain image, and the ones of the other frames may still be pending
+        vkWaitForFences(g_device, g_frames_in_flight, g_in_flight_fences, VK_TRUE, NO_TIMEOUT);
+        destroyCachedCommandBuffers();
+        createCachedCommandBuffers();
+    }
+
+    g_num_unreported_recreations += 1;
+    g_unreported_recreation_milliseconds += getMilliseconds() - start_milliseconds;
+    return true;
+}
+
+/*
+ * Frame pacing
+ *
+ * Latency sensitive and throughput bound runs want opposite settings, so all of them are picked at startup:
+ * - --present-mode fifo|fifo-relaxed|mailbox|immediate, see chooseSwapPresentMode
+ * - --frames-in-flight 1 to MAX_FRAMES_IN_FLIGHT, how many frames the CPU may queue ahead of the GPU
+ * - --fps-limit N, an optional CPU side frame limiter
+ * FramePacer_waitForFrame runs before input is polled. It waits until the GPU finished the last frame that used the
+ * upcoming frame slot, so a GPU bound frame samples its input after waiting rather than before. With a limit it then
+ * sleeps until the frame's start time, which advances by one interval from the later of the previous start time and
+ * that GPU completion: a frame that fell behind starts right away without a burst of frames to catch up.
+ */
+#define FRAME_PACER_SPIN_MILLISECONDS 0.5 // Sleeps overshoot, the last stretch before a deadline is spun instead
+#define FRAME_PACER_STATS_INTERVAL 600 // Frames between two timing breakdowns
+
+uint32_t g_frame_limit_fps = 0; // 0 means unlimited
+double g_frame_pacer_next_start_milliseconds = 0.0;
+
+// Accumulated since the last breakdown
+double g_frame_pacer_gpu_wait_milliseconds = 0.0;
+double g_frame_pacer_sleep_milliseconds = 0.0;
+uint32_t g_frame_pacer_num_frames = 0;
+
+void sleepUntilMilliseconds(const double deadline_milliseconds) {
+    const double sleep_milliseconds = deadline_milliseconds - getMilliseconds() - FRAME_PACER_SPIN_MILLISECONDS;
+    if (sleep_milliseconds > 0.0) {
+        const struct timespec duration = {
+            .tv_sec = (time_t)(sleep_milliseconds * 1e-3),
+            .tv_nsec = (long)(fmod(sleep_milliseconds, 1000.0) * 1e6)};
+        nanosleep(&duration, NULL);
+    }
+    while (getMilliseconds() < deadline_milliseconds) {}
+}
+
+void FramePacer_waitForFrame() {
+    TRACE_FUNCTION();
+    const double wait_start_milliseconds = getMilliseconds();
     vkWaitForFences(g_device, 1, &g_in_flight_fences[g_current_frame_idx], VK_TRUE, NO_TIMEOUT);
+    const double gpu_done_milliseconds = getMilliseconds();
+    g_frame_pacer_gpu_wait_milliseconds += gpu_done_milliseconds - wait_start_milliseconds;
+
+    if (g_frame_limit_fps > 0) {
+        const double start_milliseconds = MAX(g_frame_pacer_next_start_milliseconds, gpu_done_milliseconds);
+        sleepUntilMilliseconds(start_milliseconds);
+        g_frame_pacer_sleep_milliseconds += getMilliseconds() - gpu_done_milliseconds;
+        g_frame_pacer_next_start_milliseconds = start_milliseconds + 1000.0 / g_frame_limit_fps;
+    }
 
-    uint32_t imageIndex = 0;
-    const VkResult resultNextImage = vkAcquireNextImageKHR(
-        g_device,
-        g_swap_chain,
-        NO_TIMEOUT,
-        g_image_available_semaphores[g_current_frame_idx],
-        VK_NULL_HANDLE,
-        &imageIndex);
-
-    if (resultNextImage == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreateSwapChain();
-        return;
+    g_frame_pacer_num_frames += 1;
+    if (g_frame_pacer_num_frames == FRAME_PACER_STATS_INTERVAL) {
+        printf("[[DS-PACING]] Last %u frames, waited %.3f milliseconds per frame for the GPU and slept %.3f for the limiter\n",
+               g_frame_pacer_num_frames, g_frame_pacer_gpu_wait_milliseconds / g_frame_pacer_num_frames, g_frame_pacer_sleep_milliseconds / g_frame_pacer_num_frames);
+        g_frame_pacer_gpu_wait_milliseconds = 0.0;
+        g_frame_pacer_sleep_milliseconds = 0.0;
+        g_frame_pacer_num_frames = 0;
     }
-    if (resultNextImage != VK_SUCCESS && resultNextImage != VK_SUBOPTIMAL_KHR) PANIC("failed to acquire swap chain image!");
+}
 
-    vkResetFences(g_device, 1, &g_in_flight_fences[g_current_frame_idx]);
+// The frame's fence must have been waited on, see FramePacer_waitForFrame
+void drawFrame() {
+    TRACE_FUNCTION();
+    const double cpu_begin_milliseconds = getMilliseconds();
+    collectFrameCapture(g_current_frame_idx);
+    GpuProfiler_collectFrame(g_current_frame_idx);
+
+    if (!g_headless) {
+        releaseRetiredSwapChains(false);
+        if (g_did_framebuffer_resize && recreateSwapChain()) g_did_framebuffer_resize = false;
+    }
 
-    vkResetCommandBuffer(g_command_buffers[g_current_frame_idx], 0);
-    record_command_buffers(g_command_buffers[g_current_frame_idx], imageIndex);
+    // Headless frames own their offscreen target, its previous use finished together with the fence
+    uint32_t imageIndex = g_current_frame_idx;
+    if (!g_headless) {
+        const VkResult resultNextImage = vkAcquireNextImageKHR(
+            g_device,
+            g_swap_chain,
+            NO_TIMEOUT,
+            g_image_available_semaphores[g_current_frame_idx],
+            VK_NULL_HANDLE,
+            &imageIndex);
+
+        if (resultNextImage == VK_ERROR_OUT_OF_DATE_KHR) {
+            // The fence was not reset, the next frame recreates the swap chain and reuses this frame slot
+            g_did_framebuffer_resize = true;
+            return;
+        }
+        if (resultNextImage != VK_SUCCESS && resultNextImage != VK_SUBOPTIMAL_KHR) PANIC("failed to acquire swap chain image!");
+    }
 
-    for (size_t i = 0; i < 2; i++) {
-        UniformBufferObject ubo = get_UBO();
-        const size_t bufferIndex = g_current_frame_idx * 2 + i;
-        memcpy(g_uniform_buffers_mapped[bufferIndex], &ubo, sizeof(ubo));
+    vkResetFences(g_device, 1, &g_in_flight_fences[g_current_frame_idx]);
+    DescriptorAllocator_reset(&g_frame_descriptor_allocators[g_current_frame_idx]);
+
+    updateFrameTextureDescriptors(g_current_frame_idx);
+    updateBindlessTextures(g_current_frame_idx);
+    prepareFrame();
+
+    VkCommandBuffer commandBuffer = g_command_buffers[g_current_frame_idx];
+    {
+        TRACE_ZONE("Record command buffers");
+        if (g_use_cached_command_buffers) {
+            commandBuffer = getCachedCommandBuffer(imageIndex);
+        } else {
+            vkResetCommandBuffer(commandBuffer, 0);
+            record_command_buffers(commandBuffer, imageIndex, true);
+        }
     }
+    VkCommandBuffer commandBuffers[] = {commandBuffer, recordFrameCapture(imageIndex)};
 
     VkSemaphore waitSemaphores[] = {g_image_available_semaphores[g_current_frame_idx]};
     VkPipelineStageFlags waitStages[] = {(VkPipelineStageFlags)(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)};
     VkSemaphore signalSemaphores[] = {g_render_finished_semaphores[g_current_frame_idx]};
-    const VkSubmitInfo submitInfo{
+    const VkSubmitInfo submitInfo = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
+        .waitSemaphoreCount = g_headless ? 0 : 1,
         .pWaitSemaphores = waitSemaphores,
         .pWaitDstStageMask = waitStages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &g_command_buffers[g_current_frame_idx],
-        .signalSemaphoreCount = 1,
+        .commandBufferCount = commandBuffers[1] != VK_NULL_HANDLE ? 2 : 1,
+        .pCommandBuffers = commandBuffers,
+        .signalSemaphoreCount = g_headless ? 0 : 1,
         .pSignalSemaphores = signalSemaphores};
 
     if (vkQueueSubmit(g_graphics_queue, 1, &submitInfo, g_in_flight_fences[g_current_frame_idx]) != VK_SUCCESS) PANIC("failed to submit draw command buffer!");
+    GpuProfiler_markSubmitted(g_current_frame_idx, cpu_begin_milliseconds, getMilliseconds());
+
+    if (g_headless) {
+        g_current_frame_idx = (g_current_frame_idx + 1) % g_frames_in_flight;
+        g_frame_counter += 1;
+        return;
+    }
 
     VkSwapchainKHR swapChains[] = {g_swap_chain};
-    const VkPresentInfoKHR presentInfo{
+    const VkPresentInfoKHR presentInfo = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
         .pWaitSemaphores = signalSemaphores,
@@ -2121,47 +8151,117 @@ void drawFrame() {
         .pImageIndices = &imageIndex,
         .pResults = NULL};
 
-    const VkResult resultQueue = vkQueuePresentKHR(g_presentation_queue, &presentInfo);
-    if (resultQueue == VK_ERROR_OUT_OF_DATE_KHR || resultQueue == VK_SUBOPTIMAL_KHR || g_did_framebuffer_resize) {
-        g_did_framebuffer_resize = false;
-        recreateSwapChain();
+    VkResult resultQueue;
+    {
+        TRACE_ZONE("Present");
+        resultQueue = vkQueuePresentKHR(g_presentation_queue, &presentInfo);
+    }
+    if (resultQueue == VK_ERROR_OUT_OF_DATE_KHR || resultQueue == VK_SUBOPTIMAL_KHR) {
+        g_did_framebuffer_resize = true;
     } else if (resultQueue != VK_SUCCESS) {
         PANIC("failed to present swap chain image!");
     }
 
-    g_current_frame_idx = (g_current_frame_idx + 1) % MAX_FRAMES_IN_FLIGHT;
+    g_current_frame_idx = (g_current_frame_idx + 1) % g_frames_in_flight;
     g_frame_counter += 1;
 }
 
-int main() {
+const char* g_cpu_trace_path = NULL; // Set with --cpu-trace, see "CPU tracing"
+
+void printUsageAndExit(const char* program) {
+    fprintf(stderr, "Usage: %s [--headless WIDTHxHEIGHT [--frames N] [--output PATH]] [--capture DIR [--capture-format png|qoi]] [--gpu-trace PATH] [--cpu-trace PATH]\n"
+                    "       [--present-mode fifo|fifo-relaxed|mailbox|immediate] [--frames-in-flight 1-%u] [--fps-limit N]\n", program, MAX_FRAMES_IN_FLIGHT);
+    exit(EXIT_FAILURE);
+}
+
+void parseCommandLine(const int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0 && has_value) {
+            uint32_t width = 0, height = 0;
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) printUsageAndExit(argv[0]);
+            g_headless = true;
+            g_headless_extent = (VkExtent2D){.width = width, .height = height};
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            if (sscanf(argv[++i], "%u", &g_headless_num_frames) != 1 || g_headless_num_frames == 0) printUsageAndExit(argv[0]);
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            g_headless_output_path = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+            g_capture_enabled = true;
+            g_capture_directory = argv[++i];
+        } else if (strcmp(argv[i], "--gpu-trace") == 0 && has_value) {
+            g_gpu_trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--cpu-trace") == 0 && has_value) {
+            g_cpu_trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--present-mode") == 0 && has_value) {
+            i += 1;
+            if (strcmp(argv[i], "fifo") == 0) g_requested_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+            else if (strcmp(argv[i], "fifo-relaxed") == 0) g_requested_present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            else if (strcmp(argv[i], "mailbox") == 0) g_requested_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+            else if (strcmp(argv[i], "immediate") == 0) g_requested_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            else printUsageAndExit(argv[0]);
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && has_value) {
+            if (sscanf(argv[++i], "%u", &g_frames_in_flight) != 1 || g_frames_in_flight == 0 || g_frames_in_flight > MAX_FRAMES_IN_FLIGHT) printUsageAndExit(argv[0]);
+        } else if (strcmp(argv[i], "--fps-limit") == 0 && has_value) {
+            if (sscanf(argv[++i], "%u", &g_frame_limit_fps) != 1) printUsageAndExit(argv[0]);
+        } else if (strcmp(argv[i], "--capture-format") == 0 && has_value) {
+            i += 1;
+            if (strcmp(argv[i], "png") == 0) g_capture_format = CAPTURE_FORMAT_PNG;
+            else if (strcmp(argv[i], "qoi") == 0) g_capture_format = CAPTURE_FORMAT_QOI;
+            else printUsageAndExit(argv[0]);
+        } else {
+            printUsageAndExit(argv[0]);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    parseCommandLine(argc, argv);
+    TRACE_START(g_cpu_trace_path);
+
     /*
      * Start of Initialization
      */
-    printf("Initializing window.\n");
-    initWindow();
+    if(!g_headless) {
+        printf("Initializing window.\n");
+        initWindow();
+    }
     printf("Initializing Instance.\n");
     initInstance();
 
-    printf("Creating Vulkan Surface.\n");
-    if(!SDL_Vulkan_CreateSurface(g_window, g_instance, &g_surface)) PANIC("Failed to bind SDL window to VkSurface.");
+    if(!g_headless) {
+        printf("Creating Vulkan Surface.\n");
+        if(!SDL_Vulkan_CreateSurface(g_window, g_instance, &g_surface)) PANIC("Failed to bind SDL window to VkSurface.");
+    }
 
     printf("Picking Physical Device.\n");
     pickPhysicalDevice();
 
     printf("Creating Logical Device.\n");
     createLogicalDevice();
+    GpuAllocator_init();
 
-    printf("Creating Swap chain.\n");
-    createSwapChain();
+    if(g_headless) {
+        printf("Creating %ux%u offscreen targets.\n", g_headless_extent.width, g_headless_extent.height);
+        createOffscreenTargets();
+    } else {
+        printf("Creating Swap chain.\n");
+        createSwapChain(VK_NULL_HANDLE);
+    }
 
     printf("Creating Render Pass.\n");
     createRenderPass();
 
     printf("Creating descriptor set layout.\n");
     createDescriptorSetLayout();
+    createDescriptorAllocators();
+
+    printf("Creating Pipeline cache.\n");
+    createPipelineCache();
 
     printf("Creating Graphics Pipeline.\n");
     createGraphicsPipeline();
+    createCullingPipeline();
 
     printf("Creating Command Pool.\n");
     createCommandPool();
@@ -2173,13 +8273,22 @@ int main() {
     printf("Creating Framebuffers.\n");
     createFramebuffers();
 
-    printf("Creating Texture image.\n");
+    printf("Starting Texture streaming.\n");
+    createTextureStreaming();
+    g_diffuse_texture = requestTexture("./assets/textures/painted_plaster_diffuse.png");
+
+    printf("Creating fallback Texture image.\n");
     createTextureImage();
     printf("Creating Texture image View.\n");
     createTextureImageView();
     printf("Creating Texture Sampler\n");
     createTextureSampler();
 
+    // Before the models, GPU culled batches point their descriptors at the frame uniform rings
+    createUniformBuffers();
+    // Before the models as well, bindless instanced models store their InstanceData in the object record buffer
+    createBindlessResources();
+
     printf("Instantiating Models!\n");
     Transform torus_transform = {
         {0.0f, 0.0f, 0.0f},
@@ -2190,26 +8299,80 @@ int main() {
         {3.0f, 0.0f, 0.0f},
         {0.0f, 0.0f, 0.0f, 1.0f},
         {1.0f, 1.0f, 1.0f}};
-    printf("Successfully instantiated Models!\n");
 
-    createUniformBuffers();
+    createModel("./assets/models/torus.obj", &torus_transform, SCENE_NO_PARENT, &g_models[0]);
+    createModel("./assets/models/sphere.obj", &sphere_transform, g_models[0].scene_node, &g_models[1]);
+
+    // A floor of small spheres below the scene (+Z is up, see g_camera_up), all of them are drawn by a single instanced draw call
+    Transform sphere_grid[INSTANCED_GRID_SIZE * INSTANCED_GRID_SIZE];
+    for(uint32_t y = 0; y < INSTANCED_GRID_SIZE; y++) {
+        for(uint32_t x = 0; x < INSTANCED_GRID_SIZE; x++) {
+            const float half_extent = 0.5f * (float)(INSTANCED_GRID_SIZE - 1) * INSTANCED_GRID_SPACING;
+            sphere_grid[y * INSTANCED_GRID_SIZE + x] = (Transform){
+                {(float)x * INSTANCED_GRID_SPACING - half_extent, (float)y * INSTANCED_GRID_SPACING - half_extent, -3.0f},
+                {0.0f, 0.0f, 0.0f, 1.0f},
+                {0.25f, 0.25f, 0.25f}};
+        }
+    }
+    uint32_t sphere_grid_textures[INSTANCED_GRID_SIZE * INSTANCED_GRID_SIZE];
+    for(uint32_t i = 0; i < INSTANCED_GRID_SIZE * INSTANCED_GRID_SIZE; i++) sphere_grid_textures[i] = g_diffuse_texture;
+    createInstancedModel("./assets/models/sphere.obj", sphere_grid, sphere_grid_textures, INSTANCED_GRID_SIZE * INSTANCED_GRID_SIZE, &g_instanced_spheres);
+
+    Scene_update(&g_scene);
+    for(uint32_t i = 0; i < NUM_MODELS; i++) {
+        vec4 bounds;
+        Model_getWorldBoundingSphere(&g_models[i], g_scene.world_matrices[g_models[i].scene_node], bounds);
+        SphereSet_add(&g_model_bounds, bounds);
+    }
+    printf("Successfully instantiated Models!\n");
 
-    createDescriptorPool();
     createDescriptorSets();
 
     createCommandBuffers();
+    createCachedCommandBuffers();
+    createCommandRecorders();
+    createFrameCapture();
+    createGpuProfiler();
     createSyncObjects();
+    GpuAllocator_printStats();
     /*
      * End of Initialization
      */
 
     SDL_Event e;
     g_is_running = true;
+    const double start_milliseconds = getMilliseconds();
     while (g_is_running){
-        while (SDL_PollEvent(&e)){
-            handleInput(e);
+        // Nothing is presented to a minimized window, block on its events instead of spinning
+        while (!g_headless && g_is_running && (SDL_GetWindowFlags(g_window) & SDL_WINDOW_MINIMIZED)) {
+            if (SDL_WaitEvent(&e)) handleInput(e);
+        }
+        FramePacer_waitForFrame();
+        if (g_headless) {
+            g_is_running = g_frame_counter + 1 < g_headless_num_frames;
+        } else {
+            while (SDL_PollEvent(&e)){
+                handleInput(e);
+            }
         }
+        updateTextureStreaming();
+        updateScene();
+
+        const uint64_t allocations_before_frame = getThreadAllocationCount();
         drawFrame();
+        g_frame_allocations = getThreadAllocationCount() - allocations_before_frame;
+        if (MEMORY_ASSERT_NO_FRAME_ALLOCATIONS && g_frame_counter > MEMORY_STEADY_STATE_FRAME && g_frame_allocations > 0) {
+            PANIC("Frame %u allocated %llu times on the main thread, see the call sites in a debug build's [[DS-MEMORY]] report", g_frame_counter, (unsigned long long)g_frame_allocations);
+        }
+    }
+    vkDeviceWaitIdle(g_device);
+
+    if (g_headless) {
+        const double seconds = (getMilliseconds() - start_milliseconds) * 1e-3;
+        printf("[[DS-HEADLESS]] Rendered %u frames at %ux%u in %.3f seconds, %.1f frames per second\n",
+               g_frame_counter, g_swap_chain_extent.width, g_swap_chain_extent.height, seconds, g_frame_counter / seconds);
+        const uint32_t last_image_index = (g_current_frame_idx + g_frames_in_flight - 1) % g_frames_in_flight;
+        if (writeOffscreenTarget(last_image_index, g_headless_output_path)) printf("Wrote the last frame to '%s'.\n", g_headless_output_path);
     }
 
     /*
@@ -2220,30 +8383,49 @@ int main() {
     for(size_t i = 0; i < g_num_in_flight_fences; i++) vkDestroyFence(g_device, g_in_flight_fences[i], NULL);
     free(g_image_available_semaphores); free(g_render_finished_semaphores); free(g_in_flight_fences);
 
+    destroyGpuProfiler();
+    destroyFrameCapture();
+    destroyCommandRecorders();
+    destroyCachedCommandBuffers();
     vkFreeCommandBuffers(g_device, g_command_pool, g_num_command_buffers, g_command_buffers);
     free(g_command_buffers); g_command_buffers = VK_NULL_HANDLE;
 
     free(g_descriptor_sets); g_descriptor_sets = VK_NULL_HANDLE;
-    vkDestroyDescriptorPool(g_device, g_descriptor_pool, NULL);
 
     cleanupUniformBuffers();
 
+    for(size_t i = 0; i < NUM_MODELS; i++) destroyModel(&g_models[i]);
+    SphereSet_free(&g_model_bounds);
+    Scene_free(&g_scene);
+    destroyInstancedModel(&g_instanced_spheres);
+    destroyBindlessResources();
+    destroyDescriptorAllocators();
+
+    destroyTextureStreaming();
+
     vkDestroySampler(g_device, g_texture_sampler, NULL); g_texture_sampler = VK_NULL_HANDLE;
     vkDestroyImageView(g_device, g_texture_image_view, NULL); g_texture_image_view = VK_NULL_HANDLE;
-    vkFreeMemory(g_device, g_texture_image_memory, NULL); g_texture_image_memory = VK_NULL_HANDLE;
+    GpuAllocator_free(&g_texture_image_allocation);
     vkDestroyImage(g_device, g_texture_image, NULL); g_texture_image = VK_NULL_HANDLE;
 
     vkDestroyCommandPool        (g_device, g_command_pool          , NULL); g_command_pool          = VK_NULL_HANDLE;
     vkDestroyPipeline           (g_device, g_graphics_pipeline     , NULL); g_graphics_pipeline     = VK_NULL_HANDLE;
+    vkDestroyPipeline           (g_device, g_instanced_pipeline    , NULL); g_instanced_pipeline    = VK_NULL_HANDLE;
+    vkDestroyPipeline           (g_device, g_bindless_pipeline     , NULL); g_bindless_pipeline     = VK_NULL_HANDLE;
+    destroyCullingPipeline();
+    savePipelineCache();
+    vkDestroyPipelineCache      (g_device, g_pipeline_cache        , NULL); g_pipeline_cache        = VK_NULL_HANDLE;
     vkDestroyPipelineLayout     (g_device, g_pipeline_layout       , NULL); g_pipeline_layout       = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout     (g_device, g_bindless_pipeline_layout, NULL); g_bindless_pipeline_layout = VK_NULL_HANDLE;
     vkDestroyDescriptorSetLayout(g_device, g_descriptor_set_layout , NULL); g_descriptor_set_layout = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(g_device, g_bindless_descriptor_set_layout, NULL); g_bindless_descriptor_set_layout = VK_NULL_HANDLE;
     vkDestroyRenderPass         (g_device, g_render_pass           , NULL); g_render_pass           = VK_NULL_HANDLE;
     vkDestroyImage              (g_device, g_color_image           , NULL); g_color_image           = VK_NULL_HANDLE;
     vkDestroyImageView          (g_device, g_color_image_view      , NULL); g_color_image_view      = VK_NULL_HANDLE;
-    vkFreeMemory                (g_device, g_color_image_memory    , NULL); g_color_image_memory    = VK_NULL_HANDLE;
     vkDestroyImage              (g_device, g_depth_image           , NULL); g_depth_image           = VK_NULL_HANDLE;
     vkDestroyImageView          (g_device, g_depth_image_view      , NULL); g_depth_image_view      = VK_NULL_HANDLE;
-    vkFreeMemory                (g_device, g_depth_image_memory    , NULL); g_depth_image_memory    = VK_NULL_HANDLE;
+    GpuAllocator_free(&g_color_image_allocation);
+    GpuAllocator_free(&g_depth_image_allocation);
 
     for (size_t i = 0; i < g_num_swap_chain_images; i++) vkDestroyImageView(g_device, g_swap_chain_image_views[i], NULL);
     free(g_swap_chain_image_views); g_swap_chain_image_views = NULL;
@@ -2251,12 +8433,19 @@ int main() {
     for (size_t i = 0; i < g_num_swap_chain_framebuffers; i++) vkDestroyFramebuffer(g_device, g_swap_chain_framebuffers[i], NULL);
     free(g_swap_chain_framebuffers); g_swap_chain_framebuffers = NULL;
 
+    if (g_headless) destroyOffscreenTargets();
     free(g_swap_chain_images); g_swap_chain_images = NULL;
 
-    vkDestroySwapchainKHR(g_device, g_swap_chain, NULL); g_swap_chain = VK_NULL_HANDLE;
+    if (!g_headless) {
+        releaseRetiredSwapChains(true);
+        vkDestroySwapchainKHR(g_device, g_swap_chain, NULL); g_swap_chain = VK_NULL_HANDLE;
+    }
+    GpuAllocator_destroy();
     vkDestroyDevice      (g_device, NULL); g_device = VK_NULL_HANDLE;
 
-    vkDestroySurfaceKHR(g_instance, g_surface, NULL); g_surface = VK_NULL_HANDLE;
+    if (!g_headless) {
+        vkDestroySurfaceKHR(g_instance, g_surface, NULL); g_surface = VK_NULL_HANDLE;
+    }
 
     const PFN_vkDestroyDebugUtilsMessengerEXT func = (PFN_vkDestroyDebugUtilsMessengerEXT)
         (vkGetInstanceProcAddr(g_instance, "vkDestroyDebugUtilsMessengerEXT"));
@@ -2272,9 +8461,13 @@ int main() {
         SDL_DestroyWindow(g_window);
         g_window = NULL;
     }
-    SDL_Quit();
-    printf("Shut down SDL.\n");
+    if (!g_headless) {
+        SDL_Quit();
+        printf("Shut down SDL.\n");
+    }
 
+    TRACE_STOP();
+    printMemoryReport();
     printf("Program finished running, Goodbye!\n");
     return EXIT_SUCCESS;
 }
\ No newline at end of file